@@ -184,6 +184,11 @@ void DummyMediaWidget::seek(int time)
 	Q_UNUSED(time)
 }
 
+void DummyMediaWidget::seekPosition(float position)
+{
+	Q_UNUSED(position)
+}
+
 void DummyMediaWidget::setCurrentAudioStream(int currentAudioStream)
 {
 	Q_UNUSED(currentAudioStream)
@@ -60,6 +60,7 @@ public:
 	virtual void stop() = 0;
 	virtual void setPaused(bool paused) = 0;
 	virtual void seek(int time) = 0; // milliseconds
+	virtual void seekPosition(float position) = 0; // [0 - 1] relative to the file size
 	virtual void setCurrentAudioStream(int currentAudioStream) = 0;
 	virtual void setCurrentSubtitle(int currentSubtitle) = 0;
     virtual void setExternalSubtitle(const QUrl &subtitleUrl) = 0;
@@ -144,6 +145,7 @@ public:
 	void stop();
 	void setPaused(bool paused);
 	void seek(int time); // milliseconds
+	void seekPosition(float position); // [0 - 1] relative to the file size
 	void setCurrentAudioStream(int currentAudioStream);
 	void setCurrentSubtitle(int currentSubtitle);
     void setExternalSubtitle(const QUrl &subtitleUrl);
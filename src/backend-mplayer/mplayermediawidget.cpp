@@ -173,6 +173,13 @@ void MPlayerMediaWidget::seek(int time)
 		QByteArray::number(float(time) / 1000) + '\n');
 }
 
+void MPlayerMediaWidget::seekPosition(float position)
+{
+	// percent; the default format only has 6 significant digits
+	process.write("pausing_keep_force seek " +
+		QByteArray::number(100 * double(position), 'f', 6) + " 1\n");
+}
+
 void MPlayerMediaWidget::setCurrentAudioStream(int currentAudioStream)
 {
 	if ((currentAudioStream >= 0) && (currentAudioStream < audioIds.size())) {
@@ -45,6 +45,7 @@ public:
 	void stop();
 	void setPaused(bool paused);
 	void seek(int time); // milliseconds
+	void seekPosition(float position); // [0 - 1] relative to the file size
 	void setCurrentAudioStream(int currentAudioStream);
 	void setCurrentSubtitle(int currentSubtitle);
 	void setExternalSubtitle(const KUrl &subtitleUrl);
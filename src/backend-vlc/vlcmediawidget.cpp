@@ -232,6 +232,12 @@ void VlcMediaWidget::seek(int time)
 	libvlc_media_player_set_time(vlcMediaPlayer, time);
 }
 
+void VlcMediaWidget::seekPosition(float position)
+{
+	// the ts demuxer maps the position directly to a byte offset
+	libvlc_media_player_set_position(vlcMediaPlayer, position);
+}
+
 void VlcMediaWidget::setCurrentAudioStream(int currentAudioStream)
 {
 	// skip the 'deactivate' audio channel
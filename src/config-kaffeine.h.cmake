@@ -7,5 +7,6 @@
 #define KAFFEINE_DATA_INSTALL_DIR "${DATA_INSTALL_DIR}"
 #define KAFFEINE_LIB_INSTALL_DIR "${LIB_INSTALL_DIR}"
 #define HAVE_DVB @HAVE_DVB@
+#define HAVE_IO_URING @HAVE_IO_URING@
 
 #endif /* CONFIG_KAFFEINE_H */
@@ -23,6 +23,7 @@
 #include <QDBusMetaType>
 #include <K4AboutData>
 #include <KApplication>
+#include "dvb/dvbepg.h"
 #include "dvb/dvbmanager.h"
 #include "dvb/dvbtab.h"
 #include "playlist/playlisttab.h"
@@ -80,6 +81,26 @@ static const QDBusArgument &operator>>(const QDBusArgument &argument,
 	return argument;
 }
 
+static QDBusArgument &operator<<(QDBusArgument &argument,
+	const TelevisionProgramGuideEntryStruct &entry)
+{
+	argument.beginStructure();
+	argument << entry.channel << entry.begin << entry.duration << entry.title <<
+		entry.subheading << entry.details;
+	argument.endStructure();
+	return argument;
+}
+
+static const QDBusArgument &operator>>(const QDBusArgument &argument,
+	TelevisionProgramGuideEntryStruct &entry)
+{
+	argument.beginStructure();
+	argument >> entry.channel >> entry.begin >> entry.duration >> entry.title >>
+		entry.subheading >> entry.details;
+	argument.endStructure();
+	return argument;
+}
+
 MprisRootObject::MprisRootObject(QObject *parent) : QObject(parent)
 {
 	 qDBusRegisterMetaType<MprisVersionStruct>();
@@ -317,11 +338,27 @@ void MprisTrackListObject::SetRandom(bool random)
 
 #if HAVE_DVB == 1
 
+static TelevisionProgramGuideEntryStruct toProgramGuideEntry(const DvbSharedEpgEntry &epgEntry)
+{
+	TelevisionProgramGuideEntryStruct entry;
+	entry.channel = epgEntry->channel->name;
+	entry.begin = (epgEntry->begin.toString(Qt::ISODate) + QLatin1Char('Z'));
+	entry.duration = epgEntry->duration.toString(Qt::ISODate);
+	entry.title = epgEntry->title;
+	entry.subheading = epgEntry->subheading;
+	entry.details = epgEntry->details;
+	return entry;
+}
+
 DBusTelevisionObject::DBusTelevisionObject(DvbTab *dvbTab_, QObject *parent) : QObject(parent),
 	dvbTab(dvbTab_)
 {
 	qDBusRegisterMetaType<TelevisionScheduleEntryStruct>();
 	qDBusRegisterMetaType<QList<TelevisionScheduleEntryStruct> >();
+	qDBusRegisterMetaType<TelevisionProgramGuideEntryStruct>();
+	qDBusRegisterMetaType<QList<TelevisionProgramGuideEntryStruct> >();
+	connect(dvbTab->getManager()->getEpgModel(), SIGNAL(currentNextChanged(DvbSharedChannel)),
+		this, SLOT(currentNextChanged(DvbSharedChannel)));
 }
 
 DBusTelevisionObject::~DBusTelevisionObject()
@@ -406,4 +443,36 @@ void DBusTelevisionObject::RemoveProgram(quint32 key)
 	}
 }
 
+QList<TelevisionProgramGuideEntryStruct> DBusTelevisionObject::SearchProgramGuide(
+	const QString &query)
+{
+	QList<TelevisionProgramGuideEntryStruct> entries;
+
+	foreach (const DvbSharedEpgEntry &epgEntry,
+		 dvbTab->getManager()->getEpgModel()->findEntries(query)) {
+		entries.append(toProgramGuideEntry(epgEntry));
+	}
+
+	return entries;
+}
+
+QList<TelevisionProgramGuideEntryStruct> DBusTelevisionObject::GetCurrentNextPrograms(
+	const QString &channel)
+{
+	DvbManager *manager = dvbTab->getManager();
+	QList<TelevisionProgramGuideEntryStruct> entries;
+
+	foreach (const DvbSharedEpgEntry &epgEntry, manager->getEpgModel()->getCurrentNext(
+		 manager->getChannelModel()->findChannelByName(channel))) {
+		entries.append(toProgramGuideEntry(epgEntry));
+	}
+
+	return entries;
+}
+
+void DBusTelevisionObject::currentNextChanged(const DvbSharedChannel &channel)
+{
+	emit CurrentNextProgramsChanged(channel->name);
+}
+
 #endif /* HAVE_DVB == 1 */
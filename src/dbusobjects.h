@@ -23,6 +23,9 @@
 
 #include <QVariantMap>
 #include <config-kaffeine.h>
+#if HAVE_DVB == 1
+#include "dvb/dvbchannel.h"
+#endif /* HAVE_DVB == 1 */
 
 class DvbTab;
 class MainWindow;
@@ -32,6 +35,7 @@ class PlaylistTab;
 struct MprisStatusStruct;
 struct MprisVersionStruct;
 struct TelevisionScheduleEntryStruct;
+struct TelevisionProgramGuideEntryStruct;
 
 class MprisRootObject : public QObject
 {
@@ -154,6 +158,15 @@ public slots:
 	quint32 ScheduleProgram(const QString &name, const QString &channel, const QString &begin,
 		const QString &duration, int repeat);
 	void RemoveProgram(quint32 key);
+	QList<TelevisionProgramGuideEntryStruct> SearchProgramGuide(const QString &query);
+	// the running (or else the upcoming) program and the program after it
+	QList<TelevisionProgramGuideEntryStruct> GetCurrentNextPrograms(const QString &channel);
+
+signals:
+	void CurrentNextProgramsChanged(const QString &channel);
+
+private slots:
+	void currentNextChanged(const DvbSharedChannel &channel);
 
 private:
 	DvbTab *dvbTab;
@@ -193,4 +206,17 @@ struct TelevisionScheduleEntryStruct
 Q_DECLARE_METATYPE(TelevisionScheduleEntryStruct)
 Q_DECLARE_METATYPE(QList<TelevisionScheduleEntryStruct>)
 
+struct TelevisionProgramGuideEntryStruct
+{
+	QString channel;
+	QString begin;
+	QString duration;
+	QString title;
+	QString subheading;
+	QString details;
+};
+
+Q_DECLARE_METATYPE(TelevisionProgramGuideEntryStruct)
+Q_DECLARE_METATYPE(QList<TelevisionProgramGuideEntryStruct>)
+
 #endif /* DBUSOBJECTS_H */
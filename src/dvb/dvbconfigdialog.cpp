@@ -100,6 +100,13 @@ DvbConfigDialog::DvbConfigDialog(DvbManager *manager_, QWidget *parent) : KDialo
 	override6937CharsetBox = new QCheckBox(widget);
 	override6937CharsetBox->setChecked(manager->override6937Charset());
 	gridLayout->addWidget(override6937CharsetBox, 1, 1);
+
+	gridLayout->addWidget(new QLabel(i18n("Collect the program guide with idle devices:")),
+		2, 0);
+
+	epgHarvestingBox = new QCheckBox(widget);
+	epgHarvestingBox->setChecked(manager->getEpgHarvesting());
+	gridLayout->addWidget(epgHarvestingBox, 2, 1);
 	boxLayout->addLayout(gridLayout);
 
 	QFrame *frame = new QFrame(widget);
@@ -351,6 +358,7 @@ void DvbConfigDialog::accept()
 	manager->setBeginMargin(beginMarginBox->value() * 60);
 	manager->setEndMargin(endMarginBox->value() * 60);
 	manager->setOverride6937Charset(override6937CharsetBox->isChecked());
+	manager->setEpgHarvesting(epgHarvestingBox->isChecked());
 
 	bool latitudeOk;
 	bool longitudeOk;
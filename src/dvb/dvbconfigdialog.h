@@ -78,6 +78,7 @@ private:
 	QSpinBox *beginMarginBox;
 	QSpinBox *endMarginBox;
 	QCheckBox *override6937CharsetBox;
+	QCheckBox *epgHarvestingBox;
 	KLineEdit *latitudeEdit;
 	KLineEdit *longitudeEdit;
 	QPixmap validPixmap;
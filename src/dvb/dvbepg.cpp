@@ -21,7 +21,10 @@
 #include "dvbepg.h"
 #include "dvbepg_p.h"
 
+#include <QDataStream>
 #include <QFile>
+#include <QSet>
+#include <QVariant>
 #include <KStandardDirs>
 #include "../ensurenopendingoperation.h"
 #include "../log.h"
@@ -29,50 +32,19 @@
 #include "dvbmanager.h"
 #include "dvbsi.h"
 
-bool DvbEpgEntry::validate() const
-{
-	if (channel.isValid() && begin.isValid() && (begin.timeSpec() == Qt::UTC) &&
-	    duration.isValid()) {
-		return true;
-	}
-
-	return false;
-}
-
-bool DvbEpgEntryId::operator<(const DvbEpgEntryId &other) const
-{
-	if (entry->channel != other.entry->channel) {
-		return (entry->channel < other.entry->channel);
-	}
-
-	if (entry->begin != other.entry->begin) {
-		return (entry->begin < other.entry->begin);
-	}
-
-	if (entry->duration != other.entry->duration) {
-		return (entry->duration < other.entry->duration);
-	}
-
-	if (entry->title != other.entry->title) {
-		return (entry->title < other.entry->title);
-	}
-
-	if (entry->subheading != other.entry->subheading) {
-		return (entry->subheading < other.entry->subheading);
-	}
-
-	if (!entry->details.isEmpty() && !other.entry->details.isEmpty()) {
-		return (entry->details < other.entry->details);
-	}
-
-	return false;
-}
+static const qint64 NoTransition = Q_INT64_C(0x7fffffffffffffff);
 
 DvbEpgModel::DvbEpgModel(DvbManager *manager_, QObject *parent) : QObject(parent),
-	manager(manager_), hasPendingOperation(false)
+	manager(manager_), currentNextTransition(NoTransition),
+	hasPendingOperation(false)
 {
 	currentDateTimeUtc = QDateTime::currentDateTime().toUTC();
 	startTimer(54000);
+	currentNextTimer.setSingleShot(true);
+	connect(&currentNextTimer, SIGNAL(timeout()), this, SLOT(updateCurrentNext()));
+	batchTimer.setSingleShot(true);
+	batchTimer.setInterval(BatchInterval);
+	connect(&batchTimer, SIGNAL(timeout()), this, SLOT(flushPendingEntries()));
 
 	DvbChannelModel *channelModel = manager->getChannelModel();
 	connect(channelModel, SIGNAL(channelAboutToBeUpdated(DvbSharedChannel)),
@@ -84,12 +56,31 @@ DvbEpgModel::DvbEpgModel(DvbManager *manager_, QObject *parent) : QObject(parent
 	connect(manager->getRecordingModel(), SIGNAL(recordingRemoved(DvbSharedRecording)),
 		this, SLOT(recordingRemoved(DvbSharedRecording)));
 
-	// TODO use SQL to store epg data
+	// only the current part of the epg is loaded at startup; the rest is loaded on demand
+	qint64 now = currentDateTimeUtc.toTime_t();
+	QString loadCondition = QLatin1String("End > ") + QString::number(now) +
+		QLatin1String(" AND Begin < ") + QString::number(now + StartupWindow);
+	pendingLoadCondition = QLatin1String("Begin >= ") + QString::number(now + StartupWindow);
+	sqlInit(QLatin1String("EpgEntries"),
+		QStringList() << QLatin1String("Channel") << QLatin1String("Begin") <<
+		QLatin1String("Duration") << QLatin1String("End") << QLatin1String("Title") <<
+		QLatin1String("Subheading") << QLatin1String("Details") << QLatin1String("Recording") <<
+		QLatin1String("EventId"),
+		QStringList() << QLatin1String("Channel") << QLatin1String("Begin") <<
+		QLatin1String("End"), loadCondition);
+	// the expired entries are removed with one statement (instead of loading them)
+	sqlDelete(QLatin1String("End <= ") + QString::number(now));
+
+	// compatibility code
 
 	QFile file(KStandardDirs::locateLocal("appdata", QLatin1String("epgdata.dvb")));
 
+	if (!file.exists()) {
+		return;
+	}
+
 	if (!file.open(QIODevice::ReadOnly)) {
-		Log("DvbEpgModel::DvbEpgModel: cannot open") << file.fileName();
+		Log("DvbEpgModel::DvbEpgModel: cannot open file") << file.fileName();
 		return;
 	}
 
@@ -104,10 +95,10 @@ DvbEpgModel::DvbEpgModel(DvbManager *manager_, QObject *parent) : QObject(parent
 		hasRecordingKey = false;
 	} else if (version != 0x79cffd36) {
 		Log("DvbEpgModel::DvbEpgModel: wrong version") << file.fileName();
-		return;
+		version = 0;
 	}
 
-	while (!stream.atEnd()) {
+	while ((version != 0) && !stream.atEnd()) {
 		DvbEpgEntry entry;
 		QString channelName;
 		stream >> channelName;
@@ -135,6 +126,10 @@ DvbEpgModel::DvbEpgModel(DvbManager *manager_, QObject *parent) : QObject(parent
 
 		addEntry(entry);
 	}
+
+	if (!file.remove()) {
+		Log("DvbEpgModel::DvbEpgModel: cannot remove file") << file.fileName();
+	}
 }
 
 DvbEpgModel::~DvbEpgModel()
@@ -147,66 +142,28 @@ DvbEpgModel::~DvbEpgModel()
 		Log("DvbEpgModel::~DvbEpgModel: filter list not empty");
 	}
 
-	QFile file(KStandardDirs::locateLocal("appdata", QLatin1String("epgdata.dvb")));
-
-	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
-		Log("DvbEpgModel::~DvbEpgModel: cannot open") << file.fileName();
-		return;
-	}
-
-	QDataStream stream(&file);
-	stream.setVersion(QDataStream::Qt_4_4);
-	int version = 0x79cffd36;
-	stream << version;
-
-	foreach (const DvbSharedEpgEntry &entry, entries) {
-		SqlKey recordingKey;
-
-		if (entry->recording.isValid()) {
-			recordingKey = *entry->recording;
-		}
-
-		stream << entry->channel->name;
-		stream << entry->begin;
-		stream << entry->duration;
-		stream << entry->title;
-		stream << entry->subheading;
-		stream << entry->details;
-		stream << recordingKey.sqlKey;
-	}
+	sqlFlush();
 }
 
-QMap<DvbEpgEntryId, DvbSharedEpgEntry> DvbEpgModel::getEntries() const
+QList<DvbSharedEpgEntry> DvbEpgModel::getEntries()
 {
-	return entries;
+	// the pending notifications are delivered first (they are part of the result)
+	loadAll();
+	flushPendingEntries();
+	return entries.getEntries();
 }
 
-QHash<DvbSharedChannel, int> DvbEpgModel::getEpgChannels() const
+QHash<DvbSharedChannel, int> DvbEpgModel::getEpgChannels()
 {
-	return epgChannels;
+	loadAll();
+	return entries.getChannels();
 }
 
-QList<DvbSharedEpgEntry> DvbEpgModel::getCurrentNext(const DvbSharedChannel &channel) const
+QList<DvbSharedEpgEntry> DvbEpgModel::findEntries(const QString &query)
 {
-	QList<DvbSharedEpgEntry> result;
-	DvbEpgEntry fakeEntry(channel);
-
-	for (ConstIterator it = entries.lowerBound(DvbEpgEntryId(&fakeEntry));
-	     it != entries.constEnd(); ++it) {
-		const DvbSharedEpgEntry &entry = *it;
-
-		if (entry->channel != channel) {
-			break;
-		}
-
-		result.append(entry);
-
-		if (result.size() == 2) {
-			break;
-		}
-	}
-
-	return result;
+	loadAll();
+	flushPendingEntries();
+	return searchIndex.find(query);
 }
 
 DvbSharedEpgEntry DvbEpgModel::addEntry(const DvbEpgEntry &entry)
@@ -222,44 +179,123 @@ DvbSharedEpgEntry DvbEpgModel::addEntry(const DvbEpgEntry &entry)
 	}
 
 	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+	loadChannel(entry.channel->name);
+	return mergeEntry(entry);
+}
 
-	if (entry.begin.addSecs(QTime().secsTo(entry.duration)) > currentDateTimeUtc) {
-		DvbSharedEpgEntry existingEntry = entries.value(DvbEpgEntryId(&entry));
+int DvbEpgModel::addEntries(const QList<DvbEpgEntry> &newEntries)
+{
+	if (hasPendingOperation) {
+		Log("DvbEpgModel::addEntries: illegal recursive call");
+		return 0;
+	}
 
-		if (existingEntry.isValid()) {
-			if (existingEntry->details.isEmpty() && !entry.details.isEmpty()) {
-				// needed for atsc
-				emit entryAboutToBeUpdated(existingEntry);
-				const_cast<DvbEpgEntry *>(existingEntry.constData())->details =
-					entry.details;
-				emit entryUpdated(existingEntry);
-			}
+	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+	int count = 0;
 
-			return existingEntry;
+	foreach (const DvbEpgEntry &entry, newEntries) {
+		if (!entry.validate()) {
+			Log("DvbEpgModel::addEntries: invalid entry");
+			continue;
 		}
 
-		DvbSharedEpgEntry newEntry(new DvbEpgEntry(entry));
-		entries.insert(DvbEpgEntryId(newEntry), newEntry);
+		loadChannel(entry.channel->name);
 
-		if (newEntry->recording.isValid()) {
-			recordings.insert(newEntry->recording, newEntry);
+		if (mergeEntry(entry).isValid()) {
+			++count;
 		}
+	}
 
-		if (++epgChannels[newEntry->channel] == 1) {
-			emit epgChannelAdded(newEntry->channel);
+	return count;
+}
+
+DvbSharedEpgEntry DvbEpgModel::mergeEntry(const DvbEpgEntry &entry)
+{
+	if (entry.begin.addSecs(QTime().secsTo(entry.duration)) > currentDateTimeUtc) {
+		DvbSharedEpgEntry existingEntry = entries.find(entry);
+
+		if (existingEntry.isValid()) {
+			updateEntry(existingEntry, entry);
+			return existingEntry;
 		}
 
-		emit entryAdded(newEntry);
-		return newEntry;
+		DvbEpgEntry *newEntry = new DvbEpgEntry(entry);
+		newEntry->setSqlKey(findFreeKey());
+		entries.intern(newEntry);
+		sqlInsert(*newEntry);
+		return insertEntry(newEntry);
 	}
 
 	return DvbSharedEpgEntry();
 }
 
+void DvbEpgModel::updateEntry(const DvbSharedEpgEntry &existingEntry, const DvbEpgEntry &entry)
+{
+	DvbEpgEntry updatedEntry = *existingEntry;
+
+	if ((entry.eventId >= 0) || (existingEntry->eventId < 0)) {
+		// the broadcaster may move or rename an event at any time; an entry without
+		// event id takes over the one of the broadcaster (the store is updated below)
+		updatedEntry.begin = entry.begin;
+		updatedEntry.duration = entry.duration;
+		updatedEntry.eventId = entry.eventId;
+
+		if (!entry.title.isEmpty()) {
+			updatedEntry.title = entry.title;
+			updatedEntry.subheading = entry.subheading;
+		}
+	} else if (updatedEntry.title.isEmpty()) {
+		// entries without event id (xmltv) only complete the ones received from the
+		// broadcaster
+		updatedEntry.title = entry.title;
+		updatedEntry.subheading = entry.subheading;
+	}
+
+	// the details may be transmitted separately (atsc)
+	if (!entry.details.isEmpty() &&
+	    ((entry.eventId >= 0) || (existingEntry->eventId < 0) ||
+	     updatedEntry.details.isEmpty())) {
+		updatedEntry.details = entry.details;
+	}
+
+	bool moved = ((updatedEntry.begin != existingEntry->begin) ||
+		(updatedEntry.duration != existingEntry->duration));
+
+	if (!moved && (updatedEntry.eventId == existingEntry->eventId) &&
+	    (updatedEntry.title == existingEntry->title) &&
+	    (updatedEntry.subheading == existingEntry->subheading) &&
+	    (updatedEntry.details == existingEntry->details)) {
+		return;
+	}
+
+	flushPendingEntries();
+	emit entryAboutToBeUpdated(existingEntry);
+	searchIndex.remove(existingEntry);
+	// the store looks the entry up by its begin and event id
+	entries.remove(existingEntry);
+	DvbEpgEntry *modifiedEntry = const_cast<DvbEpgEntry *>(existingEntry.constData());
+	modifiedEntry->begin = updatedEntry.begin;
+	modifiedEntry->duration = updatedEntry.duration;
+	modifiedEntry->title = updatedEntry.title;
+	modifiedEntry->subheading = updatedEntry.subheading;
+	modifiedEntry->details = updatedEntry.details;
+	modifiedEntry->eventId = updatedEntry.eventId;
+	entries.intern(modifiedEntry);
+	entries.insert(existingEntry);
+	searchIndex.insert(existingEntry);
+	sqlUpdate(*existingEntry);
+	emit entryUpdated(existingEntry);
+
+	if (moved) {
+		updateCurrentNext(existingEntry->channel,
+			QDateTime::currentDateTime().toUTC().toTime_t());
+	}
+}
+
 void DvbEpgModel::scheduleProgram(const DvbSharedEpgEntry &entry, int extraSecondsBefore,
 	int extraSecondsAfter)
 {
-	if (!entry.isValid() || (entries.value(DvbEpgEntryId(entry)) != entry)) {
+	if (!entry.isValid() || !entries.contains(entry)) {
 		Log("DvbEpgModel::scheduleProgram: invalid entry");
 		return;
 	}
@@ -270,6 +306,7 @@ void DvbEpgModel::scheduleProgram(const DvbSharedEpgEntry &entry, int extraSecon
 	}
 
 	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+	flushPendingEntries();
 	emit entryAboutToBeUpdated(entry);
 	DvbSharedRecording oldRecording;
 
@@ -289,6 +326,7 @@ void DvbEpgModel::scheduleProgram(const DvbSharedEpgEntry &entry, int extraSecon
 		const_cast<DvbEpgEntry *>(entry.constData())->recording = DvbSharedRecording();
 	}
 
+	sqlUpdate(*entry);
 	emit entryUpdated(entry);
 
 	if (oldRecording.isValid()) {
@@ -354,9 +392,45 @@ void DvbEpgModel::stopEventFilter(DvbDevice *device, const DvbSharedChannel &cha
 	}
 }
 
+bool DvbEpgModel::isEventFilterComplete(DvbDevice *device,
+	const DvbSharedChannel &channel) const
+{
+	foreach (const QExplicitlySharedDataPointer<DvbEpgFilter> &epgFilter, dvbEpgFilters) {
+		if ((epgFilter->device != device) || (epgFilter->source != channel->source) ||
+		    !epgFilter->transponder.corresponds(channel->transponder)) {
+			continue;
+		}
+
+		// every service of the transponder (according to the channel list) has to be
+		// complete, not only the services which have been seen so far; services without
+		// any eit are never complete (the harvester stops after the idle timeout)
+		foreach (const DvbSharedChannel &otherChannel,
+			 manager->getChannelModel()->getChannels()) {
+			if ((otherChannel->source == channel->source) &&
+			    otherChannel->transponder.corresponds(channel->transponder) &&
+			    !epgFilter->isServiceComplete(*otherChannel)) {
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	return false;
+}
+
 void DvbEpgModel::channelAboutToBeUpdated(const DvbSharedChannel &channel)
 {
 	updatingChannel = *channel;
+
+	if (hasPendingOperation) {
+		Log("DvbEpgModel::channelAboutToBeUpdated: illegal recursive call");
+		return;
+	}
+
+	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+	// the rows are found by the channel name (which may change)
+	loadChannel(channel->name);
 }
 
 void DvbEpgModel::channelUpdated(const DvbSharedChannel &channel)
@@ -369,11 +443,14 @@ void DvbEpgModel::channelUpdated(const DvbSharedChannel &channel)
 	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
 
 	if (DvbChannelId(channel) != DvbChannelId(&updatingChannel)) {
-		DvbEpgEntry fakeEntry(channel);
-		Iterator it = entries.lowerBound(DvbEpgEntryId(&fakeEntry));
-
-		while ((ConstIterator(it) != entries.constEnd()) && ((*it)->channel == channel)) {
-			it = removeEntry(it);
+		removeEntries(channel);
+	} else if (channel->name != updatingChannel.name) {
+		// the channel name is stored in the database (the rows with the new name are the
+		// ones in memory)
+		loadedChannelNames.insert(channel->name);
+
+		foreach (const DvbEpgEventRecord &record, entries.getEntries(channel)) {
+			sqlUpdate(*record.entry);
 		}
 	}
 }
@@ -386,12 +463,8 @@ void DvbEpgModel::channelRemoved(const DvbSharedChannel &channel)
 	}
 
 	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
-	DvbEpgEntry fakeEntry(channel);
-	Iterator it = entries.lowerBound(DvbEpgEntryId(&fakeEntry));
-
-	while ((ConstIterator(it) != entries.constEnd()) && ((*it)->channel == channel)) {
-		it = removeEntry(it);
-	}
+	loadChannel(channel->name);
+	removeEntries(channel);
 }
 
 void DvbEpgModel::recordingRemoved(const DvbSharedRecording &recording)
@@ -402,11 +475,19 @@ void DvbEpgModel::recordingRemoved(const DvbSharedRecording &recording)
 	}
 
 	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+
+	if (recording->channel.isValid()) {
+		// the entry may not have been loaded yet (see insertFromSqlQuery())
+		loadChannel(recording->channel->name);
+	}
+
 	DvbSharedEpgEntry entry = recordings.take(recording);
 
 	if (entry.isValid()) {
+		flushPendingEntries();
 		emit entryAboutToBeUpdated(entry);
 		const_cast<DvbEpgEntry *>(entry.constData())->recording = DvbSharedRecording();
+		sqlUpdate(*entry);
 		emit entryUpdated(entry);
 	}
 }
@@ -422,34 +503,415 @@ void DvbEpgModel::timerEvent(QTimerEvent *event)
 
 	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
 	currentDateTimeUtc = QDateTime::currentDateTime().toUTC();
-	Iterator it = entries.begin();
+	QSet<DvbSharedChannel> channels;
 
-	while (ConstIterator(it) != entries.constEnd()) {
-		const DvbSharedEpgEntry &entry = *it;
+	foreach (const DvbSharedEpgEntry &entry,
+		 entries.takeExpiredEntries(currentDateTimeUtc.toTime_t())) {
+		releaseEntry(entry);
+		channels.insert(entry->channel);
+	}
 
-		if (entry->begin.addSecs(QTime().secsTo(entry->duration)) > currentDateTimeUtc) {
-			++it;
-		} else {
-			it = removeEntry(it);
+	qint64 now = currentDateTimeUtc.toTime_t();
+
+	foreach (const DvbSharedChannel &channel, channels) {
+		updateCurrentNext(channel, now);
+
+		if (!entries.hasEntries(channel)) {
+			emit epgChannelRemoved(channel);
 		}
 	}
 }
 
-DvbEpgModel::Iterator DvbEpgModel::removeEntry(Iterator it)
+void DvbEpgModel::bindToSqlQuery(SqlKey sqlKey, QSqlQuery &query, int index) const
 {
-	const DvbSharedEpgEntry &entry = *it;
+	DvbSharedEpgEntry entry = sqlEntries.value(sqlKey);
+
+	if (!entry.isValid()) {
+		Log("DvbEpgModel::bindToSqlQuery: invalid entry");
+		return;
+	}
+
+	// begin and end are stored as seconds since the epoch (indexed)
+	qint64 begin = entry->begin.toTime_t();
+	int duration = QTime().secsTo(entry->duration);
+	SqlKey recordingKey;
 
 	if (entry->recording.isValid()) {
-		recordings.remove(entry->recording);
+		recordingKey = *entry->recording;
+	}
+
+	query.bindValue(index++, entry->channel->name);
+	query.bindValue(index++, begin);
+	query.bindValue(index++, duration);
+	query.bindValue(index++, begin + duration);
+	query.bindValue(index++, entry->title);
+	query.bindValue(index++, entry->subheading);
+	query.bindValue(index++, entry->details);
+	query.bindValue(index++, recordingKey.sqlKey);
+	query.bindValue(index++, entry->eventId);
+}
+
+bool DvbEpgModel::insertFromSqlQuery(SqlKey sqlKey, const QSqlQuery &query, int index)
+{
+	DvbEpgEntry *entry = new DvbEpgEntry();
+	DvbSharedEpgEntry newEntry(entry);
+	entry->channel =
+		manager->getChannelModel()->findChannelByName(query.value(index++).toString());
+	entry->begin = QDateTime::fromTime_t(query.value(index++).toUInt()).toUTC();
+	entry->duration = QTime().addSecs(query.value(index++).toInt());
+	++index; // end
+	entry->title = query.value(index++).toString();
+	entry->subheading = query.value(index++).toString();
+	entry->details = query.value(index++).toString();
+	SqlKey recordingKey(query.value(index++).toUInt());
+
+	if (!query.value(index).isNull()) {
+		entry->eventId = query.value(index).toInt();
+	}
+
+	++index;
+
+	if (recordingKey.isSqlKeyValid()) {
+		entry->recording = manager->getRecordingModel()->findRecordingByKey(recordingKey);
 	}
 
-	if (--epgChannels[entry->channel] == 0) {
-		epgChannels.remove(entry->channel);
-		emit epgChannelRemoved(entry->channel);
+	if (!entry->validate() ||
+	    (entry->begin.addSecs(QTime().secsTo(entry->duration)) <= currentDateTimeUtc) ||
+	    entries.find(*entry).isValid()) {
+		return false;
+	}
+
+	entry->setSqlKey(sqlKey);
+	entries.intern(entry);
+	insertEntry(entry);
+
+	if (recordingKey.isSqlKeyValid() && !entry->recording.isValid()) {
+		// the recording has been removed; the key may be reused by a new recording
+		sqlUpdate(*entry);
+	}
+
+	return true;
+}
+
+void DvbEpgModel::loadAll()
+{
+	if (!pendingLoadCondition.isEmpty()) {
+		QString condition = pendingLoadCondition;
+		pendingLoadCondition.clear();
+
+		if (!loadedChannelNames.isEmpty()) {
+			// loading a row twice would remove it (duplicate)
+			QStringList names;
+
+			foreach (const QString &name, loadedChannelNames) {
+				names.append(quoteSqlString(name));
+			}
+
+			condition += QLatin1String(" AND Channel NOT IN (") +
+				names.join(QLatin1String(", ")) + QLatin1Char(')');
+			loadedChannelNames.clear();
+		}
+
+		sqlLoad(condition);
+	}
+}
+
+void DvbEpgModel::loadChannel(const QString &channelName)
+{
+	if (!pendingLoadCondition.isEmpty() && !loadedChannelNames.contains(channelName)) {
+		loadedChannelNames.insert(channelName);
+		sqlLoad(pendingLoadCondition + QLatin1String(" AND Channel = ") +
+			quoteSqlString(channelName));
+	}
+}
+
+SqlKey DvbEpgModel::findFreeKey()
+{
+	if (pendingLoadCondition.isEmpty()) {
+		return sqlFindFreeKey(sqlEntries);
+	}
+
+	// the rows which haven't been loaded yet keep their keys
+	quint32 key = sqlHighestKey().sqlKey;
+
+	if (!sqlEntries.isEmpty()) {
+		key = qMax(key, (sqlEntries.constEnd() - 1).key().sqlKey);
+	}
+
+	if (key < 0x7fffffff) {
+		return SqlKey(key + 1);
+	}
+
+	loadAll();
+	return sqlFindFreeKey(sqlEntries);
+}
+
+QString DvbEpgModel::quoteSqlString(const QString &string)
+{
+	QString quotedString = string;
+	quotedString.replace(QLatin1Char('\''), QLatin1String("''"));
+	return (QLatin1Char('\'') + quotedString + QLatin1Char('\''));
+}
+
+DvbSharedEpgEntry DvbEpgModel::insertEntry(DvbEpgEntry *entry)
+{
+	DvbSharedEpgEntry newEntry(entry);
+	bool newChannel = !entries.hasEntries(newEntry->channel);
+	entries.insert(newEntry);
+	searchIndex.insert(newEntry);
+	sqlEntries.insert(*newEntry, newEntry);
+
+	if (newEntry->recording.isValid()) {
+		recordings.insert(newEntry->recording, newEntry);
+	}
+
+	if (newChannel) {
+		emit epgChannelAdded(newEntry->channel);
+	}
+
+	emit entryAdded(newEntry);
+	pendingAddedEntries.insert(newEntry);
+
+	if (!batchTimer.isActive()) {
+		batchTimer.start();
+	}
+
+	updateCurrentNext(newEntry->channel, QDateTime::currentDateTime().toUTC().toTime_t());
+	return newEntry;
+}
+
+void DvbEpgModel::removeEntries(const DvbSharedChannel &channel)
+{
+	QList<DvbSharedEpgEntry> removedEntries = entries.takeEntries(channel);
+
+	if (removedEntries.isEmpty()) {
+		return;
+	}
+
+	foreach (const DvbSharedEpgEntry &entry, removedEntries) {
+		releaseEntry(entry);
+	}
+
+	updateCurrentNext(channel, QDateTime::currentDateTime().toUTC().toTime_t());
+	emit epgChannelRemoved(channel);
+}
+
+void DvbEpgModel::releaseEntry(const DvbSharedEpgEntry &entry)
+{
+	searchIndex.remove(entry);
+	sqlEntries.remove(*entry);
+	sqlRemove(*entry);
+
+	if (entry->recording.isValid()) {
+		recordings.remove(entry->recording);
 	}
 
 	emit entryRemoved(entry);
-	return entries.erase(it);
+
+	if (!pendingAddedEntries.remove(entry)) {
+		pendingRemovedEntries.append(entry);
+
+		if (!batchTimer.isActive()) {
+			batchTimer.start();
+		}
+	}
+}
+
+void DvbEpgModel::updateCurrentNext(const DvbSharedChannel &channel, qint64 now)
+{
+	// the expired entries are only removed once in a while; they are skipped here
+	DvbEpgCurrentNext newCurrentNext;
+	newCurrentNext.transition = NoTransition;
+
+	foreach (const DvbEpgEventRecord &record, entries.getEntries(channel)) {
+		qint64 end = (record.begin + record.duration);
+
+		if (end <= now) {
+			continue;
+		}
+
+		newCurrentNext.entries.append(record.entry);
+		newCurrentNext.transition = qMin(newCurrentNext.transition, end);
+
+		if (newCurrentNext.entries.size() == 2) {
+			break;
+		}
+	}
+
+	if (newCurrentNext.entries.isEmpty()) {
+		if (currentNext.remove(channel) != 0) {
+			emit currentNextChanged(channel);
+		}
+
+		return;
+	}
+
+	DvbEpgCurrentNext &oldCurrentNext = currentNext[channel];
+	bool changed = (oldCurrentNext.entries != newCurrentNext.entries);
+	oldCurrentNext = newCurrentNext;
+
+	if (newCurrentNext.transition < currentNextTransition) {
+		// at least once an hour (the clock may be adjusted)
+		currentNextTransition = newCurrentNext.transition;
+		currentNextTimer.start(int(qBound(Q_INT64_C(0), currentNextTransition - now,
+			Q_INT64_C(3600)) * 1000));
+	}
+
+	if (changed) {
+		emit currentNextChanged(channel);
+	}
+}
+
+void DvbEpgModel::updateCurrentNext()
+{
+	if (hasPendingOperation) {
+		Log("DvbEpgModel::updateCurrentNext: illegal recursive call");
+		return;
+	}
+
+	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+	qint64 now = QDateTime::currentDateTime().toUTC().toTime_t();
+	QList<DvbSharedChannel> channels;
+	currentNextTransition = NoTransition;
+
+	for (QHash<DvbSharedChannel, DvbEpgCurrentNext>::const_iterator it =
+	     currentNext.constBegin(); it != currentNext.constEnd(); ++it) {
+		if (it->transition <= now) {
+			channels.append(it.key());
+		} else {
+			currentNextTransition = qMin(currentNextTransition, it->transition);
+		}
+	}
+
+	if (currentNextTransition != NoTransition) {
+		currentNextTimer.start(int(qBound(Q_INT64_C(0), currentNextTransition - now,
+			Q_INT64_C(3600)) * 1000));
+	}
+
+	foreach (const DvbSharedChannel &channel, channels) {
+		updateCurrentNext(channel, now);
+	}
+}
+
+void DvbEpgModel::flushPendingEntries()
+{
+	batchTimer.stop();
+
+	if (!pendingRemovedEntries.isEmpty()) {
+		QList<DvbSharedEpgEntry> removedEntries = pendingRemovedEntries;
+		pendingRemovedEntries.clear();
+		emit entriesRemoved(removedEntries);
+	}
+
+	if (!pendingAddedEntries.isEmpty()) {
+		QList<DvbSharedEpgEntry> addedEntries = pendingAddedEntries.toList();
+		pendingAddedEntries.clear();
+		emit entriesAdded(addedEntries);
+	}
+}
+
+bool DvbEitSubTable::isComplete() const
+{
+	if (versionNumber < 0) {
+		return false;
+	}
+
+	for (int i = 0; i <= (lastSectionNumber >> 3); ++i) {
+		// every segment up to the last section is present (possibly as an empty section)
+		if ((expectedSections[i] == 0) ||
+		    ((receivedSections[i] & expectedSections[i]) != expectedSections[i])) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+bool DvbEitSectionTracker::insert(const DvbEitSection &section)
+{
+	int tableId = section.tableId();
+	quint64 key = ((quint64(section.originalNetworkId()) << 40) |
+		(quint64(section.transportStreamId()) << 24) |
+		(quint64(section.serviceId()) << 8) | quint64(tableId));
+	DvbEitSubTable &subTable = subTables[key];
+	int sectionNumber = section.sectionNumber();
+	int segment = (sectionNumber >> 3);
+	quint8 sectionBit = quint8(1 << (sectionNumber & 0x07));
+
+	if (subTable.versionNumber == section.versionNumber()) {
+		if ((subTable.receivedSections[segment] & sectionBit) != 0) {
+			return false;
+		}
+	} else {
+		// new or changed table
+		subTable = DvbEitSubTable();
+		subTable.versionNumber = section.versionNumber();
+	}
+
+	subTable.lastSectionNumber = section.lastSectionNumber();
+	subTable.lastTableId = section.lastTableId();
+	subTable.receivedSections[segment] |= sectionBit;
+
+	int segmentLast = qMax(section.segmentLastSectionNumber(), sectionNumber);
+	segmentLast = qMin(segmentLast, ((segment << 3) | 0x07));
+	subTable.expectedSections[segment] = quint8((2 << (segmentLast & 0x07)) - 1);
+	return true;
+}
+
+bool DvbEitSectionTracker::isServiceComplete(int networkId, int transportStreamId,
+	int serviceId) const
+{
+	quint64 serviceKey = ((quint64(transportStreamId & 0xffff) << 24) |
+		(quint64(serviceId & 0xffff) << 8));
+	quint64 serviceMask = Q_UINT64_C(0xffffffff00);
+
+	if (networkId >= 0) {
+		serviceKey |= (quint64(networkId & 0xffff) << 40);
+		serviceMask |= (Q_UINT64_C(0xffff) << 40);
+	}
+
+	bool found = false;
+
+	for (QHash<quint64, DvbEitSubTable>::const_iterator it = subTables.constBegin();
+	     it != subTables.constEnd(); ++it) {
+		if ((it.key() & serviceMask) != serviceKey) {
+			continue;
+		}
+
+		if (!isSubTableComplete(it)) {
+			return false;
+		}
+
+		found = true;
+	}
+
+	return found;
+}
+
+bool DvbEitSectionTracker::isSubTableComplete(
+	QHash<quint64, DvbEitSubTable>::const_iterator it) const
+{
+	if (!it->isComplete()) {
+		return false;
+	}
+
+	int tableId = int(it.key() & 0xff);
+
+	if (tableId < 0x50) {
+		// present / following
+		return true;
+	}
+
+	// the schedule is split into up to 16 tables
+	quint64 serviceKey = (it.key() & ~Q_UINT64_C(0xff));
+
+	for (int i = (tableId & 0xf0); i <= it->lastTableId; ++i) {
+		if (!subTables.contains(serviceKey | quint64(i))) {
+			return false;
+		}
+	}
+
+	return true;
 }
 
 DvbEpgFilter::DvbEpgFilter(DvbManager *manager, DvbDevice *device_,
@@ -488,6 +950,13 @@ void DvbEpgFilter::processSection(const char *data, int size)
 		return;
 	}
 
+	// the whole schedule is repeated all the time; once all sections have been received,
+	// only changed tables (new version number) are looked at
+
+	if (!sectionTracker.insert(eitSection)) {
+		return;
+	}
+
 	DvbChannel fakeChannel;
 	fakeChannel.source = source;
 	fakeChannel.transponder = transponder;
@@ -511,6 +980,7 @@ void DvbEpgFilter::processSection(const char *data, int size)
 		epgEntry.begin = QDateTime(QDate::fromJulianDay(entry.startDate() + 2400001),
 			bcdToTime(entry.startTime()), Qt::UTC);
 		epgEntry.duration = bcdToTime(entry.duration());
+		epgEntry.eventId = entry.eventId();
 
 		for (DvbDescriptor descriptor = entry.descriptors(); descriptor.isValid();
 		     descriptor.advance()) {
@@ -697,6 +1167,7 @@ void AtscEpgFilter::processEitSection(const char *data, int size)
 		epgEntry.begin = baseDateTime.addSecs(eitEntry.startTime());
 		epgEntry.duration = QTime().addSecs(eitEntry.duration());
 		epgEntry.title = eitEntry.title();
+		epgEntry.eventId = eitEntry.eventId();
 
 		quint32 id = ((quint32(fakeChannel.networkId) << 16) | quint32(eitEntry.eventId()));
 		DvbSharedEpgEntry entry = epgEntries.value(id);
@@ -21,69 +21,52 @@
 #ifndef DVBEPG_H
 #define DVBEPG_H
 
-#include "dvbrecording.h"
+#include <QTimer>
+#include "dvbepgstore.h"
 
 class AtscEpgFilter;
 class DvbDevice;
 class DvbEpgFilter;
 
-class DvbEpgEntry : public SharedData
+class DvbEpgCurrentNext
 {
 public:
-	DvbEpgEntry() { }
-	explicit DvbEpgEntry(const DvbSharedChannel &channel_) : channel(channel_) { }
-	~DvbEpgEntry() { }
-
-	// checks that all variables are ok
-	bool validate() const;
-
-	DvbSharedChannel channel;
-	QDateTime begin; // UTC
-	QTime duration;
-	QString title;
-	QString subheading;
-	QString details;
-	DvbSharedRecording recording;
-};
-
-typedef ExplicitlySharedDataPointer<const DvbEpgEntry> DvbSharedEpgEntry;
-Q_DECLARE_TYPEINFO(DvbSharedEpgEntry, Q_MOVABLE_TYPE);
-
-class DvbEpgEntryId
-{
-public:
-	explicit DvbEpgEntryId(const DvbEpgEntry *entry_) : entry(entry_) { }
-	explicit DvbEpgEntryId(const DvbSharedEpgEntry &entry_) : entry(entry_.constData()) { }
-	~DvbEpgEntryId() { }
+	DvbEpgCurrentNext() : transition(0) { }
+	~DvbEpgCurrentNext() { }
 
-	// compares entries, 'recording' is ignored
-	// if one 'details' is empty, 'details' is ignored
-
-	bool operator<(const DvbEpgEntryId &other) const;
-
-private:
-	const DvbEpgEntry *entry;
+	QList<DvbSharedEpgEntry> entries; // the first two entries which haven't ended yet
+	qint64 transition; // seconds since the epoch; the first of them ends
 };
 
-class DvbEpgModel : public QObject
+class DvbEpgModel : public QObject, private SqlInterface
 {
 	Q_OBJECT
-	typedef QMap<DvbEpgEntryId, DvbSharedEpgEntry>::Iterator Iterator;
-	typedef QMap<DvbEpgEntryId, DvbSharedEpgEntry>::ConstIterator ConstIterator;
 public:
 	DvbEpgModel(DvbManager *manager_, QObject *parent);
 	~DvbEpgModel();
 
-	QMap<DvbEpgEntryId, DvbSharedEpgEntry> getEntries() const;
-	QHash<DvbSharedChannel, int> getEpgChannels() const;
-	QList<DvbSharedEpgEntry> getCurrentNext(const DvbSharedChannel &channel) const;
+	// these functions load the whole epg (only the current part is loaded at startup)
+	QList<DvbSharedEpgEntry> getEntries();
+	QHash<DvbSharedChannel, int> getEpgChannels();
+	// full text search (see DvbEpgSearchIndex)
+	QList<DvbSharedEpgEntry> findEntries(const QString &query);
+	// the running (or else the upcoming) entry and the entry after it
+	QList<DvbSharedEpgEntry> getCurrentNext(const DvbSharedChannel &channel) const
+	{
+		return currentNext.value(channel).entries;
+	}
 
 	DvbSharedEpgEntry addEntry(const DvbEpgEntry &entry);
+	// returns the number of entries which are part of the epg afterwards (new or existing);
+	// the notifications are batched (see entriesAdded())
+	int addEntries(const QList<DvbEpgEntry> &newEntries);
 	void scheduleProgram(const DvbSharedEpgEntry &entry, int extraSecondsBefore,
 		int extraSecondsAfter);
 
 	void startEventFilter(DvbDevice *device, const DvbSharedChannel &channel);
 	void stopEventFilter(DvbDevice *device, const DvbSharedChannel &channel);
+	// true if the whole schedule of the transponder has been received (dvb only)
+	bool isEventFilterComplete(DvbDevice *device, const DvbSharedChannel &channel) const;
 
 signals:
 	void entryAdded(const DvbSharedEpgEntry &entry);
@@ -91,25 +74,58 @@ signals:
 	void entryAboutToBeUpdated(const DvbSharedEpgEntry &entry);
 	void entryUpdated(const DvbSharedEpgEntry &entry);
 	void entryRemoved(const DvbSharedEpgEntry &entry);
+	// the same insertions and removals, collected for a short while (an entry which is
+	// removed before its insertion has been reported doesn't appear in either list)
+	void entriesAdded(const QList<DvbSharedEpgEntry> &entries);
+	void entriesRemoved(const QList<DvbSharedEpgEntry> &entries);
 	void epgChannelAdded(const DvbSharedChannel &channel);
 	void epgChannelRemoved(const DvbSharedChannel &channel);
+	// emitted when the result of getCurrentNext() changes
+	void currentNextChanged(const DvbSharedChannel &channel);
 
 private slots:
 	void channelAboutToBeUpdated(const DvbSharedChannel &channel);
 	void channelUpdated(const DvbSharedChannel &channel);
 	void channelRemoved(const DvbSharedChannel &channel);
 	void recordingRemoved(const DvbSharedRecording &recording);
+	void updateCurrentNext();
+	void flushPendingEntries();
 
 private:
-	void timerEvent(QTimerEvent *event);
+	enum {
+		StartupWindow = (4 * 3600), // seconds; entries beginning later are loaded on demand
+		BatchInterval = 250 // milliseconds; entriesAdded() and entriesRemoved() are delayed
+	};
 
-	Iterator removeEntry(Iterator it);
+	void timerEvent(QTimerEvent *event);
+	void bindToSqlQuery(SqlKey sqlKey, QSqlQuery &query, int index) const;
+	bool insertFromSqlQuery(SqlKey sqlKey, const QSqlQuery &query, int index);
+
+	void loadAll();
+	void loadChannel(const QString &channelName); // the rows of the channel (if not loaded)
+	SqlKey findFreeKey();
+	static QString quoteSqlString(const QString &string);
+	DvbSharedEpgEntry mergeEntry(const DvbEpgEntry &entry); // 'entry' has been validated
+	void updateEntry(const DvbSharedEpgEntry &existingEntry, const DvbEpgEntry &entry);
+	DvbSharedEpgEntry insertEntry(DvbEpgEntry *entry);
+	void removeEntries(const DvbSharedChannel &channel);
+	void releaseEntry(const DvbSharedEpgEntry &entry); // already removed from 'entries'
+	void updateCurrentNext(const DvbSharedChannel &channel, qint64 now);
 
 	DvbManager *manager;
 	QDateTime currentDateTimeUtc;
-	QMap<DvbEpgEntryId, DvbSharedEpgEntry> entries;
+	DvbEpgStore entries;
+	DvbEpgSearchIndex searchIndex;
+	QHash<DvbSharedChannel, DvbEpgCurrentNext> currentNext;
+	QTimer currentNextTimer; // fires at the next transition
+	qint64 currentNextTransition; // seconds since the epoch
+	QSet<DvbSharedEpgEntry> pendingAddedEntries;
+	QList<DvbSharedEpgEntry> pendingRemovedEntries;
+	QTimer batchTimer;
+	QMap<SqlKey, DvbSharedEpgEntry> sqlEntries;
+	QString pendingLoadCondition; // the part of the epg which hasn't been loaded yet
+	QSet<QString> loadedChannelNames; // channels whose pending part has been loaded
 	QMap<DvbSharedRecording, DvbSharedEpgEntry> recordings;
-	QHash<DvbSharedChannel, int> epgChannels;
 	QList<QExplicitlySharedDataPointer<DvbEpgFilter> > dvbEpgFilters;
 	QList<QExplicitlySharedDataPointer<AtscEpgFilter> > atscEpgFilters;
 	DvbChannel updatingChannel;
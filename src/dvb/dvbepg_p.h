@@ -21,15 +21,69 @@
 #ifndef DVBEPG_P_H
 #define DVBEPG_P_H
 
+#include <string.h>
 #include "dvbbackenddevice.h"
 #include "dvbepg.h"
 
+class DvbEitSection;
+
+class DvbEitSubTable
+{
+public:
+	DvbEitSubTable() : versionNumber(-1), lastSectionNumber(0), lastTableId(0)
+	{
+		memset(expectedSections, 0, sizeof(expectedSections));
+		memset(receivedSections, 0, sizeof(receivedSections));
+	}
+
+	~DvbEitSubTable() { }
+
+	bool isComplete() const;
+
+	int versionNumber; // -1 = nothing received yet
+	int lastSectionNumber;
+	int lastTableId;
+	// one byte per segment (eight sections); a segment may end before its last section
+	quint8 expectedSections[32];
+	quint8 receivedSections[32];
+};
+
+/*
+ * keeps track of the received eit sections of every service (by table id and section
+ * number); unchanged sections are recognized without looking at their content
+ */
+
+class DvbEitSectionTracker
+{
+public:
+	DvbEitSectionTracker() { }
+	~DvbEitSectionTracker() { }
+
+	// returns false if the section has already been received (same version)
+	bool insert(const DvbEitSection &section);
+
+	// true if all sections of all tables (according to last_table_id) of the service
+	// have been received; 'networkId' may be -1 (any network)
+	bool isServiceComplete(int networkId, int transportStreamId, int serviceId) const;
+
+private:
+	bool isSubTableComplete(QHash<quint64, DvbEitSubTable>::const_iterator it) const;
+
+	QHash<quint64, DvbEitSubTable> subTables; // key: network, transport stream, service, table
+};
+
 class DvbEpgFilter : public QSharedData, public DvbSectionFilter
 {
 public:
 	DvbEpgFilter(DvbManager *manager, DvbDevice *device_, const DvbSharedChannel &channel);
 	~DvbEpgFilter();
 
+	bool isServiceComplete(const DvbChannel &channel) const
+	{
+		return sectionTracker.isServiceComplete(channel.networkId, channel.transportStreamId,
+			channel.serviceId);
+	}
+
 	DvbDevice *device;
 	QString source;
 	DvbTransponder transponder;
@@ -42,6 +96,7 @@ private:
 
 	DvbChannelModel *channelModel;
 	DvbEpgModel *epgModel;
+	DvbEitSectionTracker sectionTracker;
 };
 
 class AtscEpgMgtFilter : public DvbSectionFilter
@@ -28,10 +28,13 @@
 #include <QPushButton>
 #include <QScrollArea>
 #include <KAction>
+#include <KFileDialog>
 #include <KLineEdit>
 #include <KLocale>
+#include <KMessageBox>
 #include "../log.h"
 #include "dvbmanager.h"
+#include "dvbxmltvimporter.h"
 
 DvbEpgDialog::DvbEpgDialog(DvbManager *manager_, QWidget *parent) : KDialog(parent),
 	manager(manager_)
@@ -75,6 +78,19 @@ DvbEpgDialog::DvbEpgDialog(DvbManager *manager_, QWidget *parent) : KDialog(pare
 	connect(lineEdit, SIGNAL(textChanged(QString)),
 		epgTableModel, SLOT(setContentFilter(QString)));
 	boxLayout->addWidget(lineEdit);
+
+	DvbXmltvImporter *xmltvImporter = manager->getXmltvImporter();
+	connect(xmltvImporter, SIGNAL(importFinished(int,int)), this, SLOT(xmltvImportFinished()));
+	importButton = new QPushButton(QIcon::fromTheme(QLatin1String("document-import")),
+		i18nc("@action:button", "Import XMLTV..."), widget);
+	importButton->setEnabled(!xmltvImporter->isRunning());
+	connect(importButton, SIGNAL(clicked()), this, SLOT(importXmltv()));
+	boxLayout->addWidget(importButton);
+
+	pushButton = new QPushButton(QIcon::fromTheme(QLatin1String("document-export")),
+		i18nc("@action:button", "Export XMLTV..."), widget);
+	connect(pushButton, SIGNAL(clicked()), this, SLOT(exportXmltv()));
+	boxLayout->addWidget(pushButton);
 	rightLayout->addLayout(boxLayout);
 
 	epgView = new QTreeView(widget);
@@ -168,6 +184,33 @@ void DvbEpgDialog::scheduleProgram()
 	}
 }
 
+void DvbEpgDialog::importXmltv()
+{
+	QString fileName = KFileDialog::getOpenFileName(QUrl(),
+		QLatin1String("*.xml *.xmltv|") + i18nc("@item:inlistbox", "XMLTV Files"), this);
+
+	if (!fileName.isEmpty() && manager->getXmltvImporter()->importFile(fileName)) {
+		// the import runs in the background; the entries appear as they are parsed
+		importButton->setEnabled(false);
+	}
+}
+
+void DvbEpgDialog::exportXmltv()
+{
+	QString fileName = KFileDialog::getSaveFileName(QUrl(),
+		QLatin1String("*.xml|") + i18nc("@item:inlistbox", "XMLTV Files"), this);
+
+	if (!fileName.isEmpty() && !manager->getXmltvImporter()->exportFile(fileName)) {
+		KMessageBox::sorry(this, i18nc("@info", "Cannot write <filename>%1</filename>.",
+			fileName));
+	}
+}
+
+void DvbEpgDialog::xmltvImportFinished()
+{
+	importButton->setEnabled(true);
+}
+
 bool DvbEpgEntryLessThan::operator()(const DvbSharedEpgEntry &x, const DvbSharedEpgEntry &y) const
 {
 	if (x->channel != y->channel) {
@@ -190,7 +233,7 @@ bool DvbEpgEntryLessThan::operator()(const DvbSharedEpgEntry &x, const DvbShared
 		return (x->subheading < y->subheading);
 	}
 
-	if (x->details < y->details) {
+	if (x->details != y->details) {
 		return (x->details < y->details);
 	}
 
@@ -274,9 +317,7 @@ bool DvbEpgTableModelHelper::filterAcceptsItem(const DvbSharedEpgEntry &entry) c
 	case ChannelFilter:
 		return (entry->channel == channelFilter);
 	case ContentFilter:
-		return ((contentFilter.indexIn(entry->title) >= 0) ||
-			(contentFilter.indexIn(entry->subheading) >= 0) ||
-			(contentFilter.indexIn(entry->details) >= 0));
+		return DvbEpgSearchIndex::matches(*entry, contentFilter);
 	}
 
 	return false;
@@ -285,7 +326,6 @@ bool DvbEpgTableModelHelper::filterAcceptsItem(const DvbSharedEpgEntry &entry) c
 DvbEpgTableModel::DvbEpgTableModel(QObject *parent) : TableModel<DvbEpgTableModelHelper>(parent),
 	epgModel(NULL), contentFilterEventPending(false)
 {
-	helper.contentFilter.setCaseSensitivity(Qt::CaseInsensitive);
 }
 
 DvbEpgTableModel::~DvbEpgTableModel()
@@ -300,20 +340,21 @@ void DvbEpgTableModel::setEpgModel(DvbEpgModel *epgModel_)
 	}
 
 	epgModel = epgModel_;
-	connect(epgModel, SIGNAL(entryAdded(DvbSharedEpgEntry)),
-		this, SLOT(entryAdded(DvbSharedEpgEntry)));
+	// the batched signals avoid a relayout for every entry of an eit burst
+	connect(epgModel, SIGNAL(entriesAdded(QList<DvbSharedEpgEntry>)),
+		this, SLOT(entriesAdded(QList<DvbSharedEpgEntry>)));
 	connect(epgModel, SIGNAL(entryAboutToBeUpdated(DvbSharedEpgEntry)),
 		this, SLOT(entryAboutToBeUpdated(DvbSharedEpgEntry)));
 	connect(epgModel, SIGNAL(entryUpdated(DvbSharedEpgEntry)),
 		this, SLOT(entryUpdated(DvbSharedEpgEntry)));
-	connect(epgModel, SIGNAL(entryRemoved(DvbSharedEpgEntry)),
-		this, SLOT(entryRemoved(DvbSharedEpgEntry)));
+	connect(epgModel, SIGNAL(entriesRemoved(QList<DvbSharedEpgEntry>)),
+		this, SLOT(entriesRemoved(QList<DvbSharedEpgEntry>)));
 }
 
 void DvbEpgTableModel::setChannelFilter(const DvbSharedChannel &channel)
 {
 	helper.channelFilter = channel;
-	helper.contentFilter.setPattern(QString());
+	helper.contentFilter.clear();
 	helper.filterType = DvbEpgTableModelHelper::ChannelFilter;
 	reset(epgModel->getEntries());
 }
@@ -371,9 +412,10 @@ QVariant DvbEpgTableModel::headerData(int section, Qt::Orientation orientation,
 void DvbEpgTableModel::setContentFilter(const QString &pattern)
 {
 	helper.channelFilter = DvbSharedChannel();
-	helper.contentFilter.setPattern(pattern);
+	helper.contentFilter = DvbEpgSearchIndex::tokenize(pattern);
+	contentFilterPattern = pattern;
 
-	if (!pattern.isEmpty()) {
+	if (!helper.contentFilter.isEmpty()) {
 		helper.filterType = DvbEpgTableModelHelper::ContentFilter;
 
 		if (!contentFilterEventPending) {
@@ -384,13 +426,13 @@ void DvbEpgTableModel::setContentFilter(const QString &pattern)
 	} else {
 		// use channel filter so that content won't be unnecessarily filtered
 		helper.filterType = DvbEpgTableModelHelper::ChannelFilter;
-		reset(QMap<DvbEpgEntryId, DvbSharedEpgEntry>());
+		reset(QList<DvbSharedEpgEntry>());
 	}
 }
 
-void DvbEpgTableModel::entryAdded(const DvbSharedEpgEntry &entry)
+void DvbEpgTableModel::entriesAdded(const QList<DvbSharedEpgEntry> &entries)
 {
-	insert(entry);
+	insertItems(entries);
 }
 
 void DvbEpgTableModel::entryAboutToBeUpdated(const DvbSharedEpgEntry &entry)
@@ -403,9 +445,9 @@ void DvbEpgTableModel::entryUpdated(const DvbSharedEpgEntry &entry)
 	update(entry);
 }
 
-void DvbEpgTableModel::entryRemoved(const DvbSharedEpgEntry &entry)
+void DvbEpgTableModel::entriesRemoved(const QList<DvbSharedEpgEntry> &entries)
 {
-	remove(entry);
+	removeItems(entries);
 }
 
 void DvbEpgTableModel::customEvent(QEvent *event)
@@ -414,6 +456,6 @@ void DvbEpgTableModel::customEvent(QEvent *event)
 	contentFilterEventPending = false;
 
 	if (helper.filterType == DvbEpgTableModelHelper::ContentFilter) {
-		reset(epgModel->getEntries());
+		reset(epgModel->findEntries(contentFilterPattern));
 	}
 }
@@ -26,6 +26,7 @@
 
 class QLabel;
 class QModelIndex;
+class QPushButton;
 class QTreeView;
 class DvbEpgChannelTableModel;
 class DvbEpgTableModel;
@@ -45,6 +46,9 @@ private slots:
 	void entryActivated(const QModelIndex &index);
 	void checkEntry();
 	void scheduleProgram();
+	void importXmltv();
+	void exportXmltv();
+	void xmltvImportFinished();
 
 private:
 	DvbManager *manager;
@@ -53,6 +57,7 @@ private:
 	QTreeView *channelView;
 	QTreeView *epgView;
 	QLabel *contentLabel;
+	QPushButton *importButton;
 };
 
 #endif /* DVBEPGDIALOG_H */
@@ -107,7 +107,7 @@ public:
 	bool filterAcceptsItem(const DvbSharedEpgEntry &epgEntry) const;
 
 	DvbSharedChannel channelFilter;
-	QStringMatcher contentFilter;
+	QStringList contentFilter; // see DvbEpgSearchIndex::tokenize()
 	FilterType filterType;
 
 private:
@@ -131,15 +131,16 @@ public slots:
 	void setContentFilter(const QString &pattern);
 
 private slots:
-	void entryAdded(const DvbSharedEpgEntry &entry);
+	void entriesAdded(const QList<DvbSharedEpgEntry> &entries);
 	void entryAboutToBeUpdated(const DvbSharedEpgEntry &entry);
 	void entryUpdated(const DvbSharedEpgEntry &entry);
-	void entryRemoved(const DvbSharedEpgEntry &entry);
+	void entriesRemoved(const QList<DvbSharedEpgEntry> &entries);
 
 private:
 	void customEvent(QEvent *event);
 
 	DvbEpgModel *epgModel;
+	QString contentFilterPattern;
 	bool contentFilterEventPending;
 };
 
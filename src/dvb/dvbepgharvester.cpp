@@ -0,0 +1,231 @@
+/*
+ * dvbepgharvester.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbepgharvester.h"
+
+#include "dvbdevice.h"
+#include "dvbepg.h"
+#include "dvbmanager.h"
+
+DvbEpgHarvester::DvbEpgHarvester(DvbManager *manager_, QObject *parent) : QObject(parent),
+	manager(manager_), device(NULL), muxIndex(-1), changedEntries(0)
+{
+	DvbEpgModel *epgModel = manager->getEpgModel();
+	connect(epgModel, SIGNAL(entryAdded(DvbSharedEpgEntry)),
+		this, SLOT(entryChanged(DvbSharedEpgEntry)));
+	connect(epgModel, SIGNAL(entryUpdated(DvbSharedEpgEntry)),
+		this, SLOT(entryChanged(DvbSharedEpgEntry)));
+	connect(&checkTimer, SIGNAL(timeout()), this, SLOT(checkHarvest()));
+	checkTimer.setInterval(CheckInterval * 1000);
+}
+
+DvbEpgHarvester::~DvbEpgHarvester()
+{
+	if (device != NULL) {
+		stopHarvest(false);
+	}
+}
+
+void DvbEpgHarvester::setEnabled(bool enabled)
+{
+	if (enabled) {
+		checkTimer.start();
+	} else {
+		checkTimer.stop();
+
+		if (device != NULL) {
+			stopHarvest(false);
+		}
+	}
+}
+
+void DvbEpgHarvester::checkHarvest()
+{
+	QDateTime now = QDateTime::currentDateTime().toUTC();
+
+	if (device != NULL) {
+		// the schedule is complete once all sections of all services have been received
+		bool complete = ((harvestBegin.secsTo(now) >= MinDuration) &&
+			manager->getEpgModel()->isEventFilterComplete(device,
+			muxes.at(muxIndex).channel));
+
+		if (complete || (lastActivity.secsTo(now) >= IdleTimeout) ||
+		    (harvestBegin.secsTo(now) >= MaxDuration)) {
+			stopHarvest(true);
+		}
+
+		return;
+	}
+
+	updateMuxes();
+
+	// devices which are used anyway keep their epg filters running
+
+	foreach (const DvbDeviceConfig &deviceConfig, manager->getDeviceConfigs()) {
+		if ((deviceConfig.device == NULL) ||
+		    (deviceConfig.useCount <= deviceConfig.backgroundUseCount)) {
+			continue;
+		}
+
+		for (int i = 0; i < muxes.size(); ++i) {
+			const DvbSharedChannel &channel = muxes.at(i).channel;
+
+			if ((channel->source == deviceConfig.source) &&
+			    channel->transponder.corresponds(deviceConfig.transponder)) {
+				muxes[i].lastHarvest = now;
+				break;
+			}
+		}
+	}
+
+	int index = findStalestMux(now);
+
+	if (index < 0) {
+		return;
+	}
+
+	const DvbSharedChannel &channel = muxes.at(index).channel;
+	DvbDevice *newDevice = manager->requestDevice(channel->source, channel->transponder,
+		DvbManager::Background);
+
+	if (newDevice != NULL) {
+		startHarvest(index, newDevice);
+	}
+}
+
+void DvbEpgHarvester::deviceStateChanged()
+{
+	if (device->getDeviceState() == DvbDevice::DeviceReleased) {
+		// the device has been taken over by another request; it isn't ours anymore
+		disconnect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+		manager->getEpgModel()->stopEventFilter(device, muxes.at(muxIndex).channel);
+		device = NULL;
+		muxIndex = -1;
+	}
+}
+
+void DvbEpgHarvester::entryChanged(const DvbSharedEpgEntry &entry)
+{
+	if (device == NULL) {
+		return;
+	}
+
+	const DvbSharedChannel &channel = muxes.at(muxIndex).channel;
+
+	if ((entry->channel->source == channel->source) &&
+	    entry->channel->transponder.corresponds(channel->transponder)) {
+		lastActivity = QDateTime::currentDateTime().toUTC();
+		++changedEntries;
+	}
+}
+
+void DvbEpgHarvester::updateMuxes()
+{
+	QList<DvbEpgHarvesterMux> newMuxes;
+
+	foreach (const DvbSharedChannel &channel, manager->getChannelModel()->getChannels()) {
+		bool found = false;
+
+		for (int i = 0; i < newMuxes.size(); ++i) {
+			const DvbSharedChannel &muxChannel = newMuxes.at(i).channel;
+
+			if ((muxChannel->source == channel->source) &&
+			    muxChannel->transponder.corresponds(channel->transponder)) {
+				found = true;
+				break;
+			}
+		}
+
+		if (found) {
+			continue;
+		}
+
+		DvbEpgHarvesterMux mux;
+		mux.channel = channel;
+
+		foreach (const DvbEpgHarvesterMux &oldMux, muxes) {
+			if ((oldMux.channel->source == channel->source) &&
+			    oldMux.channel->transponder.corresponds(channel->transponder)) {
+				mux.lastHarvest = oldMux.lastHarvest;
+				mux.interval = oldMux.interval;
+				break;
+			}
+		}
+
+		newMuxes.append(mux);
+	}
+
+	muxes = newMuxes;
+}
+
+int DvbEpgHarvester::findStalestMux(const QDateTime &now) const
+{
+	// the transponder which is overdue for the longest time comes first
+	int index = -1;
+	qint64 maxOverdue = 0;
+
+	for (int i = 0; i < muxes.size(); ++i) {
+		const DvbEpgHarvesterMux &mux = muxes.at(i);
+		qint64 overdue = (qint64(DvbEpgHarvesterMux::MaxInterval) + 1);
+
+		if (mux.lastHarvest.isValid()) {
+			overdue = (mux.lastHarvest.secsTo(now) - mux.interval);
+		}
+
+		if (overdue > maxOverdue) {
+			index = i;
+			maxOverdue = overdue;
+		}
+	}
+
+	return index;
+}
+
+void DvbEpgHarvester::startHarvest(int index, DvbDevice *device_)
+{
+	device = device_;
+	muxIndex = index;
+	harvestBegin = QDateTime::currentDateTime().toUTC();
+	lastActivity = harvestBegin;
+	changedEntries = 0;
+	connect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+	manager->getEpgModel()->startEventFilter(device, muxes.at(muxIndex).channel);
+}
+
+void DvbEpgHarvester::stopHarvest(bool complete)
+{
+	DvbEpgHarvesterMux &mux = muxes[muxIndex];
+	disconnect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+	manager->getEpgModel()->stopEventFilter(device, mux.channel);
+	manager->releaseDevice(device, DvbManager::Background);
+	device = NULL;
+	muxIndex = -1;
+
+	if (complete) {
+		// transponders with a changing epg are visited more often
+		if (changedEntries > 0) {
+			mux.interval = qMax(mux.interval / 2, int(DvbEpgHarvesterMux::MinInterval));
+		} else {
+			mux.interval = qMin(mux.interval * 2, int(DvbEpgHarvesterMux::MaxInterval));
+		}
+
+		mux.lastHarvest = QDateTime::currentDateTime().toUTC();
+	}
+}
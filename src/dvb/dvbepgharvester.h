@@ -0,0 +1,90 @@
+/*
+ * dvbepgharvester.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBEPGHARVESTER_H
+#define DVBEPGHARVESTER_H
+
+#include <QDateTime>
+#include <QTimer>
+#include "dvbepgstore.h"
+
+class DvbDevice;
+class DvbManager;
+
+class DvbEpgHarvesterMux
+{
+public:
+	DvbEpgHarvesterMux() : interval(DefaultInterval) { }
+	~DvbEpgHarvesterMux() { }
+
+	enum {
+		DefaultInterval = (2 * 3600), // seconds
+		MinInterval = (1 * 3600),
+		MaxInterval = (24 * 3600)
+	};
+
+	DvbSharedChannel channel; // any channel of the transponder
+	QDateTime lastHarvest; // UTC; invalid if never harvested
+	int interval; // seconds; adapted to how often the epg of the transponder changes
+};
+
+/*
+ * collects the epg of all transponders with otherwise unused devices; the devices are
+ * requested as DvbManager::Background, so that every other request takes them away
+ */
+
+class DvbEpgHarvester : public QObject
+{
+	Q_OBJECT
+public:
+	DvbEpgHarvester(DvbManager *manager_, QObject *parent);
+	~DvbEpgHarvester();
+
+	void setEnabled(bool enabled);
+
+private slots:
+	void checkHarvest();
+	void deviceStateChanged();
+	void entryChanged(const DvbSharedEpgEntry &entry);
+
+private:
+	enum {
+		CheckInterval = 10, // seconds
+		MinDuration = 30, // seconds (services may only appear after a while)
+		IdleTimeout = 45, // seconds without new or changed entries (no complete schedule)
+		MaxDuration = 300 // seconds
+	};
+
+	void updateMuxes();
+	int findStalestMux(const QDateTime &now) const;
+	void startHarvest(int index, DvbDevice *device_);
+	void stopHarvest(bool complete);
+
+	DvbManager *manager;
+	QList<DvbEpgHarvesterMux> muxes;
+	QTimer checkTimer;
+	DvbDevice *device;
+	int muxIndex;
+	QDateTime harvestBegin; // UTC
+	QDateTime lastActivity; // UTC
+	int changedEntries;
+};
+
+#endif /* DVBEPGHARVESTER_H */
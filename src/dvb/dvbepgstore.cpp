@@ -0,0 +1,475 @@
+/*
+ * dvbepgstore.cpp
+ *
+ * Copyright (C) 2009-2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbepgstore.h"
+
+bool DvbEpgEntry::validate() const
+{
+	if (channel.isValid() && begin.isValid() && (begin.timeSpec() == Qt::UTC) &&
+	    duration.isValid()) {
+		return true;
+	}
+
+	return false;
+}
+
+class DvbEpgEventRecordLessThan
+{
+public:
+	bool operator()(const DvbEpgEventRecord &x, const DvbEpgEventRecord &y) const
+	{
+		return (x.begin < y.begin);
+	}
+};
+
+void DvbEpgStore::intern(DvbEpgEntry *entry)
+{
+	intern(entry->title);
+	intern(entry->subheading);
+	intern(entry->details);
+}
+
+DvbSharedEpgEntry DvbEpgStore::find(const DvbEpgEntry &entry) const
+{
+	if (entry.eventId >= 0) {
+		DvbSharedEpgEntry existingEntry =
+			events.value(DvbEpgEventKey(entry.channel.constData(), entry.eventId));
+
+		if (existingEntry.isValid()) {
+			return existingEntry;
+		}
+	}
+
+	QHash<DvbSharedChannel, QVector<DvbEpgEventRecord> >::ConstIterator it =
+		channels.constFind(entry.channel);
+
+	if (it == channels.constEnd()) {
+		return DvbSharedEpgEntry();
+	}
+
+	const QVector<DvbEpgEventRecord> &records = *it;
+	DvbEpgEventRecord record;
+	record.begin = entry.begin.toTime_t();
+
+	for (QVector<DvbEpgEventRecord>::ConstIterator recordIt = qLowerBound(
+	     records.constBegin(), records.constEnd(), record, DvbEpgEventRecordLessThan());
+	     (recordIt != records.constEnd()) && (recordIt->begin == record.begin); ++recordIt) {
+		// an entry with event id may complete the same entry without one (xmltv or old
+		// database rows); the entries with another event id are different events
+		if ((entry.eventId < 0) || (recordIt->eventId < 0)) {
+			return recordIt->entry;
+		}
+	}
+
+	return DvbSharedEpgEntry();
+}
+
+bool DvbEpgStore::contains(const DvbSharedEpgEntry &entry) const
+{
+	return (indexOf(channels.value(entry->channel), entry) >= 0);
+}
+
+void DvbEpgStore::insert(const DvbSharedEpgEntry &entry)
+{
+	QVector<DvbEpgEventRecord> &records = channels[entry->channel];
+	DvbEpgEventRecord record;
+	record.begin = entry->begin.toTime_t();
+	record.duration = QTime().secsTo(entry->duration);
+	record.eventId = entry->eventId;
+	record.entry = entry;
+	records.insert(qUpperBound(records.begin(), records.end(), record,
+		DvbEpgEventRecordLessThan()), record);
+
+	if (entry->eventId >= 0) {
+		events.insert(DvbEpgEventKey(entry->channel.constData(), entry->eventId), entry);
+	}
+
+	++entryCount;
+}
+
+bool DvbEpgStore::remove(const DvbSharedEpgEntry &entry)
+{
+	QHash<DvbSharedChannel, QVector<DvbEpgEventRecord> >::Iterator it =
+		channels.find(entry->channel);
+
+	if (it == channels.end()) {
+		return false;
+	}
+
+	int index = indexOf(*it, entry);
+
+	if (index < 0) {
+		return false;
+	}
+
+	it->remove(index);
+
+	if (it->isEmpty()) {
+		channels.erase(it);
+	}
+
+	removeEvent(entry);
+	entriesRemoved(1);
+	return true;
+}
+
+QList<DvbSharedEpgEntry> DvbEpgStore::takeEntries(const DvbSharedChannel &channel)
+{
+	QList<DvbSharedEpgEntry> entries;
+
+	foreach (const DvbEpgEventRecord &record, channels.take(channel)) {
+		removeEvent(record.entry);
+		entries.append(record.entry);
+	}
+
+	entriesRemoved(entries.size());
+	return entries;
+}
+
+QList<DvbSharedEpgEntry> DvbEpgStore::takeExpiredEntries(qint64 now)
+{
+	QList<DvbSharedEpgEntry> expiredEntries;
+	QHash<DvbSharedChannel, QVector<DvbEpgEventRecord> >::Iterator it = channels.begin();
+
+	while (it != channels.end()) {
+		QVector<DvbEpgEventRecord> &records = *it;
+		int count = 0;
+
+		while ((count < records.size()) && (records.at(count).begin < now)) {
+			++count;
+		}
+
+		// usually all of them except the running entry
+		QVector<DvbEpgEventRecord> runningRecords;
+
+		for (int i = 0; i < count; ++i) {
+			const DvbEpgEventRecord &record = records.at(i);
+
+			if ((record.begin + record.duration) <= now) {
+				removeEvent(record.entry);
+				expiredEntries.append(record.entry);
+			} else {
+				runningRecords.append(record);
+			}
+		}
+
+		if (runningRecords.size() != count) {
+			records.remove(0, count - runningRecords.size());
+
+			for (int i = 0; i < runningRecords.size(); ++i) {
+				records.replace(i, runningRecords.at(i));
+			}
+		}
+
+		if (records.isEmpty()) {
+			it = channels.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	entriesRemoved(expiredEntries.size());
+	return expiredEntries;
+}
+
+QList<DvbSharedEpgEntry> DvbEpgStore::getEntries() const
+{
+	QList<DvbSharedEpgEntry> entries;
+	entries.reserve(entryCount);
+
+	for (QHash<DvbSharedChannel, QVector<DvbEpgEventRecord> >::ConstIterator it =
+	     channels.constBegin(); it != channels.constEnd(); ++it) {
+		foreach (const DvbEpgEventRecord &record, *it) {
+			entries.append(record.entry);
+		}
+	}
+
+	return entries;
+}
+
+QHash<DvbSharedChannel, int> DvbEpgStore::getChannels() const
+{
+	QHash<DvbSharedChannel, int> result;
+
+	for (QHash<DvbSharedChannel, QVector<DvbEpgEventRecord> >::ConstIterator it =
+	     channels.constBegin(); it != channels.constEnd(); ++it) {
+		result.insert(it.key(), it->size());
+	}
+
+	return result;
+}
+
+void DvbEpgStore::intern(QString &string)
+{
+	if (string.isEmpty()) {
+		return;
+	}
+
+	QSet<QString>::ConstIterator it = strings.constFind(string);
+
+	if (it != strings.constEnd()) {
+		string = *it;
+	} else {
+		strings.insert(string);
+	}
+}
+
+void DvbEpgStore::entriesRemoved(int count)
+{
+	entryCount -= count;
+	removedCount += count;
+
+	if (removedCount >= qMax(strings.size() / 4, 1024)) {
+		purgeStrings();
+	}
+}
+
+void DvbEpgStore::removeEvent(const DvbSharedEpgEntry &entry)
+{
+	if (entry->eventId >= 0) {
+		QHash<DvbEpgEventKey, DvbSharedEpgEntry>::Iterator it =
+			events.find(DvbEpgEventKey(entry->channel.constData(), entry->eventId));
+
+		if ((it != events.end()) && (*it == entry)) {
+			events.erase(it);
+		}
+	}
+}
+
+int DvbEpgStore::indexOf(const QVector<DvbEpgEventRecord> &records,
+	const DvbSharedEpgEntry &entry) const
+{
+	DvbEpgEventRecord record;
+	record.begin = entry->begin.toTime_t();
+
+	for (QVector<DvbEpgEventRecord>::ConstIterator it = qLowerBound(records.constBegin(),
+	     records.constEnd(), record, DvbEpgEventRecordLessThan());
+	     (it != records.constEnd()) && (it->begin == record.begin); ++it) {
+		if (it->entry == entry) {
+			return (it - records.constBegin());
+		}
+	}
+
+	return -1;
+}
+
+void DvbEpgStore::purgeStrings()
+{
+	// strings which are only referenced by the pool aren't needed anymore
+	QSet<QString>::Iterator it = strings.begin();
+
+	while (it != strings.end()) {
+		if (it->isDetached()) {
+			it = strings.erase(it);
+		} else {
+			++it;
+		}
+	}
+
+	removedCount = 0;
+}
+
+void DvbEpgSearchIndex::insert(const DvbSharedEpgEntry &entry)
+{
+	int id = documents.size();
+	documents.append(entry);
+	documentIds.insert(entry.constData(), id);
+	QStringList tokens = (tokenize(entry->title) + tokenize(entry->subheading) +
+		tokenize(entry->details));
+	tokens.removeDuplicates();
+
+	// the ids are ascending, so the posting lists stay sorted
+	foreach (const QString &token, tokens) {
+		postings[token].append(id);
+	}
+}
+
+void DvbEpgSearchIndex::remove(const DvbSharedEpgEntry &entry)
+{
+	QHash<const DvbEpgEntry *, int>::Iterator it = documentIds.find(entry.constData());
+
+	if (it == documentIds.end()) {
+		return;
+	}
+
+	// the posting lists are cleaned up when enough entries have been removed
+	documents[*it] = DvbSharedEpgEntry();
+	documentIds.erase(it);
+
+	if (++removedCount >= qMax(documents.size() / 2, 1024)) {
+		compact();
+	}
+}
+
+QList<DvbSharedEpgEntry> DvbEpgSearchIndex::find(const QString &query) const
+{
+	QVector<int> ids;
+	bool first = true;
+
+	foreach (const QString &token, tokenize(query)) {
+		QVector<int> tokenIds;
+
+		for (QMap<QString, QVector<int> >::ConstIterator it = postings.lowerBound(token);
+		     (it != postings.constEnd()) && it.key().startsWith(token); ++it) {
+			tokenIds += *it;
+		}
+
+		qSort(tokenIds);
+
+		if (first) {
+			ids.reserve(tokenIds.size());
+
+			for (int i = 0; i < tokenIds.size(); ++i) {
+				if ((i == 0) || (tokenIds.at(i) != tokenIds.at(i - 1))) {
+					ids.append(tokenIds.at(i));
+				}
+			}
+
+			first = false;
+		} else {
+			// intersection of two sorted lists
+			QVector<int> remainingIds;
+			int i = 0;
+			int j = 0;
+
+			while ((i < ids.size()) && (j < tokenIds.size())) {
+				if (ids.at(i) < tokenIds.at(j)) {
+					++i;
+				} else if (tokenIds.at(j) < ids.at(i)) {
+					++j;
+				} else {
+					remainingIds.append(ids.at(i));
+					++i;
+					++j;
+				}
+			}
+
+			ids = remainingIds;
+		}
+
+		if (ids.isEmpty()) {
+			break;
+		}
+	}
+
+	QList<DvbSharedEpgEntry> entries;
+
+	foreach (int id, ids) {
+		const DvbSharedEpgEntry &entry = documents.at(id);
+
+		if (entry.isValid()) {
+			entries.append(entry);
+		}
+	}
+
+	return entries;
+}
+
+QStringList DvbEpgSearchIndex::tokenize(const QString &text)
+{
+	// the decomposition separates the diacritics from the base characters
+	QString normalizedText = text.normalized(QString::NormalizationForm_KD);
+	QStringList tokens;
+	QString token;
+
+	for (int i = 0; i < normalizedText.size(); ++i) {
+		QChar character = normalizedText.at(i);
+
+		if (character.isLetterOrNumber()) {
+			token.append(character.toCaseFolded());
+		} else if (!character.isMark() && !token.isEmpty()) {
+			tokens.append(token);
+			token.clear();
+		}
+	}
+
+	if (!token.isEmpty()) {
+		tokens.append(token);
+	}
+
+	return tokens;
+}
+
+bool DvbEpgSearchIndex::matches(const DvbEpgEntry &entry, const QStringList &queryTokens)
+{
+	QStringList tokens = (tokenize(entry.title) + tokenize(entry.subheading) +
+		tokenize(entry.details));
+
+	foreach (const QString &queryToken, queryTokens) {
+		bool found = false;
+
+		foreach (const QString &token, tokens) {
+			if (token.startsWith(queryToken)) {
+				found = true;
+				break;
+			}
+		}
+
+		if (!found) {
+			return false;
+		}
+	}
+
+	return !queryTokens.isEmpty();
+}
+
+void DvbEpgSearchIndex::compact()
+{
+	// renumbers the entries (keeping their order) and drops the removed ones
+	QVector<int> newIds(documents.size(), -1);
+	QVector<DvbSharedEpgEntry> newDocuments;
+	newDocuments.reserve(documentIds.size());
+
+	for (int i = 0; i < documents.size(); ++i) {
+		const DvbSharedEpgEntry &entry = documents.at(i);
+
+		if (entry.isValid()) {
+			newIds[i] = newDocuments.size();
+			documentIds.insert(entry.constData(), newDocuments.size());
+			newDocuments.append(entry);
+		}
+	}
+
+	QMap<QString, QVector<int> >::Iterator it = postings.begin();
+
+	while (it != postings.end()) {
+		QVector<int> &ids = *it;
+		int count = 0;
+
+		for (int i = 0; i < ids.size(); ++i) {
+			int id = newIds.at(ids.at(i));
+
+			if (id >= 0) {
+				ids[count] = id;
+				++count;
+			}
+		}
+
+		if (count == 0) {
+			it = postings.erase(it);
+		} else {
+			ids.resize(count);
+			++it;
+		}
+	}
+
+	documents = newDocuments;
+	removedCount = 0;
+}
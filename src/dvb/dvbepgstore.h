@@ -0,0 +1,186 @@
+/*
+ * dvbepgstore.h
+ *
+ * Copyright (C) 2009-2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBEPGSTORE_H
+#define DVBEPGSTORE_H
+
+#include <QSet>
+#include <QStringList>
+#include "dvbrecording.h"
+
+class DvbEpgEntry : public SharedData, public SqlKey
+{
+public:
+	DvbEpgEntry() : eventId(-1) { }
+	explicit DvbEpgEntry(const DvbSharedChannel &channel_) : channel(channel_), eventId(-1) { }
+	~DvbEpgEntry() { }
+
+	// checks that all variables are ok
+	// 'sqlKey' is ignored
+	bool validate() const;
+
+	DvbSharedChannel channel;
+	QDateTime begin; // UTC
+	QTime duration;
+	QString title;
+	QString subheading;
+	QString details;
+	int eventId; // may be -1 (not present)
+	DvbSharedRecording recording;
+};
+
+typedef ExplicitlySharedDataPointer<const DvbEpgEntry> DvbSharedEpgEntry;
+Q_DECLARE_TYPEINFO(DvbSharedEpgEntry, Q_MOVABLE_TYPE);
+
+// fixed-size record; searching and sorting only touch these fields
+
+class DvbEpgEventRecord
+{
+public:
+	qint64 begin; // seconds since the epoch
+	int duration; // seconds
+	int eventId;
+	DvbSharedEpgEntry entry;
+};
+
+Q_DECLARE_TYPEINFO(DvbEpgEventRecord, Q_MOVABLE_TYPE);
+
+// the event id is unique within a service (as long as the event hasn't ended)
+
+class DvbEpgEventKey
+{
+public:
+	DvbEpgEventKey(const DvbChannel *channel_, int eventId_) : channel(channel_),
+		eventId(eventId_) { }
+	~DvbEpgEventKey() { }
+
+	bool operator==(const DvbEpgEventKey &other) const
+	{
+		return ((channel == other.channel) && (eventId == other.eventId));
+	}
+
+	const DvbChannel *channel;
+	int eventId;
+};
+
+Q_DECLARE_TYPEINFO(DvbEpgEventKey, Q_PRIMITIVE_TYPE);
+
+inline uint qHash(const DvbEpgEventKey &key)
+{
+	return (qHash(key.channel) ^ uint(key.eventId));
+}
+
+/*
+ * the epg entries of every channel are kept in a vector sorted by begin; the texts are
+ * interned (repeated titles and descriptions share the same string data)
+ */
+
+class DvbEpgStore
+{
+public:
+	DvbEpgStore() : entryCount(0), removedCount(0) { }
+	~DvbEpgStore() { }
+
+	// replaces the texts by the shared copies of the pool
+	void intern(DvbEpgEntry *entry);
+
+	// returns the entry with the same channel and event id; otherwise an entry of the same
+	// channel with the same begin is returned (if 'entry' has an event id, only entries
+	// without one are considered); no texts are compared
+	DvbSharedEpgEntry find(const DvbEpgEntry &entry) const;
+	bool contains(const DvbSharedEpgEntry &entry) const;
+
+	void insert(const DvbSharedEpgEntry &entry);
+	bool remove(const DvbSharedEpgEntry &entry);
+	QList<DvbSharedEpgEntry> takeEntries(const DvbSharedChannel &channel);
+
+	// removes the entries which have ended at 'now' (seconds since the epoch); only the
+	// entries which have already begun are looked at
+	QList<DvbSharedEpgEntry> takeExpiredEntries(qint64 now);
+
+	QList<DvbSharedEpgEntry> getEntries() const;
+	QVector<DvbEpgEventRecord> getEntries(const DvbSharedChannel &channel) const
+	{
+		return channels.value(channel);
+	}
+
+	QHash<DvbSharedChannel, int> getChannels() const;
+
+	bool hasEntries(const DvbSharedChannel &channel) const
+	{
+		return channels.contains(channel);
+	}
+
+	int size() const
+	{
+		return entryCount;
+	}
+
+	int stringCount() const
+	{
+		return strings.size();
+	}
+
+private:
+	void intern(QString &string);
+	void entriesRemoved(int count);
+	void removeEvent(const DvbSharedEpgEntry &entry);
+	int indexOf(const QVector<DvbEpgEventRecord> &records,
+		const DvbSharedEpgEntry &entry) const;
+	void purgeStrings();
+
+	QHash<DvbSharedChannel, QVector<DvbEpgEventRecord> > channels; // sorted by begin
+	QHash<DvbEpgEventKey, DvbSharedEpgEntry> events; // only entries with an event id
+	QSet<QString> strings;
+	int entryCount;
+	int removedCount; // since the last purge of the string pool
+};
+
+/*
+ * inverted index over the texts of the entries; the words are case and diacritic folded
+ * and every word of a query matches the words beginning with it
+ */
+
+class DvbEpgSearchIndex
+{
+public:
+	DvbEpgSearchIndex() : removedCount(0) { }
+	~DvbEpgSearchIndex() { }
+
+	void insert(const DvbSharedEpgEntry &entry);
+	void remove(const DvbSharedEpgEntry &entry);
+
+	// returns the entries matching all words of the query
+	QList<DvbSharedEpgEntry> find(const QString &query) const;
+
+	static QStringList tokenize(const QString &text);
+	// 'queryTokens' has to be the result of tokenize()
+	static bool matches(const DvbEpgEntry &entry, const QStringList &queryTokens);
+
+private:
+	void compact();
+
+	QMap<QString, QVector<int> > postings; // sorted ids (positions in 'documents')
+	QVector<DvbSharedEpgEntry> documents; // invalid if removed
+	QHash<const DvbEpgEntry *, int> documentIds;
+	int removedCount;
+};
+
+#endif /* DVBEPGSTORE_H */
@@ -0,0 +1,1139 @@
+/*
+ * dvbfilewriter.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbfilewriter.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QFile>
+#include <QMap>
+#include <QSet>
+#include <config-kaffeine.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <stdlib.h>
+#include <string.h>
+#include <sys/stat.h> // bsd compatibility
+#include <sys/types.h> // bsd compatibility
+#include <sys/uio.h>
+#include <unistd.h>
+#include "../log.h"
+
+#ifndef HAVE_IO_URING
+#error HAVE_IO_URING must be defined
+#endif /* HAVE_IO_URING */
+
+#if HAVE_IO_URING == 1
+#include <linux/io_uring.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#endif /* HAVE_IO_URING == 1 */
+
+class DvbFileWriterFile
+{
+public:
+	DvbFileWriterFile() : fd(-1), directIo(false), failed(false), preallocated(false),
+		syncInterval(0), offset(0), committedSize(0), inFlight(0), usedBlocks(0), maxBlocks(2),
+		latencyHistogram(DvbFileWriterThread::LatencyBuckets, 0) { }
+	~DvbFileWriterFile() { }
+
+	QString fileName;
+	int fd;
+	bool directIo;
+
+	// only accessed by the writer thread
+	bool failed;
+	bool preallocated; // the unused space is released when the file is closed
+	int syncInterval; // milliseconds
+	QElapsedTimer syncTimer;
+	qint64 offset; // of the next block
+	// the file is complete up to this size; io_uring requests may complete out of order
+	qint64 committedSize; // protected by the mutex
+	QMap<qint64, qint64> completedRanges; // offset --> end (after committedSize)
+	int inFlight; // io_uring requests
+
+	int usedBlocks;
+	int maxBlocks;
+	QVector<int> latencyHistogram;
+};
+
+class DvbFileWriterBlock
+{
+public:
+	DvbFileWriterBlock() : data(NULL), size(0), file(NULL), last(false), bufferIndex(-1),
+		offset(0), written(0), next(NULL) { }
+	~DvbFileWriterBlock() { }
+
+	char *data; // aligned to DvbFileWriterThread::Alignment
+	int size;
+	DvbFileWriterFile *file;
+	bool last; // the file is closed after writing this block
+	int bufferIndex; // index of the registered io_uring buffer or -1
+
+	// only accessed by the writer thread
+	qint64 offset; // file offset
+	int written;
+	QElapsedTimer timer;
+	struct iovec iovec;
+
+	DvbFileWriterBlock *next;
+};
+
+#if HAVE_IO_URING == 1
+class DvbIoUring
+{
+public:
+	DvbIoUring() : ringFd(-1), sqRing(MAP_FAILED), cqRing(MAP_FAILED), sqes(MAP_FAILED),
+		sqRingSize(0), cqRingSize(0), sqesSize(0) { }
+	~DvbIoUring();
+
+	bool init(unsigned int entries);
+	bool registerBuffers(const QVector<struct iovec> &buffers);
+
+	unsigned int getEntries() const
+	{
+		return sqEntries;
+	}
+
+	struct io_uring_sqe *getSqe(); // returns NULL if the submission queue is full
+	bool submitAndWait(bool wait); // waits for at least one completion if 'wait' is true
+	bool getCqe(quint64 &userData, int &result); // returns false if there's no completion
+
+private:
+	Q_DISABLE_COPY(DvbIoUring)
+
+	int ringFd;
+	void *sqRing;
+	void *cqRing;
+	void *sqes;
+	size_t sqRingSize;
+	size_t cqRingSize;
+	size_t sqesSize;
+	unsigned int sqEntries;
+	unsigned int *sqHead;
+	unsigned int *sqTail;
+	unsigned int sqMask;
+	unsigned int *sqArray;
+	unsigned int *cqHead;
+	unsigned int *cqTail;
+	unsigned int cqMask;
+	struct io_uring_cqe *cqes;
+};
+
+DvbIoUring::~DvbIoUring()
+{
+	if (sqes != MAP_FAILED) {
+		munmap(sqes, sqesSize);
+	}
+
+	if ((cqRing != MAP_FAILED) && (cqRing != sqRing)) {
+		munmap(cqRing, cqRingSize);
+	}
+
+	if (sqRing != MAP_FAILED) {
+		munmap(sqRing, sqRingSize);
+	}
+
+	if (ringFd >= 0) {
+		close(ringFd);
+	}
+}
+
+bool DvbIoUring::init(unsigned int entries)
+{
+	// the raw system call interface is used, so that liburing isn't needed
+
+	struct io_uring_params params;
+	memset(&params, 0, sizeof(params));
+	ringFd = int(syscall(__NR_io_uring_setup, entries, &params));
+
+	if (ringFd < 0) {
+		return false;
+	}
+
+	sqEntries = params.sq_entries;
+	sqRingSize = (params.sq_off.array + params.sq_entries * sizeof(unsigned int));
+	cqRingSize = (params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe));
+	sqesSize = (params.sq_entries * sizeof(struct io_uring_sqe));
+	bool singleMmap = false;
+
+#ifdef IORING_FEAT_SINGLE_MMAP
+	if ((params.features & IORING_FEAT_SINGLE_MMAP) != 0) {
+		singleMmap = true;
+		sqRingSize = qMax(sqRingSize, cqRingSize);
+		cqRingSize = sqRingSize;
+	}
+#endif
+
+	sqRing = mmap(NULL, sqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+		IORING_OFF_SQ_RING);
+
+	if (sqRing == MAP_FAILED) {
+		return false;
+	}
+
+	if (singleMmap) {
+		cqRing = sqRing;
+	} else {
+		cqRing = mmap(NULL, cqRingSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE,
+			ringFd, IORING_OFF_CQ_RING);
+
+		if (cqRing == MAP_FAILED) {
+			return false;
+		}
+	}
+
+	sqes = mmap(NULL, sqesSize, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, ringFd,
+		IORING_OFF_SQES);
+
+	if (sqes == MAP_FAILED) {
+		return false;
+	}
+
+	char *sq = static_cast<char *>(sqRing);
+	sqHead = reinterpret_cast<unsigned int *>(sq + params.sq_off.head);
+	sqTail = reinterpret_cast<unsigned int *>(sq + params.sq_off.tail);
+	sqMask = *reinterpret_cast<unsigned int *>(sq + params.sq_off.ring_mask);
+	sqArray = reinterpret_cast<unsigned int *>(sq + params.sq_off.array);
+	char *cq = static_cast<char *>(cqRing);
+	cqHead = reinterpret_cast<unsigned int *>(cq + params.cq_off.head);
+	cqTail = reinterpret_cast<unsigned int *>(cq + params.cq_off.tail);
+	cqMask = *reinterpret_cast<unsigned int *>(cq + params.cq_off.ring_mask);
+	cqes = reinterpret_cast<struct io_uring_cqe *>(cq + params.cq_off.cqes);
+	return true;
+}
+
+bool DvbIoUring::registerBuffers(const QVector<struct iovec> &buffers)
+{
+	return (syscall(__NR_io_uring_register, ringFd, IORING_REGISTER_BUFFERS,
+		buffers.constData(), buffers.size()) == 0);
+}
+
+struct io_uring_sqe *DvbIoUring::getSqe()
+{
+	unsigned int tail = *sqTail;
+
+	if ((tail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE)) >= sqEntries) {
+		return NULL;
+	}
+
+	unsigned int index = (tail & sqMask);
+	struct io_uring_sqe *sqe = (static_cast<struct io_uring_sqe *>(sqes) + index);
+	memset(sqe, 0, sizeof(struct io_uring_sqe));
+	sqArray[index] = index;
+	__atomic_store_n(sqTail, tail + 1, __ATOMIC_RELEASE);
+	return sqe;
+}
+
+bool DvbIoUring::submitAndWait(bool wait)
+{
+	while (true) {
+		// the kernel advances the head for every consumed entry
+		unsigned int toSubmit = (*sqTail - __atomic_load_n(sqHead, __ATOMIC_ACQUIRE));
+		unsigned int flags = (wait ? IORING_ENTER_GETEVENTS : 0);
+
+		if ((toSubmit == 0) && !wait) {
+			return true;
+		}
+
+		if (syscall(__NR_io_uring_enter, ringFd, toSubmit, wait ? 1 : 0, flags, NULL, 0) >= 0) {
+			return true;
+		}
+
+		if ((errno != EINTR) && (errno != EAGAIN) && (errno != EBUSY)) {
+			return false;
+		}
+	}
+}
+
+bool DvbIoUring::getCqe(quint64 &userData, int &result)
+{
+	unsigned int head = *cqHead;
+
+	if (head == __atomic_load_n(cqTail, __ATOMIC_ACQUIRE)) {
+		return false;
+	}
+
+	const struct io_uring_cqe *cqe = (cqes + (head & cqMask));
+	userData = cqe->user_data;
+	result = cqe->res;
+	__atomic_store_n(cqHead, head + 1, __ATOMIC_RELEASE);
+	return true;
+}
+#endif /* HAVE_IO_URING == 1 */
+
+DvbFileWriterThread::DvbFileWriterThread(QObject *parent) : QThread(parent), unusedBlocks(NULL),
+	unusedBlockCount(0), pendingBlocksHead(NULL), pendingBlocksTail(NULL),
+	latencyHistogram(LatencyBuckets, 0), ioUringEnabled(false), ioUringActive(false),
+	stopped(false)
+{
+}
+
+DvbFileWriterThread::~DvbFileWriterThread()
+{
+	mutex.lock();
+	stopped = true;
+	condition.wakeOne();
+	mutex.unlock();
+	wait();
+
+	while (unusedBlocks != NULL) {
+		DvbFileWriterBlock *block = unusedBlocks;
+		unusedBlocks = block->next;
+		free(block->data);
+		delete block;
+	}
+
+	foreach (const QString &message, messages) {
+		Log("DvbFileWriterThread::~DvbFileWriterThread:") << message;
+	}
+}
+
+void DvbFileWriterThread::setIoUringEnabled(bool enabled)
+{
+	if (isRunning()) {
+		Log("DvbFileWriterThread::setIoUringEnabled: thread is already running");
+		return;
+	}
+
+	ioUringEnabled = enabled;
+}
+
+bool DvbFileWriterThread::isIoUringActive() const
+{
+	QMutexLocker locker(&mutex);
+	return ioUringActive;
+}
+
+QVector<int> DvbFileWriterThread::getLatencyHistogram() const
+{
+	QMutexLocker locker(&mutex);
+	return latencyHistogram;
+}
+
+QString DvbFileWriterThread::formatLatencyHistogram(const QVector<int> &histogram)
+{
+	QStringList entries;
+
+	for (int i = 0; i < histogram.size(); ++i) {
+		if (histogram.at(i) == 0) {
+			continue;
+		}
+
+		QString bucket;
+
+		if (i == 0) {
+			bucket = QLatin1String("<1ms");
+		} else {
+			bucket = QString(QLatin1String("%1ms")).arg(1 << (i - 1));
+		}
+
+		entries.append(bucket + QLatin1Char('=') + QString::number(histogram.at(i)));
+	}
+
+	return entries.join(QLatin1String(" "));
+}
+
+DvbFileWriterBlock *DvbFileWriterThread::takeBlock(DvbFileWriterFile *file, bool force)
+{
+	QMutexLocker locker(&mutex);
+
+	if ((file->usedBlocks >= file->maxBlocks) && !force) {
+		return NULL;
+	}
+
+	DvbFileWriterBlock *block = unusedBlocks;
+
+	if (block != NULL) {
+		unusedBlocks = block->next;
+		--unusedBlockCount;
+	} else {
+		void *data = NULL;
+
+		if (posix_memalign(&data, Alignment, BlockSize) != 0) {
+			return NULL;
+		}
+
+		block = new DvbFileWriterBlock();
+		block->data = static_cast<char *>(data);
+	}
+
+	++file->usedBlocks;
+	block->size = 0;
+	block->file = file;
+	block->last = false;
+	block->next = NULL;
+	return block;
+}
+
+void DvbFileWriterThread::submitBlock(DvbFileWriterBlock *block)
+{
+	QMutexLocker locker(&mutex);
+
+	if (pendingBlocksTail != NULL) {
+		pendingBlocksTail->next = block;
+	} else {
+		pendingBlocksHead = block;
+	}
+
+	pendingBlocksTail = block;
+	condition.wakeOne();
+}
+
+void DvbFileWriterThread::releaseBlock(DvbFileWriterBlock *block)
+{
+	--block->file->usedBlocks;
+	block->file = NULL;
+
+	// keep a few blocks around, so that they can be reused without allocation
+	// (registered io_uring buffers are always kept)
+	if ((block->data == NULL) || ((block->bufferIndex < 0) && (unusedBlockCount >= 8))) {
+		free(block->data);
+		delete block;
+		return;
+	}
+
+	block->next = unusedBlocks;
+	unusedBlocks = block;
+	++unusedBlockCount;
+}
+
+void DvbFileWriterThread::completeBlock(DvbFileWriterBlock *block)
+{
+	DvbFileWriterFile *file = block->file;
+	bool last = block->last;
+
+	if (!file->failed && (block->size > 0)) {
+		file->completedRanges.insert(block->offset, block->offset + block->size);
+
+		while (!file->completedRanges.isEmpty() &&
+		       (file->completedRanges.constBegin().key() == file->committedSize)) {
+			file->committedSize = file->completedRanges.constBegin().value();
+			file->completedRanges.erase(file->completedRanges.begin());
+		}
+	}
+
+	releaseBlock(block);
+
+	if (last) {
+		messages.append(file->fileName + QLatin1String(": write latency ") +
+			formatLatencyHistogram(file->latencyHistogram));
+		QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+		delete file;
+	}
+}
+
+void DvbFileWriterThread::customEvent(QEvent *event)
+{
+	Q_UNUSED(event)
+	QStringList currentMessages;
+
+	mutex.lock();
+	currentMessages.swap(messages);
+	mutex.unlock();
+
+	foreach (const QString &message, currentMessages) {
+		Log("DvbFileWriterThread::customEvent:") << message;
+	}
+}
+
+void DvbFileWriterThread::run()
+{
+#if HAVE_IO_URING == 1
+	if (ioUringEnabled) {
+		DvbIoUring ring;
+
+		if (!ring.init(64)) {
+			reportError(NULL, errno);
+		} else if (runIoUring(ring)) {
+			return;
+		}
+	}
+#endif /* HAVE_IO_URING == 1 */
+
+	QMutexLocker locker(&mutex);
+
+	while (true) {
+		if (pendingBlocksHead == NULL) {
+			if (stopped) {
+				break;
+			}
+
+			condition.wait(&mutex);
+			continue;
+		}
+
+		DvbFileWriterBlock *block = pendingBlocksHead;
+		pendingBlocksHead = block->next;
+
+		if (pendingBlocksHead == NULL) {
+			pendingBlocksTail = NULL;
+		}
+
+		locker.unlock();
+		writeBlock(block);
+		locker.relock();
+		completeBlock(block);
+	}
+}
+
+#if HAVE_IO_URING == 1
+bool DvbFileWriterThread::runIoUring(DvbIoUring &ring)
+{
+	// registered buffers avoid mapping the user pages for every request
+
+	QVector<struct iovec> buffers;
+	QList<DvbFileWriterBlock *> registeredBlocks;
+
+	for (int i = 0; i < RegisteredBlocks; ++i) {
+		void *data = NULL;
+
+		if (posix_memalign(&data, Alignment, BlockSize) != 0) {
+			break;
+		}
+
+		DvbFileWriterBlock *block = new DvbFileWriterBlock();
+		block->data = static_cast<char *>(data);
+		block->bufferIndex = i;
+		registeredBlocks.append(block);
+		struct iovec buffer;
+		buffer.iov_base = data;
+		buffer.iov_len = BlockSize;
+		buffers.append(buffer);
+	}
+
+	bool registered = ring.registerBuffers(buffers);
+
+	if (!registered) {
+		// e.g. RLIMIT_MEMLOCK is too small; the blocks are used without registration
+		reportError(NULL, errno);
+	}
+
+	QMutexLocker locker(&mutex);
+	ioUringActive = true;
+
+	foreach (DvbFileWriterBlock *block, registeredBlocks) {
+		if (!registered) {
+			block->bufferIndex = -1;
+		}
+
+		block->next = unusedBlocks;
+		unusedBlocks = block;
+		++unusedBlockCount;
+	}
+
+	QList<DvbFileWriterBlock *> backlog;
+	QList<DvbFileWriterBlock *> retryBlocks;
+	QList<DvbFileWriterBlock *> closingBlocks;
+	QSet<DvbFileWriterBlock *> submittedBlocks; // handed to the ring, not completed yet
+	int inFlight = 0;
+
+	while (true) {
+		if ((pendingBlocksHead == NULL) && backlog.isEmpty() && retryBlocks.isEmpty() &&
+		    closingBlocks.isEmpty() && (inFlight == 0)) {
+			if (stopped) {
+				break;
+			}
+
+			condition.wait(&mutex);
+			continue;
+		}
+
+		while (pendingBlocksHead != NULL) {
+			backlog.append(pendingBlocksHead);
+			pendingBlocksHead = pendingBlocksHead->next;
+		}
+
+		pendingBlocksTail = NULL;
+		locker.unlock();
+
+		// a file is closed (synchronously) after all of its requests are finished
+
+		for (int i = 0; i < closingBlocks.size(); ++i) {
+			DvbFileWriterBlock *block = closingBlocks.at(i);
+
+			if (block->file->inFlight == 0) {
+				closingBlocks.removeAt(i);
+				--i;
+				writeBlock(block);
+				locker.relock();
+				completeBlock(block);
+				locker.unlock();
+			}
+		}
+
+		while ((!retryBlocks.isEmpty() || !backlog.isEmpty()) &&
+		       (inFlight < int(ring.getEntries()))) {
+			DvbFileWriterBlock *block;
+
+			if (!retryBlocks.isEmpty()) {
+				block = retryBlocks.takeFirst();
+			} else {
+				block = backlog.takeFirst();
+				DvbFileWriterFile *file = block->file;
+
+				if (block->last) {
+					closingBlocks.append(block);
+					continue;
+				}
+
+				if (file->failed || (block->size == 0)) {
+					locker.relock();
+					completeBlock(block);
+					locker.unlock();
+					continue;
+				}
+
+				block->offset = file->offset;
+				block->written = 0;
+				block->timer.start();
+				file->offset += block->size;
+				++file->inFlight;
+			}
+
+			struct io_uring_sqe *sqe = ring.getSqe();
+
+			if (sqe == NULL) {
+				retryBlocks.prepend(block);
+				break;
+			}
+
+			DvbFileWriterFile *file = block->file;
+			sqe->fd = file->fd;
+			sqe->off = quint64(block->offset + block->written);
+			sqe->user_data = quint64(quintptr(block));
+
+			if (block->bufferIndex >= 0) {
+				sqe->opcode = IORING_OP_WRITE_FIXED;
+				sqe->addr = quint64(quintptr(block->data + block->written));
+				sqe->len = (block->size - block->written);
+				sqe->buf_index = block->bufferIndex;
+			} else {
+				block->iovec.iov_base = (block->data + block->written);
+				block->iovec.iov_len = (block->size - block->written);
+				sqe->opcode = IORING_OP_WRITEV;
+				sqe->addr = quint64(quintptr(&block->iovec));
+				sqe->len = 1;
+			}
+
+			submittedBlocks.insert(block);
+			++inFlight;
+
+			if ((file->syncInterval > 0) && (!file->syncTimer.isValid() ||
+			    (file->syncTimer.elapsed() >= file->syncInterval))) {
+				struct io_uring_sqe *syncSqe = ring.getSqe();
+
+				if (syncSqe != NULL) {
+					// the sync starts after the write has completed (it's cancelled if
+					// the write fails or is short)
+					sqe->flags |= IOSQE_IO_LINK;
+					// the lowest bit marks sync requests (blocks are aligned)
+					syncSqe->opcode = IORING_OP_FSYNC;
+					syncSqe->fd = file->fd;
+					syncSqe->fsync_flags = IORING_FSYNC_DATASYNC;
+					syncSqe->user_data = (quint64(quintptr(file)) | 1);
+					file->syncTimer.start();
+					++file->inFlight;
+					++inFlight;
+				}
+			}
+		}
+
+		if (!ring.submitAndWait(inFlight > 0)) {
+			// e.g. EBADF or ENOMEM (transient errors are retried by submitAndWait());
+			// the files with requests in the ring fail, the rest is written synchronously
+			int error = errno;
+			reportError(NULL, error);
+			QList<DvbFileWriterBlock *> failedBlocks = (submittedBlocks.toList() + retryBlocks);
+
+			foreach (DvbFileWriterBlock *block, failedBlocks) {
+				if (!block->file->failed) {
+					reportError(block->file, error);
+				}
+
+				block->file->inFlight = 0;
+			}
+
+			locker.relock();
+
+			foreach (DvbFileWriterBlock *block, failedBlocks) {
+				completeBlock(block);
+			}
+
+			QList<DvbFileWriterBlock *> remainingBlocks = (closingBlocks + backlog);
+
+			for (int i = (remainingBlocks.size() - 1); i >= 0; --i) {
+				DvbFileWriterBlock *block = remainingBlocks.at(i);
+				block->next = pendingBlocksHead;
+				pendingBlocksHead = block;
+
+				if (pendingBlocksTail == NULL) {
+					pendingBlocksTail = block;
+				}
+			}
+
+			// the buffers are unregistered together with the ring
+			for (DvbFileWriterBlock *block = unusedBlocks; block != NULL; block = block->next) {
+				block->bufferIndex = -1;
+			}
+
+			ioUringActive = false;
+			return false;
+		}
+
+		quint64 userData;
+		int result;
+
+		while (ring.getCqe(userData, result)) {
+			--inFlight;
+
+			if ((userData & 1) != 0) {
+				DvbFileWriterFile *file =
+					reinterpret_cast<DvbFileWriterFile *>(quintptr(userData & ~quint64(1)));
+				--file->inFlight;
+
+				if (result == -ECANCELED) {
+					// the linked write failed or was short; the next write is synced
+					file->syncTimer.invalidate();
+				} else if (result < 0) {
+					reportError(file, -result);
+				}
+
+				continue;
+			}
+
+			DvbFileWriterBlock *block =
+				reinterpret_cast<DvbFileWriterBlock *>(quintptr(userData));
+			DvbFileWriterFile *file = block->file;
+			submittedBlocks.remove(block);
+
+			if ((result == -EINTR) || (result == -EAGAIN)) {
+				retryBlocks.append(block);
+				continue;
+			}
+
+			if (result > 0) {
+				block->written += result;
+
+				if (block->written < block->size) {
+					// short write
+					retryBlocks.append(block);
+					continue;
+				}
+			} else if (!file->failed) {
+				reportError(file, (result < 0) ? -result : ENOSPC);
+			}
+
+			--file->inFlight;
+			recordLatency(file, block->timer.elapsed());
+			locker.relock();
+			completeBlock(block);
+			locker.unlock();
+		}
+
+		locker.relock();
+	}
+
+	ioUringActive = false;
+	return true;
+}
+#endif /* HAVE_IO_URING == 1 */
+
+void DvbFileWriterThread::writeBlock(DvbFileWriterBlock *block)
+{
+	DvbFileWriterFile *file = block->file;
+
+	if (!file->failed && (block->size > 0)) {
+#ifdef O_DIRECT
+		if (file->directIo && ((block->size % Alignment) != 0)) {
+			// only happens for the last block
+			int flags = fcntl(file->fd, F_GETFL);
+
+			if (flags >= 0) {
+				fcntl(file->fd, F_SETFL, flags & ~O_DIRECT);
+			}
+
+			file->directIo = false;
+		}
+#endif
+
+		QElapsedTimer timer;
+		timer.start();
+		block->offset = file->offset;
+		const char *data = block->data;
+		int size = block->size;
+
+		while (size > 0) {
+			int bytesWritten = int(pwrite(file->fd, data, size, file->offset));
+
+			if (bytesWritten < 0) {
+				if (errno == EINTR) {
+					continue;
+				}
+
+				reportError(file, errno);
+				break;
+			}
+
+			data += bytesWritten;
+			size -= bytesWritten;
+			file->offset += bytesWritten;
+		}
+
+		if ((file->syncInterval > 0) && !file->failed && !block->last &&
+		    (file->syncTimer.elapsed() >= file->syncInterval)) {
+			// the sync is part of the measured latency
+			fdatasync(file->fd);
+			file->syncTimer.start();
+		}
+
+		recordLatency(file, timer.elapsed());
+	}
+
+	if (block->last) {
+		if ((file->syncInterval > 0) && !file->failed) {
+			fdatasync(file->fd);
+		}
+
+		if (file->preallocated) {
+			// the blocks after the end of the file stay allocated otherwise
+			ftruncate(file->fd, file->offset);
+		}
+
+		::close(file->fd);
+		file->fd = -1;
+	}
+}
+
+void DvbFileWriterThread::reportError(DvbFileWriterFile *file, int error)
+{
+	QString message = QString::fromLocal8Bit(strerror(error));
+
+	if (file != NULL) {
+		file->failed = true;
+		message = (file->fileName + QLatin1String(": write failed: ") + message);
+	} else {
+		message = (QLatin1String("io_uring: ") + message);
+	}
+
+	QMutexLocker locker(&mutex);
+	messages.append(message);
+	QCoreApplication::postEvent(this, new QEvent(QEvent::User));
+}
+
+void DvbFileWriterThread::recordLatency(DvbFileWriterFile *file, qint64 latency)
+{
+	int bucket = 0;
+
+	while ((latency > 0) && (bucket < (LatencyBuckets - 1))) {
+		latency >>= 1;
+		++bucket;
+	}
+
+	QMutexLocker locker(&mutex);
+	++file->latencyHistogram[bucket];
+	++latencyHistogram[bucket];
+}
+
+DvbFileWriter::DvbFileWriter() : thread(NULL), file(NULL), currentBlock(NULL), currentSize(0),
+	overflowBytes(0)
+{
+}
+
+DvbFileWriter::~DvbFileWriter()
+{
+	close();
+}
+
+bool DvbFileWriter::open(DvbFileWriterThread *thread_, const QString &fileName_, bool directIo,
+	int maxBlocks, int syncInterval)
+{
+	close();
+	thread = thread_;
+	currentFileName = fileName_;
+	overflowBytes = 0;
+
+	QByteArray encodedName = QFile::encodeName(currentFileName);
+	int flags = (O_WRONLY | O_CREAT | O_EXCL);
+	int fd = -1;
+
+#ifdef O_DIRECT
+	if (directIo) {
+		fd = ::open(encodedName.constData(), flags | O_DIRECT, 0666);
+
+		if ((fd < 0) && (errno == EINVAL)) {
+			// not supported by the file system
+			Log("DvbFileWriter::open: O_DIRECT isn't supported for") << currentFileName;
+			directIo = false;
+		}
+	}
+#else
+	directIo = false;
+#endif
+
+	if (!directIo) {
+		fd = ::open(encodedName.constData(), flags, 0666);
+	}
+
+	if (fd < 0) {
+		return false;
+	}
+
+	startFile(fd, directIo, 0, maxBlocks, syncInterval);
+	return true;
+}
+
+bool DvbFileWriter::reopen(DvbFileWriterThread *thread_, const QString &fileName_,
+	qint64 maxSize, int maxBlocks, int syncInterval)
+{
+	close();
+	thread = thread_;
+	currentFileName = fileName_;
+	overflowBytes = 0;
+
+	int fd = ::open(QFile::encodeName(currentFileName).constData(), O_RDWR);
+
+	if (fd < 0) {
+		return false;
+	}
+
+	struct stat buf;
+
+	if (fstat(fd, &buf) != 0) {
+		::close(fd);
+		return false;
+	}
+
+	// the writes may complete out of order, so there may be holes before 'maxSize'; the
+	// last packet may be incomplete or garbage (interrupted write)
+	qint64 offset = qint64(buf.st_size);
+
+	if ((maxSize >= 0) && (offset > maxSize)) {
+		offset = maxSize;
+	}
+
+	offset = ((offset / 188) * 188);
+
+	while (offset > 0) {
+		char syncByte = 0;
+
+		if ((pread(fd, &syncByte, 1, offset - 188) == 1) && (syncByte == 0x47)) {
+			break;
+		}
+
+		offset -= 188;
+	}
+
+	if ((offset != buf.st_size) && (ftruncate(fd, offset) != 0)) {
+		::close(fd);
+		return false;
+	}
+
+	startFile(fd, false, offset, maxBlocks, syncInterval);
+	return true;
+}
+
+void DvbFileWriter::startFile(int fd, bool directIo, qint64 offset, int maxBlocks,
+	int syncInterval)
+{
+	file = new DvbFileWriterFile();
+	file->fileName = currentFileName;
+	file->fd = fd;
+	file->directIo = directIo;
+	file->offset = offset;
+	file->committedSize = offset;
+	file->maxBlocks = qMax(maxBlocks, 2);
+	file->syncInterval = (1000 * qMax(syncInterval, 0));
+	file->syncTimer.start();
+	currentSize = offset;
+
+	if (!thread->isRunning()) {
+		thread->start();
+	}
+}
+
+bool DvbFileWriter::preallocate(qint64 size)
+{
+	if ((file == NULL) || (size <= 0)) {
+		return false;
+	}
+
+#ifdef FALLOC_FL_KEEP_SIZE // linux (fcntl.h)
+	// the file size isn't changed, so readers (and reopen()) only see the written data
+	if (fallocate(file->fd, FALLOC_FL_KEEP_SIZE, currentSize, size) == 0) {
+		// only accessed by the writer thread after the file has been submitted for closing
+		file->preallocated = true;
+		return true;
+	}
+
+	if ((errno != EOPNOTSUPP) && (errno != ENOSYS)) {
+		Log("DvbFileWriter::preallocate: cannot allocate bytes") << size << currentFileName;
+	}
+#endif /* FALLOC_FL_KEEP_SIZE */
+
+	return false;
+}
+
+bool DvbFileWriter::write(const char *data, int size)
+{
+	if (file == NULL) {
+		return false;
+	}
+
+	if (currentBlock == NULL) {
+		currentBlock = thread->takeBlock(file, false);
+
+		if (currentBlock == NULL) {
+			overflowBytes += size;
+			return false;
+		}
+
+		currentBlockTimer.start();
+	}
+
+	int totalSize = size;
+
+	while (size > 0) {
+		DvbFileWriterBlock *nextBlock = NULL;
+
+		if ((currentBlock->size + size) >= DvbFileWriterThread::BlockSize) {
+			// avoid writing incomplete data if the next block isn't available
+			nextBlock = thread->takeBlock(file, false);
+
+			if (nextBlock == NULL) {
+				overflowBytes += size;
+				currentSize += (totalSize - size);
+				return false;
+			}
+		}
+
+		int bytes = qMin(size, DvbFileWriterThread::BlockSize - currentBlock->size);
+		memcpy(currentBlock->data + currentBlock->size, data, bytes);
+		currentBlock->size += bytes;
+		data += bytes;
+		size -= bytes;
+
+		if (nextBlock != NULL) {
+			thread->submitBlock(currentBlock);
+			currentBlock = nextBlock;
+			currentBlockTimer.start();
+		}
+	}
+
+	currentSize += totalSize;
+
+	// make sure that readers see the data within a reasonable time
+	if (currentBlockTimer.elapsed() >= 2000) {
+		flush();
+	}
+
+	return true;
+}
+
+void DvbFileWriter::flush()
+{
+	if ((currentBlock == NULL) || (currentBlock->size == 0)) {
+		return;
+	}
+
+	int size = currentBlock->size;
+
+	if (file->directIo) {
+		size &= ~(DvbFileWriterThread::Alignment - 1);
+
+		if (size == 0) {
+			return;
+		}
+	}
+
+	DvbFileWriterBlock *nextBlock = NULL;
+
+	if (size != currentBlock->size) {
+		// the unaligned tail goes into the next block
+		nextBlock = thread->takeBlock(file, false);
+
+		if (nextBlock == NULL) {
+			return;
+		}
+
+		nextBlock->size = (currentBlock->size - size);
+		memcpy(nextBlock->data, currentBlock->data + size, nextBlock->size);
+		currentBlock->size = size;
+	}
+
+	thread->submitBlock(currentBlock);
+	currentBlock = nextBlock;
+	currentBlockTimer.start();
+}
+
+void DvbFileWriter::close()
+{
+	if (file == NULL) {
+		return;
+	}
+
+	if (currentBlock == NULL) {
+		// a block without data is enough to close the file
+		currentBlock = new DvbFileWriterBlock();
+		currentBlock->file = file;
+	}
+
+	currentBlock->last = true;
+	thread->submitBlock(currentBlock);
+	currentBlock = NULL;
+
+	if (overflowBytes > 0) {
+		Log("DvbFileWriter::close: dropped bytes") << overflowBytes << currentFileName;
+	}
+
+	// the writer thread closes the file and deletes the structure
+	file = NULL;
+}
+
+qint64 DvbFileWriter::getCommittedSize() const
+{
+	if (file == NULL) {
+		// the remaining blocks are written before the file is closed
+		return currentSize;
+	}
+
+	QMutexLocker locker(&thread->mutex);
+	return file->committedSize;
+}
+
+int DvbFileWriter::getPendingBlocks() const
+{
+	if (file == NULL) {
+		return 0;
+	}
+
+	QMutexLocker locker(&thread->mutex);
+	return file->usedBlocks;
+}
+
+QVector<int> DvbFileWriter::getLatencyHistogram() const
+{
+	if (file == NULL) {
+		return QVector<int>();
+	}
+
+	QMutexLocker locker(&thread->mutex);
+	return file->latencyHistogram;
+}
@@ -0,0 +1,153 @@
+/*
+ * dvbfilewriter.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBFILEWRITER_H
+#define DVBFILEWRITER_H
+
+#include <QElapsedTimer>
+#include <QMutex>
+#include <QStringList>
+#include <QThread>
+#include <QVector>
+#include <QWaitCondition>
+
+class DvbFileWriterBlock;
+class DvbFileWriterFile;
+class DvbIoUring;
+
+/*
+ * the writer thread is shared by all file writers; the actual write calls happen in
+ * the thread, so that a slow disk doesn't stall the gui or the demux; if enabled and
+ * supported by the kernel, the blocks are submitted through io_uring, so that several
+ * writes (of different files) are in flight at the same time
+ */
+
+class DvbFileWriterThread : public QThread
+{
+public:
+	explicit DvbFileWriterThread(QObject *parent);
+	~DvbFileWriterThread(); // writes out pending blocks
+
+	enum {
+		BlockSize = (1 << 20),
+		Alignment = 4096, // suitable for O_DIRECT
+		LatencyBuckets = 16, // bucket i: [2^(i-1), 2^i) ms ; bucket 0: < 1 ms
+		RegisteredBlocks = 32 // io_uring fixed buffers
+	};
+
+	void setIoUringEnabled(bool enabled); // must be called before the thread is started
+	bool isIoUringActive() const; // false if io_uring isn't enabled or not available
+	QVector<int> getLatencyHistogram() const; // all files
+
+	static QString formatLatencyHistogram(const QVector<int> &histogram);
+
+private:
+	friend class DvbFileWriter;
+
+	DvbFileWriterBlock *takeBlock(DvbFileWriterFile *file, bool force);
+	void submitBlock(DvbFileWriterBlock *block);
+	void releaseBlock(DvbFileWriterBlock *block); // mutex must be held
+	void completeBlock(DvbFileWriterBlock *block); // mutex must be held
+	void customEvent(QEvent *event);
+	void run();
+	bool runIoUring(DvbIoUring &ring); // returns false if the writer has to fall back
+	void writeBlock(DvbFileWriterBlock *block);
+	void reportError(DvbFileWriterFile *file, int error);
+	void recordLatency(DvbFileWriterFile *file, qint64 latency);
+
+	mutable QMutex mutex;
+	QWaitCondition condition;
+	DvbFileWriterBlock *unusedBlocks;
+	int unusedBlockCount;
+	DvbFileWriterBlock *pendingBlocksHead;
+	DvbFileWriterBlock *pendingBlocksTail;
+	QStringList messages; // logged in the gui thread
+	QVector<int> latencyHistogram;
+	bool ioUringEnabled;
+	bool ioUringActive;
+	bool stopped;
+};
+
+class DvbFileWriter
+{
+public:
+	DvbFileWriter();
+	~DvbFileWriter(); // closes the file
+
+	/*
+	 * the file must not exist yet; maxBlocks limits the number of blocks which are
+	 * being filled or written (at least two, i.e. double buffering); if syncInterval
+	 * (seconds) is positive, the written data is regularly committed with fdatasync()
+	 */
+
+	bool open(DvbFileWriterThread *thread_, const QString &fileName_, bool directIo,
+		int maxBlocks = 2, int syncInterval = 0);
+	// appends to an existing file after the last complete packet (188 bytes) before
+	// 'maxSize' (if not negative); the rest of the file is truncated
+	bool reopen(DvbFileWriterThread *thread_, const QString &fileName_, qint64 maxSize,
+		int maxBlocks = 2, int syncInterval = 0);
+	// reserves 'size' bytes after the current end of the file (fallocate); returns false
+	// if the file system doesn't support it or if there isn't enough space
+	bool preallocate(qint64 size);
+	// never blocks; returns false if the data has been dropped (overflow)
+	bool write(const char *data, int size);
+	void flush(); // hands the partially filled block over to the writer thread
+	void close(); // asynchronous
+
+	bool isOpen() const
+	{
+		return (file != NULL);
+	}
+
+	QString fileName() const
+	{
+		return currentFileName;
+	}
+
+	qint64 getSize() const // including data which hasn't been written yet
+	{
+		return currentSize;
+	}
+
+	// the data up to this size can be read from the file (read-while-recording)
+	qint64 getCommittedSize() const;
+
+	qint64 getOverflowBytes() const
+	{
+		return overflowBytes;
+	}
+
+	int getPendingBlocks() const; // blocks which are being filled or written
+	QVector<int> getLatencyHistogram() const;
+
+private:
+	Q_DISABLE_COPY(DvbFileWriter)
+	void startFile(int fd, bool directIo, qint64 offset, int maxBlocks, int syncInterval);
+
+	DvbFileWriterThread *thread;
+	DvbFileWriterFile *file;
+	DvbFileWriterBlock *currentBlock;
+	QElapsedTimer currentBlockTimer;
+	QString currentFileName;
+	qint64 currentSize;
+	qint64 overflowBytes;
+};
+
+#endif /* DVBFILEWRITER_H */
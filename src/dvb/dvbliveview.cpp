@@ -22,6 +22,7 @@
 #include "dvbliveview_p.h"
 
 #include <QDir>
+#include <QFile>
 #include <QPainter>
 #include <QSet>
 #include <QSocketNotifier>
@@ -32,6 +33,7 @@
 #include <fcntl.h>
 #include <sys/stat.h> // bsd compatibility
 #include <sys/types.h> // bsd compatibility
+#include <sys/uio.h>
 #include <unistd.h>
 #include "../log.h"
 #include "dvbdevice.h"
@@ -43,6 +45,9 @@ void DvbOsd::init(OsdLevel level_, const QString &channelName_,
 	level = level_;
 	channelName = channelName_;
 
+	firstEntry = DvbEpgEntry();
+	secondEntry = DvbEpgEntry();
+
 	if (epgEntries.size() >= 1) {
 		firstEntry = *epgEntries.at(0);
 	}
@@ -146,6 +151,8 @@ DvbLiveView::DvbLiveView(DvbManager *manager_, QObject *parent) : QObject(parent
 		this, SLOT(pmtSectionChanged(QByteArray)));
 	connect(&patPmtTimer, SIGNAL(timeout()), this, SLOT(insertPatPmt()));
 	connect(&osdTimer, SIGNAL(timeout()), this, SLOT(osdTimeout()));
+	connect(manager->getEpgModel(), SIGNAL(currentNextChanged(DvbSharedChannel)),
+		this, SLOT(currentNextChanged(DvbSharedChannel)));
 
 	connect(internal, SIGNAL(currentAudioStreamChanged(int)),
 		this, SLOT(currentAudioStreamChanged(int)));
@@ -218,6 +225,10 @@ void DvbLiveView::playChannel(const DvbSharedChannel &channel_)
 	}
 
 	internal->channelName = channel->name;
+	internal->pmtPid = channel->pmtPid;
+	internal->setBufferPolicy(manager->getLiveViewBufferBlocks(),
+		(manager->getLiveViewDropPolicy() == DvbManager::DropNewestPackets) ?
+		DvbLiveViewInternal::DropNewest : DvbLiveViewInternal::DropOldest);
 	internal->resetPipe();
 	mediaWidget->play(internal);
 
@@ -231,8 +242,6 @@ void DvbLiveView::playChannel(const DvbSharedChannel &channel_)
 	subtitlePid = -1;
 	pmtSectionChanged(channel->pmtSectionData);
 	patPmtTimer.start(500);
-
-	internal->buffer.reserve(87 * 188);
 	QTimer::singleShot(2000, this, SLOT(showOsd()));
 }
 
@@ -346,8 +355,8 @@ void DvbLiveView::pmtSectionChanged(const QByteArray &pmtSectionData)
 
 void DvbLiveView::insertPatPmt()
 {
-	internal->buffer.append(internal->patGenerator.generatePackets());
-	internal->buffer.append(internal->pmtGenerator.generatePackets());
+	internal->writePackets(internal->patGenerator.generatePackets());
+	internal->writePackets(internal->pmtGenerator.generatePackets());
 }
 
 void DvbLiveView::deviceStateChanged()
@@ -407,6 +416,12 @@ void DvbLiveView::playbackStatusChanged(MediaWidget::PlaybackStatus playbackStat
 			device = NULL;
 		}
 
+		if (internal->getDroppedBytes() > 0) {
+			Log("DvbLiveView::playbackStatusChanged: dropped bytes") <<
+				internal->getDroppedBytes() << QLatin1String("max queue depth") <<
+				internal->getMaxQueueDepth();
+		}
+
 		channel = DvbSharedChannel();
 		pids.clear();
 		patPmtTimer.stop();
@@ -415,8 +430,9 @@ void DvbLiveView::playbackStatusChanged(MediaWidget::PlaybackStatus playbackStat
 		internal->pmtSectionData.clear();
 		internal->patGenerator = DvbSectionGenerator();
 		internal->pmtGenerator = DvbSectionGenerator();
-		internal->buffer.clear();
+		internal->clearBuffers();
 		internal->timeShiftFile.close();
+		internal->timeShiftIndex.reset();
 		internal->dvbOsd.init(DvbOsd::Off, QString(), QList<DvbSharedEpgEntry>());
 		osdWidget->hideObject();
 		break;
@@ -432,20 +448,17 @@ void DvbLiveView::playbackStatusChanged(MediaWidget::PlaybackStatus playbackStat
 			break;
 		}
 
-		internal->timeShiftFile.setFileName(manager->getTimeShiftFolder() + QLatin1String("/TimeShift-") +
-			QDateTime::currentDateTime().toString(QLatin1String("yyyyMMddThhmmss")) +
-			QLatin1String(".m2t"));
-
-		if (internal->timeShiftFile.exists() ||
-		    !internal->timeShiftFile.open(QIODevice::WriteOnly)) {
+		if (!internal->timeShiftFile.open(manager->getFileWriterThread(),
+		    manager->getTimeShiftFolder() + QLatin1String("/TimeShift-") +
+		    QDateTime::currentDateTime().toString(QLatin1String("yyyyMMddThhmmss")) +
+		    QLatin1String(".m2t"), manager->getTimeShiftDirectIo())) {
 			Log("DvbLiveView::playbackStatusChanged: cannot open file") <<
 				internal->timeShiftFile.fileName();
-			internal->timeShiftFile.setFileName(QDir::homePath() + QLatin1String("/TimeShift-") +
-				QDateTime::currentDateTime().toString(QLatin1String("yyyyMMddThhmmss")) +
-				QLatin1String(".m2t"));
 
-			if (internal->timeShiftFile.exists() ||
-			    !internal->timeShiftFile.open(QIODevice::WriteOnly)) {
+			if (!internal->timeShiftFile.open(manager->getFileWriterThread(),
+			    QDir::homePath() + QLatin1String("/TimeShift-") +
+			    QDateTime::currentDateTime().toString(QLatin1String("yyyyMMddThhmmss")) +
+			    QLatin1String(".m2t"), manager->getTimeShiftDirectIo())) {
 				Log("DvbLiveView::playbackStatusChanged: cannot open file") <<
 					internal->timeShiftFile.fileName();
 				mediaWidget->stop();
@@ -453,6 +466,8 @@ void DvbLiveView::playbackStatusChanged(MediaWidget::PlaybackStatus playbackStat
 			}
 		}
 
+		internal->timeShiftIndex.reset();
+		internal->timeShiftIndex.setPids(DvbPmtParser(DvbPmtSection(internal->pmtSectionData)));
 		updatePids();
 
 		// don't allow changes after starting time shift
@@ -479,6 +494,17 @@ void DvbLiveView::osdTimeout()
 	osdTimer.stop();
 }
 
+void DvbLiveView::currentNextChanged(const DvbSharedChannel &channel_)
+{
+	// the long osd stays visible until it's toggled
+	if ((channel_ == channel) && (internal->dvbOsd.level == DvbOsd::LongOsd)) {
+		internal->dvbOsd.init(DvbOsd::LongOsd,
+			QString(QLatin1String("%1 - %2")).arg(channel->number).arg(channel->name),
+			manager->getEpgModel()->getCurrentNext(channel));
+		osdWidget->showObject(&internal->dvbOsd, -1);
+	}
+}
+
 void DvbLiveView::startDevice()
 {
 	foreach (int pid, pids) {
@@ -571,7 +597,10 @@ void DvbLiveView::updatePids(bool forcePatPmtUpdate)
 }
 
 DvbLiveViewInternal::DvbLiveViewInternal(QObject *parent) : QObject(parent), mediaWidget(NULL),
-	readFd(-1), writeFd(-1)
+	pmtPid(-1), readFd(-1), writeFd(-1), notifier(NULL), currentBlock(NULL),
+	unusedBlocksHead(NULL), usedBlocksHead(NULL), usedBlocksTail(NULL), usedBlocksHeadOffset(0),
+	blockCount(0), maxBlocks(64), dropPolicy(DropOldest), droppedBytes(0), queueDepth(0),
+	maxQueueDepth(0)
 {
 	QString fileName = KStandardDirs::locateLocal("appdata", QLatin1String("dvbpipe.m2t"));
 	QFile::remove(fileName);
@@ -603,6 +632,14 @@ DvbLiveViewInternal::DvbLiveViewInternal(QObject *parent) : QObject(parent), med
 
 DvbLiveViewInternal::~DvbLiveViewInternal()
 {
+	clearBuffers();
+
+	for (DvbLiveViewBlock *block = unusedBlocksHead; block != NULL;) {
+		DvbLiveViewBlock *nextBlock = block->next;
+		delete block;
+		block = nextBlock;
+	}
+
 	if (writeFd >= 0) {
 		close(writeFd);
 	}
@@ -612,69 +649,274 @@ DvbLiveViewInternal::~DvbLiveViewInternal()
 	}
 }
 
+void DvbLiveViewInternal::setBufferPolicy(int maxBlocks_, DropPolicy dropPolicy_)
+{
+	// at least two blocks are needed (one being filled, one being written)
+	maxBlocks = qMax(maxBlocks_, 2);
+	dropPolicy = dropPolicy_;
+}
+
 void DvbLiveViewInternal::resetPipe()
 {
-	if (!buffers.isEmpty()) {
-		buffer = buffers.at(0);
-		buffers.clear();
-	}
+	clearBuffers();
+	droppedBytes = 0;
+	maxQueueDepth = 0;
 
 	if (readFd >= 0) {
-		if (buffer.isEmpty()) {
-			buffer.resize(87 * 188);
-		}
+		char data[87 * 188];
 
-		while (read(readFd, buffer.data(), buffer.size()) > 0) {
+		while (read(readFd, data, sizeof(data)) > 0) {
 		}
 	}
+}
+
+void DvbLiveViewInternal::clearBuffers()
+{
+	if (currentBlock != NULL) {
+		releaseBlock(currentBlock);
+		currentBlock = NULL;
+	}
+
+	while (usedBlocksHead != NULL) {
+		DvbLiveViewBlock *block = usedBlocksHead;
+		usedBlocksHead = block->next;
+		releaseBlock(block);
+	}
+
+	usedBlocksTail = NULL;
+	usedBlocksHeadOffset = 0;
+	queueDepth = 0;
+
+	if (notifier != NULL) {
+		notifier->setEnabled(false);
+	}
+}
 
-	buffer.clear();
+void DvbLiveViewInternal::writePackets(const QByteArray &packets)
+{
+	for (int i = 0; (i + 188) <= packets.size(); i += 188) {
+		processData(packets.constData() + i);
+	}
+}
+
+bool DvbLiveViewInternal::getKeyFramePosition(int time, float &position) const
+{
+	DvbTsIndexEntry entry;
+
+	if (!timeShiftFile.isOpen() || !timeShiftIndex.findKeyFrame(time, entry)) {
+		return false;
+	}
+
+	// the player only sees the data which has been written
+	qint64 committedSize = timeShiftFile.getCommittedSize();
+
+	if (entry.offset >= committedSize) {
+		return false;
+	}
+
+	position = float(double(entry.offset) / committedSize);
+	return true;
 }
 
 void DvbLiveViewInternal::writeToPipe()
 {
-	while (!buffers.isEmpty()) {
-		const QByteArray &currentBuffer = buffers.at(0);
-		int bytesWritten = int(write(writeFd, currentBuffer.constData(), currentBuffer.size()));
+	while (usedBlocksHead != NULL) {
+		struct iovec iovecs[16];
+		int iovecCount = 0;
+		int size = 0;
+
+		for (DvbLiveViewBlock *block = usedBlocksHead; (block != NULL) && (iovecCount < 16);
+		     block = block->next) {
+			int offset = ((iovecCount == 0) ? usedBlocksHeadOffset : 0);
+			iovecs[iovecCount].iov_base = (block->data + offset);
+			iovecs[iovecCount].iov_len = size_t(block->size - offset);
+			size += (block->size - offset);
+			++iovecCount;
+		}
 
-		if ((bytesWritten < 0) && (errno == EINTR)) {
-			continue;
+		int bytesWritten = int(writev(writeFd, iovecs, iovecCount));
+
+		if (bytesWritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			break;
 		}
 
-		if (bytesWritten == currentBuffer.size()) {
-			buffers.removeFirst();
-			continue;
+		int remainingBytes = bytesWritten;
+
+		while (remainingBytes > 0) {
+			int blockBytes = (usedBlocksHead->size - usedBlocksHeadOffset);
+
+			if (remainingBytes < blockBytes) {
+				usedBlocksHeadOffset += remainingBytes;
+				break;
+			}
+
+			remainingBytes -= blockBytes;
+			DvbLiveViewBlock *block = usedBlocksHead;
+			usedBlocksHead = block->next;
+			usedBlocksHeadOffset = 0;
+			--queueDepth;
+			releaseBlock(block);
 		}
 
-		if (bytesWritten > 0) {
-			buffers.first().remove(0, bytesWritten);
+		if (usedBlocksHead == NULL) {
+			usedBlocksTail = NULL;
 		}
 
-		break;
+		if (bytesWritten != size) {
+			break;
+		}
 	}
 
-	if (!buffers.isEmpty()) {
-		notifier->setEnabled(true);
-	}
+	notifier->setEnabled(usedBlocksHead != NULL);
 }
 
 void DvbLiveViewInternal::processData(const char data[188])
 {
-	buffer.append(data, 188);
+	if (currentBlock == NULL) {
+		currentBlock = takeBlock(isPsiPacket(data));
+
+		if (currentBlock == NULL) {
+			droppedBytes += 188;
+			return;
+		}
+	}
 
-	if (buffer.size() < (87 * 188)) {
+	memcpy(currentBlock->data + currentBlock->size, data, 188);
+	currentBlock->size += 188;
+
+	if (currentBlock->size < int(sizeof(currentBlock->data))) {
 		return;
 	}
 
-	if (!timeShiftFile.isOpen()) {
-		if (writeFd >= 0) {
-			buffers.append(buffer);
-			writeToPipe();
+	DvbLiveViewBlock *block = currentBlock;
+	currentBlock = NULL;
+	queueBlock(block);
+}
+
+bool DvbLiveViewInternal::isPsiPacket(const char *packet) const
+{
+	int pid = ((static_cast<unsigned char>(packet[1]) << 8) |
+		static_cast<unsigned char>(packet[2])) & ((1 << 13) - 1);
+	return ((pid == 0x00) || (pid == pmtPid));
+}
+
+DvbLiveViewBlock *DvbLiveViewInternal::takeBlock(bool force)
+{
+	if (unusedBlocksHead != NULL) {
+		DvbLiveViewBlock *block = unusedBlocksHead;
+		unusedBlocksHead = block->next;
+		block->size = 0;
+		block->next = NULL;
+		return block;
+	}
+
+	if (blockCount < maxBlocks) {
+		++blockCount;
+		return new DvbLiveViewBlock();
+	}
+
+	if ((dropPolicy == DropNewest) && !force) {
+		return NULL;
+	}
+
+	return reclaimBlock();
+}
+
+DvbLiveViewBlock *DvbLiveViewInternal::reclaimBlock()
+{
+	// the queue is full: drop the oldest packets which aren't pat / pmt packets
+	// the head block is skipped if it is partially written
+
+	DvbLiveViewBlock *previousBlock = NULL;
+	DvbLiveViewBlock *block = usedBlocksHead;
+
+	if ((block != NULL) && (usedBlocksHeadOffset != 0)) {
+		previousBlock = block;
+		block = block->next;
+	}
+
+	for (; block != NULL; previousBlock = block, block = block->next) {
+		int size = 0;
+
+		for (int i = 0; i < block->size; i += 188) {
+			if (isPsiPacket(block->data + i)) {
+				if (size != i) {
+					memcpy(block->data + size, block->data + i, 188);
+				}
+
+				size += 188;
+			}
+		}
+
+		if (size == int(sizeof(block->data))) {
+			continue;
+		}
+
+		droppedBytes += (block->size - size);
+
+		if (previousBlock != NULL) {
+			previousBlock->next = block->next;
+		} else {
+			usedBlocksHead = block->next;
+		}
+
+		if (usedBlocksTail == block) {
+			usedBlocksTail = previousBlock;
+		}
+
+		--queueDepth;
+
+		// the remaining psi packets are written again as part of the new block
+		block->size = size;
+		block->next = NULL;
+		return block;
+	}
+
+	return NULL;
+}
+
+void DvbLiveViewInternal::releaseBlock(DvbLiveViewBlock *block)
+{
+	block->size = 0;
+	block->next = unusedBlocksHead;
+	unusedBlocksHead = block;
+}
+
+void DvbLiveViewInternal::queueBlock(DvbLiveViewBlock *block)
+{
+	if (timeShiftFile.isOpen()) {
+		if (timeShiftFile.write(block->data, block->size)) {
+			timeShiftIndex.addPackets(block->data, block->size);
 		}
+
+		releaseBlock(block);
+		return;
+	}
+
+	if (writeFd < 0) {
+		releaseBlock(block);
+		return;
+	}
+
+	block->next = NULL;
+
+	if (usedBlocksTail != NULL) {
+		usedBlocksTail->next = block;
 	} else {
-		timeShiftFile.write(buffer); // FIXME avoid buffer reallocation
+		usedBlocksHead = block;
 	}
 
-	buffer.clear();
-	buffer.reserve(87 * 188);
+	usedBlocksTail = block;
+
+	if (++queueDepth > maxQueueDepth) {
+		maxQueueDepth = queueDepth;
+	}
+
+	if (!notifier->isEnabled()) {
+		writeToPipe();
+	}
 }
@@ -54,6 +54,7 @@ private slots:
 	void deviceStateChanged();
 	void showOsd();
 	void osdTimeout();
+	void currentNextChanged(const DvbSharedChannel &channel_);
 
 	void currentAudioStreamChanged(int currentAudioStream);
 	void currentSubtitleChanged(int currentSubtitle);
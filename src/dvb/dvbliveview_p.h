@@ -21,14 +21,26 @@
 #ifndef DVBLIVEVIEW_P_H
 #define DVBLIVEVIEW_P_H
 
-#include <QFile>
 #include "../mediawidget.h"
 #include "../osdwidget.h"
 #include "dvbepg.h"
+#include "dvbfilewriter.h"
 #include "dvbsi.h"
+#include "dvbtsindex.h"
 
 class QSocketNotifier;
 
+class DvbLiveViewBlock
+{
+public:
+	DvbLiveViewBlock() : size(0), next(NULL) { }
+	~DvbLiveViewBlock() { }
+
+	char data[87 * 188];
+	int size;
+	DvbLiveViewBlock *next;
+};
+
 class DvbOsd : public OsdObject
 {
 public:
@@ -58,19 +70,43 @@ class DvbLiveViewInternal : public QObject, public DvbPidFilter, public MediaSou
 {
 	Q_OBJECT
 public:
+	enum DropPolicy {
+		DropOldest, // drops queued packets first (psi packets are kept)
+		DropNewest // drops incoming packets first (psi packets are kept)
+	};
+
 	explicit DvbLiveViewInternal(QObject *parent);
 	~DvbLiveViewInternal();
 
+	void setBufferPolicy(int maxBlocks_, DropPolicy dropPolicy_);
 	void resetPipe();
+	void clearBuffers();
+	void writePackets(const QByteArray &packets); // size must be a multiple of 188
+
+	qint64 getDroppedBytes() const
+	{
+		return droppedBytes;
+	}
+
+	int getQueueDepth() const // blocks
+	{
+		return queueDepth;
+	}
+
+	int getMaxQueueDepth() const // blocks
+	{
+		return maxQueueDepth;
+	}
 
 	MediaWidget *mediaWidget;
 	QString channelName;
+	int pmtPid;
 	DvbPmtFilter pmtFilter;
 	QByteArray pmtSectionData;
 	DvbSectionGenerator patGenerator;
 	DvbSectionGenerator pmtGenerator;
-	QByteArray buffer;
-	QFile timeShiftFile;
+	DvbFileWriter timeShiftFile;
+	DvbTsIndex timeShiftIndex;
 	DvbOsd dvbOsd;
 
 	bool overrideAudioStreams() const { return !audioStreams.isEmpty(); }
@@ -102,6 +138,8 @@ public:
 
 	bool hideCurrentTotalTime() const { return !timeshift; }
 
+	bool getKeyFramePosition(int time, float &position) const;
+
 	bool timeshift;
 	QStringList audioStreams;
 	QStringList subtitles;
@@ -122,12 +160,29 @@ private slots:
 
 private:
 	void processData(const char data[188]);
+	bool isPsiPacket(const char *packet) const;
+	DvbLiveViewBlock *takeBlock(bool force);
+	DvbLiveViewBlock *reclaimBlock();
+	void releaseBlock(DvbLiveViewBlock *block);
+	void queueBlock(DvbLiveViewBlock *block);
 
 	KUrl url;
 	int readFd;
 	int writeFd;
 	QSocketNotifier *notifier;
-	QList<QByteArray> buffers;
+
+	// fixed pool of blocks; used blocks are queued until they are written to the pipe
+	DvbLiveViewBlock *currentBlock;
+	DvbLiveViewBlock *unusedBlocksHead;
+	DvbLiveViewBlock *usedBlocksHead;
+	DvbLiveViewBlock *usedBlocksTail;
+	int usedBlocksHeadOffset; // bytes of the head block already written
+	int blockCount;
+	int maxBlocks;
+	DropPolicy dropPolicy;
+	qint64 droppedBytes;
+	int queueDepth;
+	int maxQueueDepth;
 };
 
 #endif /* DVBLIVEVIEW_P_H */
@@ -32,16 +32,28 @@
 #include "dvbdevice.h"
 #include "dvbdevice_linux.h"
 #include "dvbepg.h"
+#include "dvbepgharvester.h"
+#include "dvbfilewriter.h"
 #include "dvbliveview.h"
+#include "dvbrecordingscanner.h"
 #include "dvbsi.h"
+#include "dvbxmltvimporter.h"
 
 DvbManager::DvbManager(MediaWidget *mediaWidget_, QWidget *parent_) : QObject(parent_),
 	parent(parent_), mediaWidget(mediaWidget_), channelView(NULL), dvbDumpEnabled(false)
 {
+	// the writer thread has to outlive the file writers of the other children
+	fileWriterThread = new DvbFileWriterThread(NULL);
+	fileWriterThread->setIoUringEnabled(getFileWriterIoUring());
 	channelModel = DvbChannelModel::createSqlModel(this);
+	// the recording model hands over the finished recordings (even while constructing)
+	recordingScanner = new DvbRecordingScanner(this);
 	recordingModel = new DvbRecordingModel(this, this);
 	epgModel = new DvbEpgModel(this, this);
+	epgHarvester = new DvbEpgHarvester(this, this);
+	xmltvImporter = new DvbXmltvImporter(this, this);
 	liveView = new DvbLiveView(this, this);
+	fileWriterThread->setParent(this); // children are deleted in the order they were added
 
 	readDeviceConfigs();
 	updateSourceMapping();
@@ -49,6 +61,7 @@ DvbManager::DvbManager(MediaWidget *mediaWidget_, QWidget *parent_) : QObject(pa
 	loadDeviceManager();
 
 	DvbSiText::setOverride6937(override6937Charset());
+	epgHarvester->setEnabled(getEpgHarvesting());
 }
 
 DvbManager::~DvbManager()
@@ -57,6 +70,8 @@ DvbManager::~DvbManager()
 
 	// we need an explicit deletion order (device users ; devices ; device manager)
 
+	delete xmltvImporter;
+	delete epgHarvester;
 	delete epgModel;
 	delete recordingModel;
 
@@ -66,11 +81,22 @@ DvbManager::~DvbManager()
 }
 
 DvbDevice *DvbManager::requestDevice(const QString &source, const DvbTransponder &transponder,
-	DvbManager::RequestType requestType)
+	DvbManager::RequestType requestType, DvbDevice *preferredDevice)
 {
 	Q_ASSERT(requestType != Exclusive);
 	// FIXME call DvbEpgModel::startEventFilter / DvbEpgModel::stopEventFilter here?
 
+	// a free device is searched in this order (the preferred device comes first)
+	QList<int> indexes;
+
+	for (int i = 0; i < deviceConfigs.size(); ++i) {
+		if ((preferredDevice != NULL) && (deviceConfigs.at(i).device == preferredDevice)) {
+			indexes.prepend(i);
+		} else {
+			indexes.append(i);
+		}
+	}
+
 	for (int i = 0; i < deviceConfigs.size(); ++i) {
 		const DvbDeviceConfig &it = deviceConfigs.at(i);
 
@@ -83,13 +109,15 @@ DvbDevice *DvbManager::requestDevice(const QString &source, const DvbTransponder
 
 			if (requestType == Prioritized) {
 				++deviceConfigs[i].prioritizedUseCount;
+			} else if (requestType == Background) {
+				++deviceConfigs[i].backgroundUseCount;
 			}
 
 			return it.device;
 		}
 	}
 
-	for (int i = 0; i < deviceConfigs.size(); ++i) {
+	foreach (int i, indexes) {
 		const DvbDeviceConfig &it = deviceConfigs.at(i);
 
 		if ((it.device == NULL) || (it.useCount != 0)) {
@@ -108,6 +136,8 @@ DvbDevice *DvbManager::requestDevice(const QString &source, const DvbTransponder
 
 				if (requestType == Prioritized) {
 					deviceConfigs[i].prioritizedUseCount = 1;
+				} else if (requestType == Background) {
+					deviceConfigs[i].backgroundUseCount = 1;
 				}
 
 				deviceConfigs[i].source = source;
@@ -118,11 +148,42 @@ DvbDevice *DvbManager::requestDevice(const QString &source, const DvbTransponder
 		}
 	}
 
+	if (requestType == Background) {
+		return NULL;
+	}
+
+	// devices which are only used in the background are taken away
+
+	foreach (int i, indexes) {
+		const DvbDeviceConfig &it = deviceConfigs.at(i);
+
+		if ((it.device == NULL) || (it.useCount <= 0) ||
+		    (it.useCount != it.backgroundUseCount)) {
+			continue;
+		}
+
+		foreach (const DvbConfig &config, it.configs) {
+			if (config->name == source) {
+				deviceConfigs[i].useCount = 1;
+				deviceConfigs[i].prioritizedUseCount =
+					((requestType == Prioritized) ? 1 : 0);
+				deviceConfigs[i].backgroundUseCount = 0;
+				deviceConfigs[i].source = source;
+				deviceConfigs[i].transponder = transponder;
+
+				DvbDevice *device = it.device;
+				device->reacquire(config.constData());
+				device->tune(transponder);
+				return device;
+			}
+		}
+	}
+
 	if (requestType != Prioritized) {
 		return NULL;
 	}
 
-	for (int i = 0; i < deviceConfigs.size(); ++i) {
+	foreach (int i, indexes) {
 		const DvbDeviceConfig &it = deviceConfigs.at(i);
 
 		if ((it.device == NULL) || (it.useCount == 0) || (it.prioritizedUseCount != 0)) {
@@ -133,6 +194,7 @@ DvbDevice *DvbManager::requestDevice(const QString &source, const DvbTransponder
 			if (config->name == source) {
 				deviceConfigs[i].useCount = 1;
 				deviceConfigs[i].prioritizedUseCount = 1;
+				deviceConfigs[i].backgroundUseCount = 0;
 				deviceConfigs[i].source = source;
 				deviceConfigs[i].transponder = transponder;
 
@@ -171,6 +233,27 @@ DvbDevice *DvbManager::requestExclusiveDevice(const QString &source)
 		}
 	}
 
+	for (int i = 0; i < deviceConfigs.size(); ++i) {
+		const DvbDeviceConfig &it = deviceConfigs.at(i);
+
+		if ((it.device == NULL) || (it.useCount <= 0) ||
+		    (it.useCount != it.backgroundUseCount)) {
+			continue;
+		}
+
+		foreach (const DvbConfig &config, it.configs) {
+			if (config->name == source) {
+				deviceConfigs[i].useCount = -1;
+				deviceConfigs[i].backgroundUseCount = 0;
+				deviceConfigs[i].source.clear();
+
+				DvbDevice *device = it.device;
+				device->reacquire(config.constData());
+				return device;
+			}
+		}
+	}
+
 	return NULL;
 }
 
@@ -180,15 +263,21 @@ void DvbManager::releaseDevice(DvbDevice *device, RequestType requestType)
 		const DvbDeviceConfig &it = deviceConfigs.at(i);
 
 		if (it.device == device) {
+			if (requestType == Background) {
+				--deviceConfigs[i].backgroundUseCount;
+				Q_ASSERT(it.backgroundUseCount >= 0);
+			}
+
 			switch (requestType) {
 			case Prioritized:
 				--deviceConfigs[i].prioritizedUseCount;
 				Q_ASSERT(it.prioritizedUseCount >= 0);
 			// fall through
 			case Shared:
+			case Background:
 				--deviceConfigs[i].useCount;
 				Q_ASSERT(it.useCount >= 0);
-				Q_ASSERT(it.useCount >= it.prioritizedUseCount);
+				Q_ASSERT(it.useCount >= (it.prioritizedUseCount + it.backgroundUseCount));
 
 				if (it.useCount == 0) {
 					it.device->release();
@@ -337,6 +426,76 @@ QString DvbManager::getTimeShiftFolder() const
 	return KGlobal::config()->group("DVB").readEntry("TimeShiftFolder", QDir::homePath());
 }
 
+bool DvbManager::getTimeShiftDirectIo() const
+{
+	return KGlobal::config()->group("DVB").readEntry("TimeShiftDirectIo", false);
+}
+
+int DvbManager::getRecordingBufferBlocks() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingBufferBlocks", 8);
+}
+
+int DvbManager::getRecordingSyncInterval() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingSyncInterval", 10);
+}
+
+bool DvbManager::getFileWriterIoUring() const
+{
+	return KGlobal::config()->group("DVB").readEntry("FileWriterIoUring", false);
+}
+
+bool DvbManager::getRecordingCompactMode() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingCompactMode", false);
+}
+
+bool DvbManager::getRecordingCompactKeepTeletext() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingCompactKeepTeletext", true);
+}
+
+bool DvbManager::getRecordingCompactKeepSubtitles() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingCompactKeepSubtitles", true);
+}
+
+QString DvbManager::getRecordingAlternativeFolder() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingAlternativeFolder", QString());
+}
+
+int DvbManager::getRecordingMaxBandwidth() const
+{
+	return KGlobal::config()->group("DVB").readEntry("RecordingMaxBandwidth", 0);
+}
+
+int DvbManager::getChannelBitRate(const QString &channelName) const
+{
+	int bitRate = KGlobal::config()->group("RecordingBitRates").readEntry(channelName, 0);
+
+	if (bitRate <= 0) {
+		// nothing learned yet; a typical hd service
+		bitRate = KGlobal::config()->group("DVB").readEntry("RecordingDefaultBitRate", 12000);
+	}
+
+	return bitRate;
+}
+
+void DvbManager::updateChannelBitRate(const QString &channelName, int bitRate)
+{
+	KConfigGroup group = KGlobal::config()->group("RecordingBitRates");
+	int oldBitRate = group.readEntry(channelName, 0);
+
+	if (oldBitRate > 0) {
+		// the bit rate of a service varies with the programme; smooth the estimate
+		bitRate = ((3 * oldBitRate + bitRate) / 4);
+	}
+
+	group.writeEntry(channelName, bitRate);
+}
+
 int DvbManager::getBeginMargin() const
 {
 	return KGlobal::config()->group("DVB").readEntry("BeginMargin", 300);
@@ -352,6 +511,33 @@ bool DvbManager::override6937Charset() const
 	return KGlobal::config()->group("DVB").readEntry("Override6937", false);
 }
 
+bool DvbManager::getEpgHarvesting() const
+{
+	return KGlobal::config()->group("DVB").readEntry("EpgHarvesting", true);
+}
+
+int DvbManager::getLiveViewBufferBlocks() const
+{
+	return KGlobal::config()->group("DVB").readEntry("LiveViewBufferBlocks", 64);
+}
+
+DvbManager::LiveViewDropPolicy DvbManager::getLiveViewDropPolicy() const
+{
+	int dropPolicy = KGlobal::config()->group("DVB").readEntry("LiveViewDropPolicy", 0);
+
+	if (dropPolicy == DropNewestPackets) {
+		return DropNewestPackets;
+	}
+
+	return DropOldestPackets;
+}
+
+QMap<QString, QString> DvbManager::getXmltvChannelIds() const
+{
+	// channels which aren't listed are matched by their display names
+	return KGlobal::config()->group("XmltvChannelIds").entryMap();
+}
+
 void DvbManager::setRecordingFolder(const QString &path)
 {
 	KGlobal::config()->group("DVB").writeEntry("RecordingFolder", path);
@@ -372,6 +558,12 @@ void DvbManager::setEndMargin(int endMargin)
 	KGlobal::config()->group("DVB").writeEntry("EndMargin", endMargin);
 }
 
+void DvbManager::setEpgHarvesting(bool enabled)
+{
+	KGlobal::config()->group("DVB").writeEntry("EpgHarvesting", enabled);
+	epgHarvester->setEnabled(enabled);
+}
+
 void DvbManager::setOverride6937Charset(bool override)
 {
 	KGlobal::config()->group("DVB").writeEntry("Override6937", override);
@@ -453,6 +645,7 @@ void DvbManager::deviceRemoved(DvbBackendDevice *backendDevice)
 			if (it.useCount != 0) {
 				it.useCount = 0;
 				it.prioritizedUseCount = 0;
+				it.backgroundUseCount = 0;
 				it.device->release();
 			}
 
@@ -792,7 +985,7 @@ bool DvbManager::readScanSources(DvbScanData &data, const char *tag, Transmissio
 
 DvbDeviceConfig::DvbDeviceConfig(const QString &deviceId_, const QString &frontendName_,
 	DvbDevice *device_) : deviceId(deviceId_), frontendName(frontendName_), device(device_),
-	useCount(0), prioritizedUseCount(0)
+	useCount(0), prioritizedUseCount(0), backgroundUseCount(0)
 {
 }
 
@@ -34,10 +34,14 @@ class DvbConfig;
 class DvbDevice;
 class DvbDeviceConfig;
 class DvbDeviceConfigUpdate;
+class DvbEpgHarvester;
 class DvbEpgModel;
 class DvbLiveView;
 class DvbRecordingModel;
+class DvbRecordingScanner;
+class DvbFileWriterThread;
 class DvbScanData;
+class DvbXmltvImporter;
 class MediaWidget;
 
 class DvbManager : public QObject
@@ -47,7 +51,10 @@ public:
 	enum RequestType {
 		Shared,
 		Exclusive, // you can freely tune() and stop(), because the device isn't shared
-		Prioritized // takes precedence over 'Shared' and 'Exclusive'
+		Prioritized, // takes precedence over 'Shared' and 'Exclusive'
+		// only uses free devices and is taken away by every other request (the device is
+		// released without notice besides DvbDevice::stateChanged())
+		Background
 	};
 
 	enum TransmissionType {
@@ -58,6 +65,11 @@ public:
 		Atsc
 	};
 
+	enum LiveViewDropPolicy {
+		DropOldestPackets, // keeps the live view close to real time
+		DropNewestPackets // keeps the already queued data contiguous
+	};
+
 	DvbManager(MediaWidget *mediaWidget_, QWidget *parent_);
 	~DvbManager();
 
@@ -101,13 +113,28 @@ public:
 		return recordingModel;
 	}
 
+	DvbRecordingScanner *getRecordingScanner() const
+	{
+		return recordingScanner;
+	}
+
+	DvbFileWriterThread *getFileWriterThread() const
+	{
+		return fileWriterThread;
+	}
+
+	DvbXmltvImporter *getXmltvImporter() const
+	{
+		return xmltvImporter;
+	}
+
 	void setChannelView(QTreeView *channelView_)
 	{
 		channelView = channelView_;
 	}
 
 	DvbDevice *requestDevice(const QString &source, const DvbTransponder &transponder,
-		RequestType requestType);
+		RequestType requestType, DvbDevice *preferredDevice = NULL);
 	DvbDevice *requestExclusiveDevice(const QString &source);
 	void releaseDevice(DvbDevice *device, RequestType requestType);
 
@@ -122,14 +149,32 @@ public:
 
 	QString getRecordingFolder() const;
 	QString getTimeShiftFolder() const;
+	bool getTimeShiftDirectIo() const;
+	int getRecordingBufferBlocks() const; // blocks of 1 MiB
+	int getRecordingSyncInterval() const; // seconds (0 = never)
+	bool getFileWriterIoUring() const; // falls back to write() if not available
+	// only the elementary streams, the pcr and the regenerated pat / pmt are recorded
+	bool getRecordingCompactMode() const;
+	bool getRecordingCompactKeepTeletext() const;
+	bool getRecordingCompactKeepSubtitles() const;
+	// used if the recording folder doesn't have enough space or write bandwidth
+	QString getRecordingAlternativeFolder() const;
+	int getRecordingMaxBandwidth() const; // Mbit/s of all recordings of a disk (0 = unlimited)
+	int getChannelBitRate(const QString &channelName) const; // kbit/s (estimated)
+	void updateChannelBitRate(const QString &channelName, int bitRate); // measured
 	int getBeginMargin() const; // seconds
 	int getEndMargin() const; // seconds
 	bool override6937Charset() const;
+	bool getEpgHarvesting() const; // collects the epg of all transponders with idle devices
+	int getLiveViewBufferBlocks() const; // blocks of 87 packets
+	LiveViewDropPolicy getLiveViewDropPolicy() const;
+	QMap<QString, QString> getXmltvChannelIds() const; // xmltv id -> channel name
 	void setRecordingFolder(const QString &path);
 	void setTimeShiftFolder(const QString &path);
 	void setBeginMargin(int beginMargin); // seconds
 	void setEndMargin(int endMargin); // seconds
 	void setOverride6937Charset(bool override);
+	void setEpgHarvesting(bool enabled);
 
 	static double getLatitude();
 	static double getLongitude();
@@ -159,8 +204,12 @@ private:
 	DvbChannelModel *channelModel;
 	QTreeView *channelView;
 	DvbEpgModel *epgModel;
+	DvbEpgHarvester *epgHarvester;
 	DvbLiveView *liveView;
 	DvbRecordingModel *recordingModel;
+	DvbRecordingScanner *recordingScanner;
+	DvbFileWriterThread *fileWriterThread;
+	DvbXmltvImporter *xmltvImporter;
 
 	QList<DvbDeviceConfig> deviceConfigs;
 	bool dvbDumpEnabled;
@@ -185,6 +234,7 @@ public:
 	QList<DvbConfig> configs;
 	int useCount; // -1 means exclusive use
 	int prioritizedUseCount;
+	int backgroundUseCount;
 	QString source;
 	DvbTransponder transponder;
 };
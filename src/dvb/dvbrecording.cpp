@@ -21,14 +21,25 @@
 #include "dvbrecording.h"
 #include "dvbrecording_p.h"
 
+#include <QDataStream>
 #include <QDir>
+#include <QFile>
 #include <QSet>
+#include <QSocketNotifier>
 #include <QVariant>
 #include <KStandardDirs>
+#include <errno.h>
+#include <fcntl.h>
+#include <sys/stat.h> // bsd compatibility
+#include <sys/statvfs.h>
+#include <sys/types.h> // bsd compatibility
+#include <unistd.h>
 #include "../ensurenopendingoperation.h"
 #include "../log.h"
+#include "dvbconfig.h"
 #include "dvbdevice.h"
 #include "dvbmanager.h"
+#include "dvbrecordingscanner.h"
 
 bool DvbRecording::validate()
 {
@@ -45,16 +56,26 @@ bool DvbRecording::validate()
 }
 
 DvbRecordingModel::DvbRecordingModel(DvbManager *manager_, QObject *parent) : QObject(parent),
-	manager(manager_), hasPendingOperation(false)
+	manager(manager_), tailSource(NULL), hasPendingOperation(false)
 {
+	// recordings which have been interrupted by a crash or a restart are continued
+	journal = new DvbRecordingJournal();
+	resumableRecordings = journal->open(
+		KStandardDirs::locateLocal("appdata", QLatin1String("recordings.journal")));
+	admission = new DvbRecordingAdmission(manager);
+	planner = new DvbRecordingPlanner();
+	// several changes are combined into one update of the plan
+	planTimer.setSingleShot(true);
+	connect(&planTimer, SIGNAL(timeout()), this, SLOT(updatePlan()));
+
 	sqlInit(QLatin1String("RecordingSchedule"),
 		QStringList() << QLatin1String("Name") << QLatin1String("Channel") << QLatin1String("Begin") <<
 		QLatin1String("Duration") << QLatin1String("Repeat"));
 
-	// we regularly recheck the status of the recordings
-	// this way we can keep retrying if the device was busy / tuning failed
-
-	startTimer(5000);
+	// the timer is armed for the nearest deadline (start or end of a recording)
+	scheduleTimer.setSingleShot(true);
+	connect(&scheduleTimer, SIGNAL(timeout()), this, SLOT(checkDeadlines()));
+	armScheduleTimer();
 
 	// compatibility code
 
@@ -117,6 +138,54 @@ DvbRecordingModel::~DvbRecordingModel()
 	}
 
 	sqlFlush();
+	// the running recordings are continued after a restart
+	journal->suspend();
+	recordingFiles.clear();
+	journal->close();
+	qDeleteAll(splitters);
+	delete planner;
+	delete journal;
+	delete admission;
+}
+
+bool DvbRecordingModel::getRecordingProgress(const SqlKey &sqlKey, QString &fileName,
+	qint64 &committedSize, QVector<DvbTsIndexEntry> *indexEntries) const
+{
+	QExplicitlySharedDataPointer<DvbRecordingFile> recordingFile = recordingFiles.value(sqlKey);
+
+	if ((recordingFile.constData() == NULL) || !recordingFile->isOpen()) {
+		return false;
+	}
+
+	fileName = recordingFile->getFileName();
+	committedSize = recordingFile->getCommittedSize();
+
+	if (indexEntries != NULL) {
+		*indexEntries = recordingFile->getIndexEntries();
+		int size = indexEntries->size();
+
+		while ((size > 0) && (indexEntries->at(size - 1).offset >= committedSize)) {
+			--size;
+		}
+
+		indexEntries->resize(size);
+	}
+
+	return true;
+}
+
+bool DvbRecordingModel::playRecording(const DvbSharedRecording &recording)
+{
+	if (tailSource == NULL) {
+		tailSource = new DvbRecordingTailSource(this, this);
+	}
+
+	if (!tailSource->start(*recording)) {
+		return false;
+	}
+
+	manager->getMediaWidget()->play(tailSource);
+	return true;
 }
 
 bool DvbRecordingModel::hasRecordings() const
@@ -161,6 +230,8 @@ DvbSharedRecording DvbRecordingModel::addRecording(DvbRecording &recording)
 
 	DvbSharedRecording newRecording(new DvbRecording(recording));
 	recordings.insert(*newRecording, newRecording);
+	scheduleRecording(*newRecording);
+	schedulePlan(*newRecording);
 	sqlInsert(*newRecording);
 	emit recordingAdded(newRecording);
 	return newRecording;
@@ -187,6 +258,8 @@ void DvbRecordingModel::updateRecording(DvbSharedRecording recording,
 	if (!updateStatus(modifiedRecording)) {
 		recordings.remove(*recording);
 		recordingFiles.remove(*recording);
+		unscheduleRecording(*recording);
+		schedulePlan(*recording);
 		sqlRemove(*recording);
 		emit recordingRemoved(recording);
 		return;
@@ -194,6 +267,8 @@ void DvbRecordingModel::updateRecording(DvbSharedRecording recording,
 
 	emit recordingAboutToBeUpdated(recording);
 	*const_cast<DvbRecording *>(recording.constData()) = modifiedRecording;
+	scheduleRecording(*recording);
+	schedulePlan(*recording);
 	sqlUpdate(*recording);
 	emit recordingUpdated(recording);
 }
@@ -214,28 +289,135 @@ void DvbRecordingModel::removeRecording(DvbSharedRecording recording)
 
 	recordings.remove(*recording);
 	recordingFiles.remove(*recording);
+	unscheduleRecording(*recording);
+	schedulePlan(*recording);
 	sqlRemove(*recording);
 	emit recordingRemoved(recording);
 }
 
-void DvbRecordingModel::timerEvent(QTimerEvent *event)
+void DvbRecordingModel::checkDeadlines()
 {
-	Q_UNUSED(event)
 	QDateTime currentDateTime = QDateTime::currentDateTime().toUTC();
+	QList<SqlKey> dueRecordings;
 
-	foreach (const DvbSharedRecording &recording, recordings) {
-		if (recording->end <= currentDateTime) {
+	while (!deadlines.isEmpty() && (deadlines.constBegin().key() <= currentDateTime)) {
+		SqlKey sqlKey = deadlines.constBegin().value();
+		deadlines.erase(deadlines.begin());
+		recordingDeadlines.remove(sqlKey);
+		dueRecordings.append(sqlKey);
+	}
+
+	// updateRecording() reschedules the recording (or removes it)
+
+	foreach (const SqlKey &sqlKey, dueRecordings) {
+		DvbSharedRecording recording = recordings.value(sqlKey);
+
+		if (recording.isValid()) {
 			DvbRecording modifiedRecording = *recording;
 			updateRecording(recording, modifiedRecording);
 		}
 	}
 
+	for (int i = 0; i < splitters.size(); ++i) {
+		if (!splitters.at(i)->hasOutputs()) {
+			delete splitters.takeAt(i);
+			--i;
+		}
+	}
+
+	// the recordings of the last session have been started (or they are over)
+	resumableRecordings.clear();
+	armScheduleTimer();
+}
+
+void DvbRecordingModel::scheduleRecording(const DvbRecording &recording)
+{
+	QDateTime deadline;
+
+	switch (recording.status) {
+	case DvbRecording::Inactive:
+		deadline = recording.begin;
+		break;
+	case DvbRecording::Recording:
+		deadline = recording.end;
+		break;
+	case DvbRecording::Error:
+		// keep retrying if the device was busy / tuning failed
+		deadline = qMin(QDateTime::currentDateTime().toUTC().addSecs(5), recording.end);
+		break;
+	}
+
+	unscheduleRecording(recording);
+	deadlines.insert(deadline, recording);
+	recordingDeadlines.insert(recording, deadline);
+
+	if (deadline == deadlines.constBegin().key()) {
+		armScheduleTimer();
+	}
+}
+
+void DvbRecordingModel::unscheduleRecording(const SqlKey &sqlKey)
+{
+	QMap<SqlKey, QDateTime>::iterator it = recordingDeadlines.find(sqlKey);
+
+	if (it != recordingDeadlines.end()) {
+		deadlines.remove(*it, sqlKey);
+		recordingDeadlines.erase(it);
+	}
+}
+
+void DvbRecordingModel::armScheduleTimer()
+{
+	if (deadlines.isEmpty()) {
+		scheduleTimer.stop();
+		return;
+	}
+
+	// the timer is based on a monotonic clock, which doesn't advance during suspend;
+	// limit the interval so that changes of the wall clock are noticed in time
+	qint64 interval = QDateTime::currentDateTime().toUTC().msecsTo(
+		deadlines.constBegin().key());
+	scheduleTimer.start(int(qBound(Q_INT64_C(0), interval, Q_INT64_C(60000))));
+}
+
+void DvbRecordingModel::schedulePlan(const SqlKey &sqlKey)
+{
+	changedRecordings.insert(sqlKey);
+
+	if (!planTimer.isActive()) {
+		planTimer.start(0);
+	}
+}
+
+void DvbRecordingModel::updatePlan()
+{
+	if (hasPendingOperation) {
+		Log("DvbRecordingModel::updatePlan: illegal recursive call");
+		planTimer.start(0);
+		return;
+	}
+
+	EnsureNoPendingOperation ensureNoPendingOperation(hasPendingOperation);
+	planner->plan(manager->getDeviceConfigs(), recordings, changedRecordings,
+		QDateTime::currentDateTime().toUTC());
+	changedRecordings.clear();
+
 	foreach (const DvbSharedRecording &recording, recordings) {
-		if ((recording->status != DvbRecording::Recording) &&
-		    (recording->begin <= currentDateTime)) {
-			DvbRecording modifiedRecording = *recording;
-			updateRecording(recording, modifiedRecording);
+		QDateTime conflict = planner->getConflict(*recording);
+
+		if (recording->hasConflict == conflict.isValid()) {
+			continue;
+		}
+
+		if (conflict.isValid()) {
+			Log("DvbRecordingModel::updatePlan: no device available for") <<
+				recording->name << conflict.toLocalTime().toString(Qt::ISODate);
 		}
+
+		// the conflict flag isn't stored
+		emit recordingAboutToBeUpdated(recording);
+		const_cast<DvbRecording *>(recording.constData())->hasConflict = conflict.isValid();
+		emit recordingUpdated(recording);
 	}
 }
 
@@ -270,16 +452,31 @@ bool DvbRecordingModel::insertFromSqlQuery(SqlKey sqlKey, const QSqlQuery &query
 	if (recording->validate()) {
 		recording->setSqlKey(sqlKey);
 		recordings.insert(*newRecording, newRecording);
+		scheduleRecording(*newRecording);
+		schedulePlan(*newRecording);
 		return true;
 	}
 
 	return false;
 }
 
+DvbRecordingSplitter *DvbRecordingModel::getSplitter(const DvbSharedChannel &channel)
+{
+	foreach (DvbRecordingSplitter *splitter, splitters) {
+		if (splitter->matches(channel)) {
+			return splitter;
+		}
+	}
+
+	DvbRecordingSplitter *splitter =
+		new DvbRecordingSplitter(manager, channel->source, channel->transponder);
+	splitters.append(splitter);
+	return splitter;
+}
+
 bool DvbRecordingModel::updateStatus(DvbRecording &recording)
 {
-	QDateTime currentDateTimeLocal = QDateTime::currentDateTime();
-	QDateTime currentDateTime = currentDateTimeLocal.toUTC();
+	QDateTime currentDateTime = QDateTime::currentDateTime().toUTC();
 
 	if (recording.end <= currentDateTime) {
 		if (recording.repeat == 0) {
@@ -287,30 +484,10 @@ bool DvbRecordingModel::updateStatus(DvbRecording &recording)
 		}
 
 		recordingFiles.remove(recording);
-
-		// take care of DST switches
-		QDateTime beginLocal = recording.begin.toLocalTime();
-		QDateTime endLocal = recording.end.toLocalTime();
-		int days = endLocal.daysTo(currentDateTimeLocal);
-
-		if (endLocal.addDays(days) <= currentDateTimeLocal) {
-			++days;
-		}
-
-		// QDate::dayOfWeek() and our dayOfWeek differ by one
-		int dayOfWeek = (beginLocal.date().dayOfWeek() - 1 + days);
-
-		for (int j = 0; j < 7; ++j) {
-			if ((recording.repeat & (1 << (dayOfWeek % 7))) != 0) {
-				break;
-			}
-
-			++days;
-			++dayOfWeek;
-		}
-
-		recording.begin = recording.begin.addDays(days);
-		recording.end = recording.end.addDays(days);
+		int duration = QTime().secsTo(recording.duration);
+		recording.begin = DvbRecording::nextRepetition(recording.begin, duration,
+			recording.repeat, currentDateTime);
+		recording.end = recording.begin.addSecs(duration);
 	}
 
 	if (recording.begin <= currentDateTime) {
@@ -318,11 +495,16 @@ bool DvbRecordingModel::updateStatus(DvbRecording &recording)
 			recordingFiles.value(recording);
 
 		if (recordingFile.constData() == NULL) {
-			recordingFile = new DvbRecordingFile(manager);
+			recordingFile = new DvbRecordingFile(manager, journal, admission, recording);
 			recordingFiles.insert(recording, recordingFile);
+
+			if (resumableRecordings.contains(recording)) {
+				recordingFile->resume(resumableRecordings.take(recording));
+			}
 		}
 
-		if (recordingFile->start(recording)) {
+		if (recordingFile->start(recording, getSplitter(recording.channel),
+		    planner->getDevice(recording))) {
 			recording.status = DvbRecording::Recording;
 		} else {
 			recording.status = DvbRecording::Error;
@@ -335,12 +517,245 @@ bool DvbRecordingModel::updateStatus(DvbRecording &recording)
 	return true;
 }
 
-DvbRecordingFile::DvbRecordingFile(DvbManager *manager_) : manager(manager_), device(NULL),
-	pmtValid(false)
+QMap<SqlKey, DvbRecordingJournalEntry> DvbRecordingJournal::open(const QString &fileName)
+{
+	QMap<SqlKey, DvbRecordingJournalEntry> entries;
+	file.setFileName(fileName);
+
+	if (file.open(QIODevice::ReadOnly)) {
+		QDataStream stream(&file);
+		stream.setVersion(QDataStream::Qt_4_4);
+		int version;
+		stream >> version;
+
+		if (version != 0x2f5c0b1e) {
+			Log("DvbRecordingJournal::open: wrong version") << file.fileName();
+		} else {
+			while (!stream.atEnd()) {
+				int type;
+				SqlKey sqlKey;
+				QDateTime dateTime;
+				QString recordingFileName;
+				QByteArray pmtSectionData;
+				QList<int> pids;
+				qint64 offset = 0;
+				stream >> type >> sqlKey.sqlKey >> dateTime;
+
+				switch (type) {
+				case StartRecord:
+					stream >> recordingFileName;
+					break;
+				case PmtRecord:
+					stream >> pmtSectionData >> pids;
+					break;
+				case OffsetRecord:
+					stream >> offset;
+					break;
+				}
+
+				if (stream.status() != QDataStream::Ok) {
+					// the last record may be incomplete
+					break;
+				}
+
+				if (type == StopRecord) {
+					entries.remove(sqlKey);
+					continue;
+				}
+
+				if ((type != StartRecord) && !entries.contains(sqlKey)) {
+					continue;
+				}
+
+				DvbRecordingJournalEntry &entry = entries[sqlKey];
+				entry.lastUpdate = dateTime;
+
+				switch (type) {
+				case StartRecord:
+					entry = DvbRecordingJournalEntry();
+					entry.fileName = recordingFileName;
+					entry.lastUpdate = dateTime;
+					break;
+				case PmtRecord:
+					entry.pmtSectionData = pmtSectionData;
+					entry.pids = pids;
+					break;
+				case OffsetRecord:
+					entry.offset = offset;
+					break;
+				}
+			}
+		}
+
+		file.close();
+	}
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		Log("DvbRecordingJournal::open: cannot open file") << file.fileName();
+		return entries;
+	}
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_4_4);
+	int version = 0x2f5c0b1e;
+	stream << version;
+	file.flush();
+	return entries;
+}
+
+void DvbRecordingJournal::close()
+{
+	file.close();
+	activeRecordings.clear();
+	suspended = false;
+}
+
+void DvbRecordingJournal::suspend()
+{
+	suspended = true;
+}
+
+void DvbRecordingJournal::startRecording(const SqlKey &sqlKey, const QString &fileName)
+{
+	QDataStream stream(&file);
+	beginRecord(stream, StartRecord, sqlKey);
+	stream << fileName;
+	activeRecordings.insert(sqlKey.sqlKey);
+	endRecord();
+}
+
+void DvbRecordingJournal::updatePmt(const SqlKey &sqlKey, const QByteArray &pmtSectionData,
+	const QList<int> &pids)
+{
+	QDataStream stream(&file);
+	beginRecord(stream, PmtRecord, sqlKey);
+	stream << pmtSectionData << pids;
+	endRecord();
+}
+
+void DvbRecordingJournal::updateOffset(const SqlKey &sqlKey, qint64 offset)
+{
+	QDataStream stream(&file);
+	beginRecord(stream, OffsetRecord, sqlKey);
+	stream << offset;
+	endRecord();
+}
+
+void DvbRecordingJournal::stopRecording(const SqlKey &sqlKey)
+{
+	if (suspended) {
+		activeRecordings.remove(sqlKey.sqlKey);
+		return;
+	}
+
+	QDataStream stream(&file);
+	beginRecord(stream, StopRecord, sqlKey);
+	activeRecordings.remove(sqlKey.sqlKey);
+	endRecord();
+
+	if (activeRecordings.isEmpty() && file.isOpen()) {
+		// keep the journal small; only the version remains
+		file.resize(sizeof(int));
+		file.seek(sizeof(int));
+	}
+}
+
+void DvbRecordingJournal::beginRecord(QDataStream &stream, RecordType type,
+	const SqlKey &sqlKey)
+{
+	// writing to a closed file is a no-op
+	stream.setVersion(QDataStream::Qt_4_4);
+	stream << int(type) << sqlKey.sqlKey << QDateTime::currentDateTime().toUTC();
+}
+
+void DvbRecordingJournal::endRecord()
+{
+	if (file.isOpen()) {
+		// a write() call; fdatasync() isn't needed to survive a crash of the application
+		file.flush();
+	}
+}
+
+QString DvbRecordingAdmission::chooseFolder(int bitRate, const QDateTime &end) const
+{
+	QString folder = manager->getRecordingFolder();
+	qint64 bytes = (qint64(bitRate) * 125 *
+		qMax(qint64(QDateTime::currentDateTime().toUTC().secsTo(end)), Q_INT64_C(0)));
+
+	if (check(folder, bitRate, bytes)) {
+		return folder;
+	}
+
+	QString alternativeFolder = manager->getRecordingAlternativeFolder();
+
+	if (!alternativeFolder.isEmpty() && (alternativeFolder != folder) &&
+	    check(alternativeFolder, bitRate, bytes)) {
+		Log("DvbRecordingAdmission::chooseFolder: using the alternative folder") <<
+			alternativeFolder;
+		return alternativeFolder;
+	}
+
+	return folder;
+}
+
+void DvbRecordingAdmission::addRecording(DvbRecordingFile *file)
+{
+	if (!files.contains(file)) {
+		files.append(file);
+	}
+}
+
+void DvbRecordingAdmission::removeRecording(DvbRecordingFile *file)
+{
+	files.removeAll(file);
+}
+
+bool DvbRecordingAdmission::check(const QString &folder, int bitRate, qint64 bytes) const
+{
+	QByteArray encodedFolder = QFile::encodeName(folder);
+	struct stat folderStat;
+	struct statvfs fileSystemStat;
+
+	if ((stat(encodedFolder.constData(), &folderStat) != 0) ||
+	    (statvfs(encodedFolder.constData(), &fileSystemStat) != 0)) {
+		// the folder is created when the recording is started
+		return true;
+	}
+
+	// the preallocated space of the running recordings is already in use
+	qint64 availableBytes = (qint64(fileSystemStat.f_bavail) * fileSystemStat.f_frsize);
+	int totalBitRate = bitRate;
+
+	foreach (DvbRecordingFile *file, files) {
+		if (file->getFileSystemId() == quint64(folderStat.st_dev)) {
+			bytes += file->getUnreservedBytes();
+			totalBitRate += file->getBitRate();
+		}
+	}
+
+	if (bytes > availableBytes) {
+		Log("DvbRecordingAdmission::check: not enough space (MiB needed / available)") <<
+			(bytes >> 20) << (availableBytes >> 20) << folder;
+		return false;
+	}
+
+	int maxBandwidth = manager->getRecordingMaxBandwidth();
+
+	if ((maxBandwidth > 0) && (totalBitRate > (1000 * maxBandwidth))) {
+		Log("DvbRecordingAdmission::check: write bandwidth exceeded (kbit/s)") <<
+			totalBitRate << folder;
+		return false;
+	}
+
+	return true;
+}
+
+DvbRecordingFile::DvbRecordingFile(DvbManager *manager_, DvbRecordingJournal *journal_,
+	DvbRecordingAdmission *admission_, const SqlKey &sqlKey_) : manager(manager_),
+	journal(journal_), admission(admission_), sqlKey(sqlKey_), estimatedBitRate(0),
+	bitRateOffset(0), preallocatedBytes(0), fileSystemId(0), splitter(NULL),
+	pmtValid(false), compact(false), stuffingBytes(0)
 {
-	connect(&pmtFilter, SIGNAL(pmtSectionChanged(QByteArray)),
-		this, SLOT(pmtSectionChanged(QByteArray)));
-	connect(&patPmtTimer, SIGNAL(timeout()), this, SLOT(insertPatPmt()));
 }
 
 DvbRecordingFile::~DvbRecordingFile()
@@ -348,30 +763,69 @@ DvbRecordingFile::~DvbRecordingFile()
 	stop();
 }
 
-bool DvbRecordingFile::start(const DvbRecording &recording)
+bool DvbRecordingFile::resume(const DvbRecordingJournalEntry &entry)
+{
+	if (!QFile::exists(entry.fileName) ||
+	    !file.reopen(manager->getFileWriterThread(), entry.fileName, entry.offset,
+	    manager->getRecordingBufferBlocks(), manager->getRecordingSyncInterval())) {
+		Log("DvbRecordingFile::resume: cannot reopen file") << entry.fileName;
+		return false;
+	}
+
+	Log("DvbRecordingFile::resume: continuing at offset") << file.getSize() << file.fileName();
+	QString sidecarFileName = DvbTsIndex::sidecarFileName(file.fileName());
+	index.load(sidecarFileName);
+	index.resume(file.getSize(),
+		entry.lastUpdate.msecsTo(QDateTime::currentDateTime().toUTC()));
+
+	if (!entry.pmtSectionData.isEmpty()) {
+		DvbPmtSection pmtSection(entry.pmtSectionData);
+
+		if (pmtSection.isValid()) {
+			index.setPids(DvbPmtParser(pmtSection));
+		}
+	}
+
+	index.openSidecarFile(sidecarFileName);
+	compact = manager->getRecordingCompactMode();
+	stuffingBytes = 0;
+	journal->startRecording(sqlKey, file.fileName());
+	journal->updateOffset(sqlKey, file.getCommittedSize());
+	journalTimer.start();
+	return true;
+}
+
+bool DvbRecordingFile::start(const DvbRecording &recording, DvbRecordingSplitter *splitter_,
+	DvbDevice *plannedDevice)
 {
+	channelName = recording.channel->name;
+	end = recording.end;
+
 	if (!file.isOpen()) {
-		QString folder = manager->getRecordingFolder();
+		estimatedBitRate = manager->getChannelBitRate(channelName);
+		QString folder = admission->chooseFolder(estimatedBitRate, end);
 		QString path = folder + QLatin1Char('/') +
 			QString(recording.name).replace(QLatin1Char('/'), QLatin1Char('_'));
 
+		QString fileName;
+
 		for (int attempt = 0; attempt < 100; ++attempt) {
 			if (attempt == 0) {
-				file.setFileName(path + QLatin1String(".m2t"));
+				fileName = (path + QLatin1String(".m2t"));
 			} else {
-				file.setFileName(path + QLatin1Char('-') + QString::number(attempt) +
+				fileName = (path + QLatin1Char('-') + QString::number(attempt) +
 					QLatin1String(".m2t"));
 			}
 
-			if (file.exists()) {
+			if (QFile::exists(fileName)) {
 				continue;
 			}
 
-			if (file.open(QIODevice::WriteOnly)) {
+			if (file.open(manager->getFileWriterThread(), fileName, false,
+			    manager->getRecordingBufferBlocks(), manager->getRecordingSyncInterval())) {
 				break;
 			} else {
-				Log("DvbRecordingFile::start: cannot open file") <<
-					file.fileName();
+				Log("DvbRecordingFile::start: cannot open file") << fileName;
 			}
 
 			if ((attempt == 0) && !QDir(folder).exists()) {
@@ -396,31 +850,28 @@ bool DvbRecordingFile::start(const DvbRecording &recording)
 		}
 
 		if (!file.isOpen()) {
-			Log("DvbRecordingFile::start: cannot open file") << file.fileName();
+			Log("DvbRecordingFile::start: cannot open file") << fileName;
 			return false;
 		}
+
+		index.reset();
+		index.openSidecarFile(DvbTsIndex::sidecarFileName(file.fileName()));
+		compact = manager->getRecordingCompactMode();
+		stuffingBytes = 0;
+		journal->startRecording(sqlKey, file.fileName());
+		journalTimer.start();
 	}
 
-	if (device == NULL) {
-		channel = recording.channel;
-		device = manager->requestDevice(channel->source, channel->transponder,
-			DvbManager::Prioritized);
+	if (!bitRateTimer.isValid()) {
+		admit();
+	}
 
-		if (device == NULL) {
-			Log("DvbRecordingFile::start: cannot find a suitable device");
+	if (splitter == NULL) {
+		if (!splitter_->addOutput(this, recording.channel, plannedDevice)) {
 			return false;
 		}
 
-		connect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
-		pmtFilter.setProgramNumber(channel->serviceId);
-		device->addSectionFilter(channel->pmtPid, &pmtFilter);
-		pmtSectionData = channel->pmtSectionData;
-		patGenerator.initPat(channel->transportStreamId, channel->serviceId,
-			channel->pmtPid);
-
-		if (channel->isScrambled && !pmtSectionData.isEmpty()) {
-			device->startDescrambling(pmtSectionData, this);
-		}
+		splitter = splitter_;
 	}
 
 	return true;
@@ -428,158 +879,970 @@ bool DvbRecordingFile::start(const DvbRecording &recording)
 
 void DvbRecordingFile::stop()
 {
-	if (device != NULL) {
-		if (channel->isScrambled && !pmtSectionData.isEmpty()) {
-			device->stopDescrambling(pmtSectionData, this);
+	if (splitter != NULL) {
+		splitter->removeOutput(this);
+		splitter = NULL;
+	}
+
+	if (bitRateTimer.isValid()) {
+		qint64 elapsed = bitRateTimer.elapsed();
+
+		if (elapsed >= 60000) {
+			// bytes per millisecond * 8 = kbit/s
+			manager->updateChannelBitRate(channelName,
+				int(((file.getSize() - bitRateOffset) * 8) / elapsed));
 		}
 
-		foreach (int pid, pids) {
-			device->removePidFilter(pid, this);
+		admission->removeRecording(this);
+		bitRateTimer.invalidate();
+	}
+
+	if (file.isOpen()) {
+		if (journal->isSuspended()) {
+			// the remaining blocks are written before the writer thread exits
+			journal->updateOffset(sqlKey, file.getSize());
 		}
 
-		device->removeSectionFilter(channel->pmtPid, &pmtFilter);
-		disconnect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
-		manager->releaseDevice(device, DvbManager::Prioritized);
-		device = NULL;
+		journal->stopRecording(sqlKey);
+		manager->getRecordingScanner()->scanFile(file.fileName());
+
+		if (compact) {
+			Log("DvbRecordingFile::stop: stuffing bytes dropped by the compact mode") <<
+				stuffingBytes << file.fileName();
+		}
 	}
 
 	pmtValid = false;
-	patPmtTimer.stop();
-	patGenerator.reset();
-	pmtGenerator.reset();
-	pmtSectionData.clear();
-	pids.clear();
 	buffers.clear();
 	file.close();
-	channel = DvbSharedChannel();
+	index.closeSidecarFile();
+	index.reset();
 }
 
-void DvbRecordingFile::deviceStateChanged()
+int DvbRecordingFile::getBitRate() const
 {
-	if (device->getDeviceState() == DvbDevice::DeviceReleased) {
-		foreach (int pid, pids) {
-			device->removePidFilter(pid, this);
-		}
-
-		device->removeSectionFilter(channel->pmtPid, &pmtFilter);
-		disconnect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
-
-		if (channel->isScrambled && !pmtSectionData.isEmpty()) {
-			device->stopDescrambling(pmtSectionData, this);
-		}
-
-		device = manager->requestDevice(channel->source, channel->transponder,
-			DvbManager::Prioritized);
-
-		if (device != NULL) {
-			connect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
-			device->addSectionFilter(channel->pmtPid, &pmtFilter);
-
-			foreach (int pid, pids) {
-				device->addPidFilter(pid, this);
-			}
+	if (bitRateTimer.isValid()) {
+		qint64 elapsed = bitRateTimer.elapsed();
 
-			if (channel->isScrambled && !pmtSectionData.isEmpty()) {
-				device->startDescrambling(pmtSectionData, this);
-			}
-		} else {
-			stop();
+		if (elapsed >= 30000) {
+			return int(((file.getSize() - bitRateOffset) * 8) / elapsed);
 		}
 	}
+
+	return estimatedBitRate;
 }
 
-void DvbRecordingFile::pmtSectionChanged(const QByteArray &pmtSectionData_)
+qint64 DvbRecordingFile::getUnreservedBytes() const
 {
-	pmtSectionData = pmtSectionData_;
-	DvbPmtSection pmtSection(pmtSectionData);
-	DvbPmtParser pmtParser(pmtSection);
-	QSet<int> newPids;
+	qint64 projectedBytes = (qint64(getBitRate()) * 125 *
+		qMax(qint64(QDateTime::currentDateTime().toUTC().secsTo(end)), Q_INT64_C(0)));
+	qint64 reservedBytes = (preallocatedBytes - (file.getSize() - bitRateOffset));
+	return qMax(projectedBytes - qMax(reservedBytes, Q_INT64_C(0)), Q_INT64_C(0));
+}
 
-	if (pmtParser.videoPid != -1) {
-		newPids.insert(pmtParser.videoPid);
+void DvbRecordingFile::admit()
+{
+	if (estimatedBitRate <= 0) {
+		estimatedBitRate = manager->getChannelBitRate(channelName);
 	}
 
-	for (int i = 0; i < pmtParser.audioPids.size(); ++i) {
-		newPids.insert(pmtParser.audioPids.at(i).first);
-	}
+	struct stat fileStat;
 
-	for (int i = 0; i < pmtParser.subtitlePids.size(); ++i) {
-		newPids.insert(pmtParser.subtitlePids.at(i).first);
+	if (stat(QFile::encodeName(file.fileName()).constData(), &fileStat) == 0) {
+		fileSystemId = quint64(fileStat.st_dev);
 	}
 
-	if (pmtParser.teletextPid != -1) {
-		newPids.insert(pmtParser.teletextPid);
-	}
+	// the projected size is reserved on disk, so that the file stays contiguous and
+	// a full disk is noticed by the admission check of the next recording
+	qint64 bytes = (qint64(estimatedBitRate) * 125 *
+		qMax(qint64(QDateTime::currentDateTime().toUTC().secsTo(end)), Q_INT64_C(0)));
+	preallocatedBytes = (file.preallocate(bytes) ? bytes : 0);
+	bitRateOffset = file.getSize();
+	bitRateTimer.start();
+	admission->addRecording(this);
+}
 
-	for (int i = 0; i < pids.size(); ++i) {
-		int pid = pids.at(i);
+void DvbRecordingFile::processData(const char data[188])
+{
+	if (compact) {
+		DvbTsPacket packet(data);
+		qint64 pcr;
+
+		// packets without payload are only needed for the pcr or a discontinuity
+		if (!packet.hasPayload() && !packet.isDiscontinuous() && !packet.getPcr(pcr)) {
+			stuffingBytes += 188;
+			return;
+		}
+	}
 
-		if (!newPids.remove(pid)) {
-			device->removePidFilter(pid, this);
-			pids.removeAt(i);
-			--i;
+	if (!pmtValid) {
+		if (buffers.isEmpty() || (buffers.last().size() >= (348 * 188))) {
+			QByteArray nextBuffer;
+			nextBuffer.reserve(348 * 188);
+			buffers.append(nextBuffer);
 		}
+
+		buffers.last().append(data, 188);
+		return;
 	}
 
-	foreach (int pid, newPids) {
-		device->addPidFilter(pid, this);
-		pids.append(pid);
+	if (file.write(data, 188)) {
+		index.addPackets(data, 188);
 	}
+}
 
-	pmtGenerator.initPmt(channel->pmtPid, pmtSection, pids);
+void DvbRecordingFile::setPmt(const QByteArray &pmtSectionData, const QList<int> &pids)
+{
+	DvbPmtSection pmtSection(pmtSectionData);
+
+	if (pmtSection.isValid()) {
+		index.setPids(DvbPmtParser(pmtSection));
+	}
+
+	journal->updatePmt(sqlKey, pmtSectionData, pids);
+}
+
+void DvbRecordingFile::writePatPmt(const QByteArray &pat, const QByteArray &pmt)
+{
+	writeData(pat);
+	writeData(pmt);
+
+	// called every 500 ms
+	if (journalTimer.elapsed() >= 10000) {
+		journal->updateOffset(sqlKey, file.getCommittedSize());
+		journalTimer.start();
+	}
 
 	if (!pmtValid) {
 		pmtValid = true;
-		file.write(patGenerator.generatePackets());
-		file.write(pmtGenerator.generatePackets());
 
 		foreach (const QByteArray &buffer, buffers) {
-			file.write(buffer);
+			writeData(buffer);
 		}
 
 		buffers.clear();
+	}
+}
+
+void DvbRecordingFile::writeData(const QByteArray &data)
+{
+	if (file.write(data.constData(), data.size())) {
+		index.addPackets(data.constData(), data.size());
+	}
+}
+
+class DvbRecordingSplitterService
+{
+public:
+	DvbRecordingSplitterService() : pmtValid(false), pendingTicks(0), dropTeletext(false),
+		dropSubtitles(false) { }
+	~DvbRecordingSplitterService() { }
+
+	DvbSharedChannel channel;
+	QByteArray pmtSectionData;
+	QList<int> pids; // without the dropped pids (compact mode)
+	DvbSectionGenerator patGenerator;
+	DvbSectionGenerator pmtGenerator;
+	QList<DvbRecordingFile *> outputs;
+	bool pmtValid;
+	int pendingTicks; // timer ticks without a pmt
+	bool dropTeletext; // compact mode
+	bool dropSubtitles; // compact mode
+};
+
+DvbRecordingSplitter::DvbRecordingSplitter(DvbManager *manager_, const QString &source_,
+	const DvbTransponder &transponder_) : manager(manager_), source(source_),
+	transponder(transponder_), device(NULL)
+{
+	pidOutputs.resize(8192);
+	connect(&patPmtTimer, SIGNAL(timeout()), this, SLOT(insertPatPmt()));
+}
+
+DvbRecordingSplitter::~DvbRecordingSplitter()
+{
+	if (hasOutputs()) {
+		Log("DvbRecordingSplitter::~DvbRecordingSplitter: recordings are still active");
+	}
+
+	foreach (DvbRecordingSplitterService *service, services) {
+		service->outputs.clear();
+	}
+
+	releaseIdleServices();
+}
+
+bool DvbRecordingSplitter::matches(const DvbSharedChannel &channel) const
+{
+	return ((channel->source == source) && channel->transponder.corresponds(transponder));
+}
+
+bool DvbRecordingSplitter::hasOutputs() const
+{
+	foreach (DvbRecordingSplitterService *service, services) {
+		if (!service->outputs.isEmpty()) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+bool DvbRecordingSplitter::addOutput(DvbRecordingFile *output, const DvbSharedChannel &channel,
+	DvbDevice *plannedDevice)
+{
+	if (device == NULL) {
+		device = manager->requestDevice(source, transponder, DvbManager::Prioritized,
+			plannedDevice);
+
+		if (device == NULL) {
+			Log("DvbRecordingSplitter::addOutput: cannot find a suitable device");
+			return false;
+		}
+
+		connect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+	}
+
+	DvbRecordingSplitterService *service = services.value(channel->serviceId);
+
+	if (service == NULL) {
+		service = new DvbRecordingSplitterService();
+		service->channel = channel;
+		service->pmtSectionData = channel->pmtSectionData;
+		service->patGenerator.initPat(channel->transportStreamId, channel->serviceId,
+			channel->pmtPid);
+
+		if (manager->getRecordingCompactMode()) {
+			service->dropTeletext = !manager->getRecordingCompactKeepTeletext();
+			service->dropSubtitles = !manager->getRecordingCompactKeepSubtitles();
+		}
+
+		services.insert(channel->serviceId, service);
+
+		if (channel->isScrambled && !service->pmtSectionData.isEmpty()) {
+			device->startDescrambling(service->pmtSectionData, this);
+		}
+	}
+
+	service->outputs.append(output);
+	updatePids();
+
+	if (service->pmtValid) {
+		// the pat / pmt are regenerated for every new recording (continuity counter)
+		output->setPmt(service->pmtSectionData, service->pids);
+		output->writePatPmt(service->patGenerator.generatePackets(),
+			service->pmtGenerator.generatePackets());
+	}
+
+	if (!patPmtTimer.isActive()) {
 		patPmtTimer.start(500);
 	}
 
-	insertPatPmt();
+	return true;
+}
+
+void DvbRecordingSplitter::removeOutput(DvbRecordingFile *output)
+{
+	foreach (DvbRecordingSplitterService *service, services) {
+		if (service->outputs.removeAll(output) != 0) {
+			break;
+		}
+	}
+
+	updatePids();
+
+	// the service (filters, pmt, device) is kept until control returns to the event
+	// loop; a following recording of the same service which starts at the same time
+	// continues with the same stream (no re-tuning, no waiting for the pmt)
+	QTimer::singleShot(0, this, SLOT(releaseIdleServices()));
+}
+
+void DvbRecordingSplitter::releaseIdleServices()
+{
+	QMap<int, DvbRecordingSplitterService *>::iterator it = services.begin();
+
+	while (it != services.end()) {
+		DvbRecordingSplitterService *service = *it;
+
+		if (!service->outputs.isEmpty()) {
+			++it;
+			continue;
+		}
+
+		if ((device != NULL) && service->channel->isScrambled &&
+		    !service->pmtSectionData.isEmpty()) {
+			device->stopDescrambling(service->pmtSectionData, this);
+		}
+
+		delete service;
+		it = services.erase(it);
+	}
+
+	updatePids();
+
+	if (services.isEmpty()) {
+		patPmtTimer.stop();
+
+		if (device != NULL) {
+			disconnect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+			manager->releaseDevice(device, DvbManager::Prioritized);
+			device = NULL;
+		}
+	}
+}
+
+void DvbRecordingSplitter::deviceStateChanged()
+{
+	if (device->getDeviceState() != DvbDevice::DeviceReleased) {
+		return;
+	}
+
+	removeFilters();
+	disconnect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+
+	foreach (DvbRecordingSplitterService *service, services) {
+		if (service->channel->isScrambled && !service->pmtSectionData.isEmpty()) {
+			device->stopDescrambling(service->pmtSectionData, this);
+		}
+	}
 
-	if (channel->isScrambled) {
+	device = manager->requestDevice(source, transponder, DvbManager::Prioritized);
+
+	if (device != NULL) {
+		connect(device, SIGNAL(stateChanged()), this, SLOT(deviceStateChanged()));
+		addFilters();
+
+		foreach (DvbRecordingSplitterService *service, services) {
+			if (service->channel->isScrambled && !service->pmtSectionData.isEmpty()) {
+				device->startDescrambling(service->pmtSectionData, this);
+			}
+		}
+	} else {
+		// the recordings are restarted by the recording model
+		QList<DvbRecordingFile *> outputs;
+
+		foreach (DvbRecordingSplitterService *service, services) {
+			outputs += service->outputs;
+		}
+
+		foreach (DvbRecordingFile *output, outputs) {
+			output->stop();
+		}
+	}
+}
+
+void DvbRecordingSplitter::insertPatPmt()
+{
+	foreach (DvbRecordingSplitterService *service, services) {
+		if (!service->pmtValid) {
+			// fall back to the stored pmt if none has been received within a second
+			if (++service->pendingTicks >= 2) {
+				pmtSectionChanged(service, service->channel->pmtSectionData);
+			}
+
+			continue;
+		}
+
+		QByteArray pat = service->patGenerator.generatePackets();
+		QByteArray pmt = service->pmtGenerator.generatePackets();
+
+		foreach (DvbRecordingFile *output, service->outputs) {
+			output->writePatPmt(pat, pmt);
+		}
+	}
+}
+
+void DvbRecordingSplitter::processData(const char data[188])
+{
+	int pid = ((static_cast<unsigned char>(data[1]) << 8) |
+		static_cast<unsigned char>(data[2])) & ((1 << 13) - 1);
+	const QList<DvbRecordingFile *> &outputs = pidOutputs.at(pid);
+
+	for (int i = 0; i < outputs.size(); ++i) {
+		outputs.at(i)->processData(data);
+	}
+}
+
+void DvbRecordingSplitter::processSection(const char *data, int size)
+{
+	unsigned char tableId = data[0];
+
+	if (tableId != 0x02) {
+		return;
+	}
+
+	DvbPmtSection pmtSection(data, size);
+
+	if (!pmtSection.isValid()) {
+		return;
+	}
+
+	DvbRecordingSplitterService *service = services.value(pmtSection.programNumber());
+
+	if (service == NULL) {
+		return;
+	}
+
+	if (service->pmtValid && (size == service->pmtSectionData.size()) &&
+	    (memcmp(data, service->pmtSectionData.constData(), size) == 0)) {
+		return;
+	}
+
+	pmtSectionChanged(service, pmtSection.toByteArray());
+}
+
+void DvbRecordingSplitter::pmtSectionChanged(DvbRecordingSplitterService *service,
+	const QByteArray &pmtSectionData)
+{
+	service->pmtSectionData = pmtSectionData;
+	DvbPmtSection pmtSection(pmtSectionData);
+	DvbPmtParser pmtParser(pmtSection);
+	QSet<int> newPids;
+
+	if (pmtParser.videoPid != -1) {
+		newPids.insert(pmtParser.videoPid);
+	}
+
+	for (int i = 0; i < pmtParser.audioPids.size(); ++i) {
+		newPids.insert(pmtParser.audioPids.at(i).first);
+	}
+
+	// dropped pids aren't filtered at all (compact mode)
+	if (!service->dropSubtitles) {
+		for (int i = 0; i < pmtParser.subtitlePids.size(); ++i) {
+			newPids.insert(pmtParser.subtitlePids.at(i).first);
+		}
+	}
+
+	if ((pmtParser.teletextPid != -1) && !service->dropTeletext) {
+		newPids.insert(pmtParser.teletextPid);
+	}
+
+	// the pcr may be carried on a separate pid (0x1fff = no pcr)
+	if (pmtSection.isValid() && (pmtSection.pcrPid() != 0x1fff)) {
+		newPids.insert(pmtSection.pcrPid());
+	}
+
+	service->pids = newPids.toList();
+	qSort(service->pids);
+	service->pmtGenerator.initPmt(service->channel->pmtPid, pmtSection, service->pids);
+	service->pmtValid = true;
+	updatePids();
+
+	QByteArray pat = service->patGenerator.generatePackets();
+	QByteArray pmt = service->pmtGenerator.generatePackets();
+
+	foreach (DvbRecordingFile *output, service->outputs) {
+		output->setPmt(pmtSectionData, service->pids);
+		output->writePatPmt(pat, pmt);
+	}
+
+	if (service->channel->isScrambled && (device != NULL)) {
 		device->startDescrambling(pmtSectionData, this);
 	}
 }
 
-void DvbRecordingFile::insertPatPmt()
+void DvbRecordingSplitter::updatePids()
 {
-	if (!pmtValid) {
-		pmtSectionChanged(channel->pmtSectionData);
+	// the routing table is rebuilt from scratch; this only happens if a recording is
+	// started or stopped or if a pmt changes
+
+	foreach (int pid, pids) {
+		pidOutputs[pid].clear();
+	}
+
+	QSet<int> newPids;
+	QSet<int> newPmtPids;
+
+	foreach (DvbRecordingSplitterService *service, services) {
+		newPmtPids.insert(service->channel->pmtPid);
+
+		foreach (int pid, service->pids) {
+			newPids.insert(pid);
+			pidOutputs[pid] += service->outputs;
+		}
+	}
+
+	if (device != NULL) {
+		foreach (int pid, pids) {
+			if (!newPids.contains(pid)) {
+				device->removePidFilter(pid, this);
+			}
+		}
+
+		foreach (int pid, newPids) {
+			if (!pids.contains(pid)) {
+				device->addPidFilter(pid, this);
+			}
+		}
+
+		foreach (int pmtPid, pmtPids) {
+			if (!newPmtPids.contains(pmtPid)) {
+				device->removeSectionFilter(pmtPid, this);
+			}
+		}
+
+		foreach (int pmtPid, newPmtPids) {
+			if (!pmtPids.contains(pmtPid)) {
+				device->addSectionFilter(pmtPid, this);
+			}
+		}
+	}
+
+	pids = newPids;
+	pmtPids = newPmtPids;
+}
+
+void DvbRecordingSplitter::addFilters()
+{
+	foreach (int pid, pids) {
+		device->addPidFilter(pid, this);
+	}
+
+	foreach (int pmtPid, pmtPids) {
+		device->addSectionFilter(pmtPid, this);
+	}
+}
+
+void DvbRecordingSplitter::removeFilters()
+{
+	foreach (int pid, pids) {
+		device->removePidFilter(pid, this);
+	}
+
+	foreach (int pmtPid, pmtPids) {
+		device->removeSectionFilter(pmtPid, this);
+	}
+}
+
+DvbRecordingTailSource::DvbRecordingTailSource(DvbRecordingModel *model_, QObject *parent) :
+	QObject(parent), model(model_), sourceFd(-1), readFd(-1), writeFd(-1), notifier(NULL),
+	bufferOffset(0), readOffset(0), idlePolls(0)
+{
+	QString pipeName =
+		KStandardDirs::locateLocal("appdata", QLatin1String("dvbrecordingpipe.m2t"));
+	QFile::remove(pipeName);
+	url = QUrl::fromLocalFile(pipeName);
+
+	if (mkfifo(QFile::encodeName(pipeName).constData(), 0600) != 0) {
+		Log("DvbRecordingTailSource::DvbRecordingTailSource: mkfifo failed");
+	}
+
+	connect(&pollTimer, SIGNAL(timeout()), this, SLOT(feed()));
+}
+
+DvbRecordingTailSource::~DvbRecordingTailSource()
+{
+	stop();
+}
+
+bool DvbRecordingTailSource::start(const SqlKey &sqlKey_)
+{
+	stop();
+	qint64 committedSize;
+
+	if (!model->getRecordingProgress(sqlKey_, fileName, committedSize)) {
+		Log("DvbRecordingTailSource::start: recording isn't running");
+		return false;
+	}
+
+	sqlKey = sqlKey_;
+	QByteArray encodedPipeName = QFile::encodeName(url.toLocalFile());
+	// the read end is kept open, so that the write end can be opened without a reader
+	readFd = open(encodedPipeName.constData(), O_RDONLY | O_NONBLOCK);
+	writeFd = open(encodedPipeName.constData(), O_WRONLY | O_NONBLOCK);
+	sourceFd = open(QFile::encodeName(fileName).constData(), O_RDONLY);
+
+	if ((readFd < 0) || (writeFd < 0) || (sourceFd < 0)) {
+		Log("DvbRecordingTailSource::start: open failed") << fileName;
+		stop();
+		return false;
+	}
+
+	notifier = new QSocketNotifier(writeFd, QSocketNotifier::Write, this);
+	notifier->setEnabled(false);
+	connect(notifier, SIGNAL(activated(int)), this, SLOT(feed()));
+
+	// the file writer hands over partially filled blocks after 2 seconds, so the latency
+	// is the same as for time shift
+	pollTimer.start(200);
+	feed();
+	return true;
+}
+
+void DvbRecordingTailSource::stop()
+{
+	pollTimer.stop();
+	delete notifier;
+	notifier = NULL;
+
+	if (sourceFd >= 0) {
+		close(sourceFd);
+		sourceFd = -1;
+	}
+
+	if (writeFd >= 0) {
+		close(writeFd);
+		writeFd = -1;
+	}
+
+	if (readFd >= 0) {
+		close(readFd);
+		readFd = -1;
+	}
+
+	buffer.clear();
+	bufferOffset = 0;
+	readOffset = 0;
+	idlePolls = 0;
+}
+
+void DvbRecordingTailSource::feed()
+{
+	if (writeFd < 0) {
 		return;
 	}
 
-	file.write(patGenerator.generatePackets());
-	file.write(pmtGenerator.generatePackets());
+	notifier->setEnabled(false);
+
+	while (true) {
+		if (bufferOffset >= buffer.size()) {
+			QString currentFileName;
+			qint64 committedSize;
+			bool running = (model->getRecordingProgress(sqlKey, currentFileName,
+				committedSize) && (currentFileName == fileName));
+
+			if (!running) {
+				// the recording has finished; the file is complete after a short while
+				struct stat buf;
+				committedSize = ((fstat(sourceFd, &buf) == 0) ? buf.st_size : 0);
+			}
+
+			committedSize = ((committedSize / 188) * 188);
+
+			if (readOffset >= committedSize) {
+				if (!running && (++idlePolls >= 10)) {
+					// closing the write end signals the end of the file to the player
+					pollTimer.stop();
+					delete notifier;
+					notifier = NULL;
+					close(writeFd);
+					writeFd = -1;
+				}
+
+				return;
+			}
+
+			idlePolls = 0;
+			buffer.resize(int(qMin(committedSize - readOffset, qint64(BufferSize))));
+			ssize_t bytesRead = pread(sourceFd, buffer.data(), buffer.size(), readOffset);
+
+			if (bytesRead <= 0) {
+				if ((bytesRead < 0) && (errno == EINTR)) {
+					continue;
+				}
+
+				buffer.clear();
+				return;
+			}
+
+			buffer.resize(int(bytesRead));
+			bufferOffset = 0;
+			readOffset += bytesRead;
+		}
+
+		ssize_t bytesWritten = write(writeFd, buffer.constData() + bufferOffset,
+			buffer.size() - bufferOffset);
+
+		if (bytesWritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			// the pipe is full
+			notifier->setEnabled(true);
+			return;
+		}
+
+		bufferOffset += int(bytesWritten);
+	}
 }
 
-void DvbRecordingFile::processData(const char data[188])
+void DvbRecordingPlanner::plan(const QList<DvbDeviceConfig> &deviceConfigs,
+	const QMap<SqlKey, DvbSharedRecording> &recordings,
+	const QSet<SqlKey> &changedRecordings, const QDateTime &currentDateTime)
 {
-	if (!pmtValid) {
-		if (!patPmtTimer.isActive()) {
-			patPmtTimer.start(1000);
-			QByteArray nextBuffer;
-			nextBuffer.reserve(348 * 188);
-			buffers.append(nextBuffer);
+	QList<DvbRecordingPlannerTuner> newTuners;
+
+	foreach (const DvbDeviceConfig &deviceConfig, deviceConfigs) {
+		if (deviceConfig.device == NULL) {
+			continue;
 		}
 
-		QByteArray &buffer = buffers.last();
-		buffer.append(data, 188);
+		DvbRecordingPlannerTuner tuner;
+		tuner.device = deviceConfig.device;
 
-		if (buffer.size() >= (348 * 188)) {
-			QByteArray nextBuffer;
-			nextBuffer.reserve(348 * 188);
-			buffers.append(nextBuffer);
+		foreach (const DvbConfig &config, deviceConfig.configs) {
+			tuner.sources.append(config->name);
+		}
+
+		newTuners.append(tuner);
+	}
+
+	bool fullPlan = (!windowBegin.isValid() || (windowBegin.addDays(1) <= currentDateTime) ||
+		(newTuners.size() != tuners.size()));
+
+	for (int i = 0; !fullPlan && (i < tuners.size()); ++i) {
+		fullPlan = ((tuners.at(i).device != newTuners.at(i).device) ||
+			(tuners.at(i).sources != newTuners.at(i).sources));
+	}
+
+	if (fullPlan) {
+		tuners = newTuners;
+		windowBegin = currentDateTime;
+		windowEnd = currentDateTime.addDays(7);
+		occurrences.clear();
+
+		foreach (const DvbSharedRecording &recording, recordings) {
+			if (recording->end > currentDateTime) {
+				expand(recording, occurrences);
+			}
+		}
+
+		qStableSort(occurrences);
+		assign(0, occurrences.size(), currentDateTime);
+	} else {
+		// the time ranges of the old and new occurrences of the changed recordings
+		QList<QPair<QDateTime, QDateTime> > ranges;
+		QList<DvbRecordingPlannerOccurrence> oldOccurrences = occurrences;
+		QList<DvbRecordingPlannerOccurrence> newOccurrences;
+		occurrences.clear();
+
+		foreach (const DvbRecordingPlannerOccurrence &occurrence, oldOccurrences) {
+			if (changedRecordings.contains(*occurrence.recording)) {
+				ranges.append(qMakePair(occurrence.begin, occurrence.end));
+			} else if (occurrence.end > currentDateTime) {
+				occurrences.append(occurrence);
+			}
+		}
+
+		foreach (const SqlKey &sqlKey, changedRecordings) {
+			DvbSharedRecording recording = recordings.value(sqlKey);
+
+			if (recording.isValid() && (recording->end > currentDateTime)) {
+				expand(recording, newOccurrences);
+			}
+		}
+
+		qStableSort(newOccurrences);
+		oldOccurrences = occurrences;
+		occurrences.clear();
+		int oldIndex = 0;
+
+		foreach (const DvbRecordingPlannerOccurrence &occurrence, newOccurrences) {
+			ranges.append(qMakePair(occurrence.begin, occurrence.end));
+
+			while ((oldIndex < oldOccurrences.size()) &&
+			       !(occurrence < oldOccurrences.at(oldIndex))) {
+				occurrences.append(oldOccurrences.at(oldIndex));
+				++oldIndex;
+			}
+
+			occurrences.append(occurrence);
+		}
+
+		occurrences += oldOccurrences.mid(oldIndex);
+
+		// only the groups overlapping a range are planned again
+
+		for (int first = 0; first < occurrences.size();) {
+			QDateTime groupBegin = occurrences.at(first).begin;
+			QDateTime groupEnd = occurrences.at(first).end;
+			int last = (first + 1);
+
+			while ((last < occurrences.size()) && (occurrences.at(last).begin < groupEnd)) {
+				groupEnd = qMax(groupEnd, occurrences.at(last).end);
+				++last;
+			}
+
+			for (int i = 0; i < ranges.size(); ++i) {
+				if ((ranges.at(i).first < groupEnd) && (ranges.at(i).second > groupBegin)) {
+					assign(first, last, currentDateTime);
+					break;
+				}
+			}
+
+			first = last;
+		}
+	}
+
+	devices.clear();
+	conflicts.clear();
+
+	foreach (const DvbRecordingPlannerOccurrence &occurrence, occurrences) {
+		if (occurrence.begin >= windowEnd) {
+			break;
 		}
 
+		if (occurrence.tuner < 0) {
+			if (!conflicts.contains(*occurrence.recording)) {
+				conflicts.insert(*occurrence.recording, occurrence.begin);
+			}
+		} else if (occurrence.first) {
+			devices.insert(*occurrence.recording, tuners.at(occurrence.tuner).device);
+		}
+	}
+}
+
+void DvbRecordingPlanner::expand(const DvbSharedRecording &recording,
+	QList<DvbRecordingPlannerOccurrence> &newOccurrences) const
+{
+	DvbRecordingPlannerOccurrence occurrence;
+	occurrence.recording = recording;
+	occurrence.begin = recording->begin;
+	occurrence.end = recording->end;
+	occurrence.first = true;
+	newOccurrences.append(occurrence);
+	occurrence.first = false;
+
+	if (recording->repeat == 0) {
 		return;
 	}
 
-	file.write(data, 188);
+	QDateTime beginLocal = recording->begin.toLocalTime();
+	int duration = recording->begin.secsTo(recording->end);
+	// QDate::dayOfWeek() and our dayOfWeek differ by one
+	int dayOfWeek = (beginLocal.date().dayOfWeek() - 1);
+
+	for (int days = 1; days <= 7; ++days) {
+		if ((recording->repeat & (1 << ((dayOfWeek + days) % 7))) == 0) {
+			continue;
+		}
+
+		occurrence.begin = beginLocal.addDays(days).toUTC();
+
+		if (occurrence.begin >= windowEnd) {
+			break;
+		}
+
+		occurrence.end = occurrence.begin.addSecs(duration);
+		newOccurrences.append(occurrence);
+	}
+}
+
+void DvbRecordingPlanner::assign(int first, int last, const QDateTime &currentDateTime)
+{
+	// all tuners are free before the first occurrence of the group
+
+	for (int i = 0; i < tuners.size(); ++i) {
+		DvbRecordingPlannerTuner &tuner = tuners[i];
+		tuner.source.clear();
+		tuner.transponder = DvbTransponder();
+		tuner.busyUntil = QDateTime();
+		tuner.groupBegin = QDateTime();
+		tuner.group.clear();
+	}
+
+	for (int i = first; i < last; ++i) {
+		DvbRecordingPlannerOccurrence &occurrence = occurrences[i];
+		occurrence.tuner = -1;
+
+		if (occurrence.begin >= windowEnd) {
+			continue;
+		}
+
+		const QString &source = occurrence.recording->channel->source;
+		const DvbTransponder &transponder = occurrence.recording->channel->transponder;
+		int index = -1;
+
+		// share a tuner which is already tuned to the transponder
+
+		for (int j = 0; j < tuners.size(); ++j) {
+			const DvbRecordingPlannerTuner &tuner = tuners.at(j);
+
+			if (tuner.isBusy(occurrence.begin) && (tuner.source == source) &&
+			    tuner.transponder.corresponds(transponder)) {
+				index = j;
+				break;
+			}
+		}
+
+		// otherwise take the free tuner with the least sources
+
+		if (index < 0) {
+			for (int j = 0; j < tuners.size(); ++j) {
+				const DvbRecordingPlannerTuner &tuner = tuners.at(j);
+
+				if (!tuner.isBusy(occurrence.begin) && tuner.sources.contains(source) &&
+				    ((index < 0) ||
+				     (tuner.sources.size() < tuners.at(index).sources.size()))) {
+					index = j;
+				}
+			}
+		}
+
+		if (index < 0) {
+			index = relocate(occurrence.begin, source, currentDateTime);
+		}
+
+		if (index < 0) {
+			continue;
+		}
+
+		DvbRecordingPlannerTuner &tuner = tuners[index];
+
+		if (!tuner.isBusy(occurrence.begin)) {
+			tuner.source = source;
+			tuner.transponder = transponder;
+			tuner.busyUntil = occurrence.end;
+			tuner.groupBegin = occurrence.begin;
+			tuner.group.clear();
+		} else if (tuner.busyUntil < occurrence.end) {
+			tuner.busyUntil = occurrence.end;
+		}
+
+		tuner.group.append(i);
+		occurrence.tuner = index;
+	}
+}
+
+int DvbRecordingPlanner::relocate(const QDateTime &begin, const QString &source,
+	const QDateTime &currentDateTime)
+{
+	// all tuners which can receive 'source' are busy; move the recordings of such a tuner
+	// to a tuner which has been free since they started (if they haven't started yet)
+
+	for (int i = 0; i < tuners.size(); ++i) {
+		DvbRecordingPlannerTuner &busyTuner = tuners[i];
+
+		if (!busyTuner.isBusy(begin) || !busyTuner.sources.contains(source) ||
+		    (busyTuner.groupBegin <= currentDateTime)) {
+			continue;
+		}
+
+		for (int j = 0; j < tuners.size(); ++j) {
+			DvbRecordingPlannerTuner &freeTuner = tuners[j];
+
+			if ((j == i) || freeTuner.isBusy(busyTuner.groupBegin) ||
+			    !freeTuner.sources.contains(busyTuner.source)) {
+				continue;
+			}
+
+			freeTuner.source = busyTuner.source;
+			freeTuner.transponder = busyTuner.transponder;
+			freeTuner.busyUntil = busyTuner.busyUntil;
+			freeTuner.groupBegin = busyTuner.groupBegin;
+			freeTuner.group = busyTuner.group;
+
+			foreach (int index, freeTuner.group) {
+				occurrences[index].tuner = j;
+			}
+
+			// conservative; the previous use ended at 'groupBegin' at the latest
+			busyTuner.busyUntil = busyTuner.groupBegin;
+			busyTuner.group.clear();
+			return i;
+		}
+	}
+
+	return -1;
 }
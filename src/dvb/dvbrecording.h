@@ -22,21 +22,36 @@
 #define DVBRECORDING_H
 
 #include <QDateTime>
+#include <QSet>
+#include <QTimer>
+#include <QVector>
 #include "dvbchannel.h"
 
 class DvbManager;
+class DvbRecordingAdmission;
 class DvbRecordingFile;
+class DvbRecordingJournal;
+class DvbRecordingJournalEntry;
+class DvbRecordingPlanner;
+class DvbRecordingSplitter;
+class DvbRecordingTailSource;
+class DvbTsIndexEntry;
 
 class DvbRecording : public SharedData, public SqlKey
 {
 public:
-	DvbRecording() : repeat(0), status(Inactive) { }
+	DvbRecording() : repeat(0), status(Inactive), hasConflict(false) { }
 	~DvbRecording() { }
 
 	// checks that all variables are ok and updates 'end'
 	// 'sqlKey' and 'status' are ignored
 	bool validate();
 
+	// begin (UTC) of the next repetition which ends after 'currentDateTime' (UTC); the
+	// recording must have ended already and 'repeat' must not be zero
+	static QDateTime nextRepetition(const QDateTime &begin, int duration, int repeat,
+		const QDateTime &currentDateTime);
+
 	enum Status {
 		Inactive,
 		Recording,
@@ -50,8 +65,36 @@ public:
 	QTime duration;
 	int repeat; // (1 << 0) (monday) | (1 << 1) (tuesday) | ... | (1 << 6) (sunday)
 	Status status; // read-only
+	bool hasConflict; // read-only, no device is available according to the plan
 };
 
+inline QDateTime DvbRecording::nextRepetition(const QDateTime &begin, int duration,
+	int repeat, const QDateTime &currentDateTime)
+{
+	// the next repetition is computed in local time, so that the recording keeps its
+	// local start time across DST switches (see tools/checkrepetitions.cpp)
+	QDateTime beginLocal = begin.toLocalTime();
+	QDateTime endLocal = begin.addSecs(duration).toLocalTime();
+	QDateTime currentDateTimeLocal = currentDateTime.toLocalTime();
+	int days = endLocal.daysTo(currentDateTimeLocal);
+
+	if (endLocal.addDays(days) <= currentDateTimeLocal) {
+		++days;
+	}
+
+	// QDate::dayOfWeek() and our dayOfWeek differ by one
+	int dayOfWeek = ((beginLocal.date().dayOfWeek() - 1 + days) % 7);
+	// rotate the mask so that bit 0 corresponds to 'dayOfWeek'
+	int rotatedRepeat = (((repeat >> dayOfWeek) | (repeat << (7 - dayOfWeek))) &
+		((1 << 7) - 1));
+
+	for (int mask = rotatedRepeat; (mask & 1) == 0; mask >>= 1) {
+		++days;
+	}
+
+	return beginLocal.addDays(days).toUTC();
+}
+
 typedef ExplicitlySharedDataPointer<const DvbRecording> DvbSharedRecording;
 Q_DECLARE_TYPEINFO(DvbSharedRecording, Q_MOVABLE_TYPE);
 
@@ -70,6 +113,17 @@ public:
 	void updateRecording(DvbSharedRecording recording, DvbRecording &modifiedRecording);
 	void removeRecording(DvbSharedRecording recording);
 
+	/*
+	 * read-while-recording: the data up to 'committedSize' can be read from the file; the
+	 * index entries (if requested) are limited to the committed data; returns false if the
+	 * recording isn't running
+	 */
+
+	bool getRecordingProgress(const SqlKey &sqlKey, QString &fileName, qint64 &committedSize,
+		QVector<DvbTsIndexEntry> *indexEntries = NULL) const;
+	// plays the recording from the beginning while it continues
+	bool playRecording(const DvbSharedRecording &recording);
+
 signals:
 	void recordingAdded(const DvbSharedRecording &recording);
 	// updating doesn't change the recording pointer (modifies existing content)
@@ -77,16 +131,35 @@ signals:
 	void recordingUpdated(const DvbSharedRecording &recording);
 	void recordingRemoved(const DvbSharedRecording &recording);
 
+private slots:
+	void checkDeadlines();
+	void updatePlan();
+
 private:
-	void timerEvent(QTimerEvent *event);
+	void scheduleRecording(const DvbRecording &recording);
+	void unscheduleRecording(const SqlKey &sqlKey);
+	void armScheduleTimer();
+	void schedulePlan(const SqlKey &sqlKey); // the recording has been added / changed / removed
 
 	void bindToSqlQuery(SqlKey sqlKey, QSqlQuery &query, int index) const;
 	bool insertFromSqlQuery(SqlKey sqlKey, const QSqlQuery &query, int index);
+	DvbRecordingSplitter *getSplitter(const DvbSharedChannel &channel);
 	bool updateStatus(DvbRecording &recording);
 
 	DvbManager *manager;
 	QMap<SqlKey, DvbSharedRecording> recordings;
 	QMap<SqlKey, QExplicitlySharedDataPointer<DvbRecordingFile> > recordingFiles;
+	QList<DvbRecordingSplitter *> splitters; // one for every transponder with recordings
+	QMultiMap<QDateTime, SqlKey> deadlines; // next start / end / retry --> recording
+	QMap<SqlKey, QDateTime> recordingDeadlines;
+	QTimer scheduleTimer;
+	DvbRecordingPlanner *planner;
+	QTimer planTimer;
+	QSet<SqlKey> changedRecordings; // since the last update of the plan
+	DvbRecordingJournal *journal;
+	DvbRecordingAdmission *admission;
+	QMap<SqlKey, DvbRecordingJournalEntry> resumableRecordings;
+	DvbRecordingTailSource *tailSource;
 	bool hasPendingOperation;
 };
 
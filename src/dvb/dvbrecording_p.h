@@ -22,45 +22,371 @@
 #define DVBRECORDING_P_H
 
 #include <QFile>
+#include <QSet>
 #include <QTimer>
+#include <QUrl>
+#include "../mediawidget.h"
 #include "dvbchannel.h"
+#include "dvbfilewriter.h"
+#include "dvbrecording.h"
 #include "dvbsi.h"
+#include "dvbtsindex.h"
 
+class QSocketNotifier;
 class DvbDevice;
+class DvbDeviceConfig;
 class DvbManager;
-class DvbRecording;
+class DvbRecordingSplitter;
+class DvbRecordingSplitterService;
 
-class DvbRecordingFile : private QObject, public QSharedData, private DvbPidFilter
+class DvbRecordingJournalEntry
 {
-	Q_OBJECT
 public:
-	explicit DvbRecordingFile(DvbManager *manager_);
+	DvbRecordingJournalEntry() : offset(0) { }
+	~DvbRecordingJournalEntry() { }
+
+	QString fileName;
+	QByteArray pmtSectionData;
+	QList<int> pids;
+	qint64 offset; // bytes which have been written completely (without holes)
+	QDateTime lastUpdate; // UTC
+};
+
+/*
+ * append-only log of the active recordings (file name, pmt, pids, offset); the records
+ * are flushed, but not synced; after a crash or a restart the recordings which are still
+ * running continue with the same file
+ */
+
+class DvbRecordingJournal
+{
+public:
+	DvbRecordingJournal() : suspended(false) { }
+	~DvbRecordingJournal() { }
+
+	// returns the recordings which were active in the last session and starts a new journal
+	QMap<SqlKey, DvbRecordingJournalEntry> open(const QString &fileName);
+	void close(); // the active recordings remain in the journal
+	// the recordings which are stopped afterwards remain in the journal (shutdown)
+	void suspend();
+
+	bool isSuspended() const
+	{
+		return suspended;
+	}
+
+	void startRecording(const SqlKey &sqlKey, const QString &fileName);
+	void updatePmt(const SqlKey &sqlKey, const QByteArray &pmtSectionData,
+		const QList<int> &pids);
+	void updateOffset(const SqlKey &sqlKey, qint64 offset);
+	void stopRecording(const SqlKey &sqlKey);
+
+private:
+	Q_DISABLE_COPY(DvbRecordingJournal)
+
+	enum RecordType {
+		StartRecord = 0,
+		PmtRecord = 1,
+		OffsetRecord = 2,
+		StopRecord = 3
+	};
+
+	void beginRecord(QDataStream &stream, RecordType type, const SqlKey &sqlKey);
+	void endRecord();
+
+	QFile file;
+	QSet<quint32> activeRecordings;
+	bool suspended;
+};
+
+/*
+ * projects the space and the write bandwidth which the running recordings need (per
+ * file system); a recording which doesn't fit is redirected to the alternative folder
+ * (if that one fits), otherwise a warning is logged and the recording is started anyway
+ */
+
+class DvbRecordingAdmission
+{
+public:
+	explicit DvbRecordingAdmission(DvbManager *manager_) : manager(manager_) { }
+	~DvbRecordingAdmission() { }
+
+	// returns the folder for a new recording; 'bitRate' in kbit/s
+	QString chooseFolder(int bitRate, const QDateTime &end) const;
+
+	void addRecording(DvbRecordingFile *file);
+	void removeRecording(DvbRecordingFile *file);
+
+private:
+	Q_DISABLE_COPY(DvbRecordingAdmission)
+
+	bool check(const QString &folder, int bitRate, qint64 bytes) const;
+
+	DvbManager *manager;
+	QList<DvbRecordingFile *> files;
+};
+
+class DvbRecordingFile : public QSharedData
+{
+public:
+	DvbRecordingFile(DvbManager *manager_, DvbRecordingJournal *journal_,
+		DvbRecordingAdmission *admission_, const SqlKey &sqlKey_);
 	~DvbRecordingFile();
 
+	// continues an interrupted recording; start() has to be called afterwards
+	bool resume(const DvbRecordingJournalEntry &entry);
 	// start() returns true if the recording is already running
-	bool start(const DvbRecording &recording);
+	bool start(const DvbRecording &recording, DvbRecordingSplitter *splitter_,
+		DvbDevice *plannedDevice);
 	void stop();
 
+	qint64 getStuffingBytes() const // dropped by the compact mode
+	{
+		return stuffingBytes;
+	}
+
+	QString getFileName() const
+	{
+		return file.fileName();
+	}
+
+	bool isOpen() const
+	{
+		return file.isOpen();
+	}
+
+	qint64 getCommittedSize() const
+	{
+		return file.getCommittedSize();
+	}
+
+	const QVector<DvbTsIndexEntry> &getIndexEntries() const // may exceed the committed size
+	{
+		return index.getEntries();
+	}
+
+	quint64 getFileSystemId() const
+	{
+		return fileSystemId;
+	}
+
+	int getBitRate() const; // kbit/s (measured after a while)
+	qint64 getUnreservedBytes() const; // projected bytes which haven't been preallocated
+
+	// called by the splitter
+	void processData(const char data[188]);
+	void setPmt(const QByteArray &pmtSectionData, const QList<int> &pids);
+	void writePatPmt(const QByteArray &pat, const QByteArray &pmt);
+
+private:
+	Q_DISABLE_COPY(DvbRecordingFile)
+
+	void writeData(const QByteArray &data);
+	void admit(); // after the file has been opened
+
+	DvbManager *manager;
+	DvbRecordingJournal *journal;
+	DvbRecordingAdmission *admission;
+	SqlKey sqlKey;
+	QString channelName;
+	QDateTime end;
+	int estimatedBitRate; // kbit/s
+	QElapsedTimer bitRateTimer;
+	qint64 bitRateOffset; // file size when bitRateTimer was started
+	qint64 preallocatedBytes;
+	quint64 fileSystemId;
+	QElapsedTimer journalTimer;
+	DvbRecordingSplitter *splitter;
+	DvbFileWriter file;
+	DvbTsIndex index;
+	QList<QByteArray> buffers;
+	bool pmtValid;
+	bool compact; // drops stuffing packets (the dropped pids aren't filtered at all)
+	qint64 stuffingBytes; // dropped stuffing packets (the dropped pids aren't received)
+};
+
+/*
+ * owns the device for all recordings of a transponder; every packet is dispatched with
+ * a single table lookup to the recordings using its pid, and the pat / pmt packets of a
+ * service are generated once for all of its recordings
+ */
+
+class DvbRecordingSplitter : public QObject, private DvbPidFilter, private DvbSectionFilter
+{
+	Q_OBJECT
+public:
+	DvbRecordingSplitter(DvbManager *manager_, const QString &source_,
+		const DvbTransponder &transponder_);
+	~DvbRecordingSplitter();
+
+	bool matches(const DvbSharedChannel &channel) const;
+	bool hasOutputs() const;
+
+	// plannedDevice is preferred if the device has to be requested (may be NULL)
+	bool addOutput(DvbRecordingFile *output, const DvbSharedChannel &channel,
+		DvbDevice *plannedDevice);
+	void removeOutput(DvbRecordingFile *output);
+
 private slots:
 	void deviceStateChanged();
-	void pmtSectionChanged(const QByteArray &pmtSectionData_);
 	void insertPatPmt();
+	void releaseIdleServices();
 
 private:
 	void processData(const char data[188]);
+	void processSection(const char *data, int size);
+	void pmtSectionChanged(DvbRecordingSplitterService *service,
+		const QByteArray &pmtSectionData);
+	void updatePids();
+	void addFilters();
+	void removeFilters();
 
 	DvbManager *manager;
-	DvbSharedChannel channel;
-	QFile file;
-	QList<QByteArray> buffers;
+	QString source;
+	DvbTransponder transponder;
 	DvbDevice *device;
-	QList<int> pids;
-	DvbPmtFilter pmtFilter;
-	QByteArray pmtSectionData;
-	DvbSectionGenerator patGenerator;
-	DvbSectionGenerator pmtGenerator;
+	// service id --> service; a service without outputs is released asynchronously
+	QMap<int, DvbRecordingSplitterService *> services;
+	QVector<QList<DvbRecordingFile *> > pidOutputs; // pid --> recordings
+	QSet<int> pids;
+	QSet<int> pmtPids;
 	QTimer patPmtTimer;
-	bool pmtValid;
+};
+
+/*
+ * plays a recording while it is being recorded; the file is fed into a pipe up to the
+ * committed size, and the source waits for more data until the recording is finished
+ */
+
+class DvbRecordingTailSource : public QObject, public MediaSource
+{
+	Q_OBJECT
+public:
+	DvbRecordingTailSource(DvbRecordingModel *model_, QObject *parent);
+	~DvbRecordingTailSource();
+
+	bool start(const SqlKey &sqlKey_); // the media widget has to be started afterwards
+	void stop();
+
+	QUrl getUrl() const { return url; }
+	bool hideCurrentTotalTime() const { return true; }
+	void playbackFinished() { stop(); }
+
+	void playbackStatusChanged(MediaWidget::PlaybackStatus status)
+	{
+		if (status == MediaWidget::Idle) {
+			stop();
+		}
+	}
+
+private slots:
+	void feed();
+
+private:
+	enum {
+		BufferSize = (256 * 188)
+	};
+
+	DvbRecordingModel *model;
+	SqlKey sqlKey;
+	QString fileName;
+	QUrl url;
+	int sourceFd;
+	int readFd;
+	int writeFd;
+	QSocketNotifier *notifier;
+	QTimer pollTimer;
+	QByteArray buffer;
+	int bufferOffset;
+	qint64 readOffset;
+	int idlePolls; // after the recording has finished
+};
+
+class DvbRecordingPlannerOccurrence
+{
+public:
+	DvbRecordingPlannerOccurrence() : first(false), tuner(-1) { }
+	~DvbRecordingPlannerOccurrence() { }
+
+	bool operator<(const DvbRecordingPlannerOccurrence &other) const
+	{
+		return (begin < other.begin);
+	}
+
+	DvbSharedRecording recording;
+	QDateTime begin;
+	QDateTime end;
+	bool first; // the occurrence stored in the recording
+	int tuner; // -1 = conflict
+};
+
+class DvbRecordingPlannerTuner
+{
+public:
+	DvbRecordingPlannerTuner() : device(NULL) { }
+	~DvbRecordingPlannerTuner() { }
+
+	bool isBusy(const QDateTime &dateTime) const
+	{
+		return (busyUntil.isValid() && (busyUntil > dateTime));
+	}
+
+	DvbDevice *device;
+	QStringList sources;
+	QString source;
+	DvbTransponder transponder;
+	QDateTime busyUntil; // invalid if the tuner hasn't been used yet
+	QDateTime groupBegin;
+	QList<int> group; // occurrences sharing the current tuning
+};
+
+/*
+ * assigns the devices to the upcoming recordings (including repetitions) ahead of time;
+ * recordings of the same transponder share a device, and a device serving less sources
+ * is preferred, so that the more flexible devices remain available
+ *
+ * the occurrences form groups which overlap in time; the groups are independent of each
+ * other (all devices are free in between), so a change only re-plans the groups which
+ * overlap the old or new occurrences of the changed recordings
+ */
+
+class DvbRecordingPlanner
+{
+public:
+	DvbRecordingPlanner() { }
+	~DvbRecordingPlanner() { }
+
+	// everything is planned again if the devices have changed or the plan is a day old
+	void plan(const QList<DvbDeviceConfig> &deviceConfigs,
+		const QMap<SqlKey, DvbSharedRecording> &recordings,
+		const QSet<SqlKey> &changedRecordings, const QDateTime &currentDateTime);
+
+	// device for the next occurrence of the recording (NULL if there's no plan)
+	DvbDevice *getDevice(const SqlKey &sqlKey) const
+	{
+		return devices.value(sqlKey);
+	}
+
+	// begin of the first occurrence without a device (invalid if there's no conflict)
+	QDateTime getConflict(const SqlKey &sqlKey) const
+	{
+		return conflicts.value(sqlKey);
+	}
+
+private:
+	// appends the occurrences within the window (the first one is always appended)
+	void expand(const DvbSharedRecording &recording,
+		QList<DvbRecordingPlannerOccurrence> &newOccurrences) const;
+	void assign(int first, int last, const QDateTime &currentDateTime); // [first, last)
+	int relocate(const QDateTime &begin, const QString &source,
+		const QDateTime &currentDateTime);
+
+	QList<DvbRecordingPlannerTuner> tuners;
+	QList<DvbRecordingPlannerOccurrence> occurrences; // sorted by begin
+	QDateTime windowBegin;
+	QDateTime windowEnd; // the repetitions are expanded for one week
+	QMap<SqlKey, DvbDevice *> devices;
+	QMap<SqlKey, QDateTime> conflicts;
 };
 
 #endif /* DVBRECORDING_P_H */
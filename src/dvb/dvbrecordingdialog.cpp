@@ -23,17 +23,21 @@
 
 #include <QBoxLayout>
 #include <QCheckBox>
+#include <QFileInfo>
 #include <QHeaderView>
 #include <QLabel>
 #include <QPushButton>
+#include <QTreeWidget>
 #include <KAction>
 #include <KCalendarSystem>
 #include <KComboBox>
 #include <KLineEdit>
+#include <KMessageBox>
 #include "../datetimeedit.h"
 #include "../log.h"
 #include "dvbchanneldialog.h"
 #include "dvbmanager.h"
+#include "dvbrecordingscanner.h"
 
 DvbRecordingDialog::DvbRecordingDialog(DvbManager *manager_, QWidget *parent) : KDialog(parent),
 	manager(manager_)
@@ -74,11 +78,54 @@ DvbRecordingDialog::DvbRecordingDialog(DvbManager *manager_, QWidget *parent) :
 	pushButton = new QPushButton(action->icon(), action->text(), widget);
 	connect(pushButton, SIGNAL(clicked()), this, SLOT(removeRecording()));
 	boxLayout->addWidget(pushButton);
+
+	playAction = new KAction(KIcon(QLatin1String("media-playback-start")),
+		i18nc("@action", "Play"), widget);
+	connect(playAction, SIGNAL(triggered()), this, SLOT(playRecording()));
+	treeView->addAction(playAction);
+	playButton = new QPushButton(playAction->icon(), playAction->text(), widget);
+	connect(playButton, SIGNAL(clicked()), this, SLOT(playRecording()));
+	boxLayout->addWidget(playButton);
 	boxLayout->addStretch();
 
+	// the status of the current recording changes while the dialog is shown
+	connect(treeView->selectionModel(), SIGNAL(currentChanged(QModelIndex,QModelIndex)),
+		this, SLOT(updatePlayAction()));
+	connect(model, SIGNAL(dataChanged(QModelIndex,QModelIndex)),
+		this, SLOT(updatePlayAction()));
+	connect(model, SIGNAL(layoutChanged()), this, SLOT(updatePlayAction()));
+	connect(model, SIGNAL(rowsRemoved(QModelIndex,int,int)), this, SLOT(updatePlayAction()));
+	updatePlayAction();
+
+	// statistics of the finished recordings (see DvbRecordingScanner)
+	statisticsView = new QTreeWidget(widget);
+	statisticsView->setColumnCount(7);
+	statisticsView->setHeaderLabels(QStringList() << i18nc("@title:column", "File") <<
+		i18nc("@title:column", "Duration") << i18nc("@title:column", "Bit Rate (kbit/s)") <<
+		i18nc("@title:column", "CC Errors") << i18nc("@title:column", "PCR Jumps") <<
+		i18nc("@title:column", "Scrambled Packets") << i18nc("@title:column", "Missing PIDs"));
+	statisticsView->header()->setResizeMode(QHeaderView::ResizeToContents);
+	statisticsView->setContextMenuPolicy(Qt::ActionsContextMenu);
+	statisticsView->setRootIsDecorated(false);
+	statisticsView->sortByColumn(0, Qt::AscendingOrder);
+	statisticsView->setSortingEnabled(true);
+	connect(manager->getRecordingScanner(), SIGNAL(statisticsUpdated()),
+		this, SLOT(updateStatistics()));
+	connect(manager->getRecordingScanner(), SIGNAL(fileTrimmed(QString,bool)),
+		this, SLOT(fileTrimmed(QString,bool)));
+	updateStatistics();
+
+	// removes the margins (see DvbManager::getBeginMargin()) without re-encoding
+	action = new KAction(KIcon(QLatin1String("edit-cut")), i18nc("@action", "Trim Margins"),
+		widget);
+	connect(action, SIGNAL(triggered()), this, SLOT(trimFile()));
+	statisticsView->addAction(action);
+
 	QBoxLayout *mainLayout = new QVBoxLayout(widget);
 	mainLayout->addLayout(boxLayout);
 	mainLayout->addWidget(treeView);
+	mainLayout->addWidget(new QLabel(i18nc("@label", "Recorded files:"), widget));
+	mainLayout->addWidget(statisticsView);
 	setMainWidget(widget);
 	resize(100 * fontMetrics().averageCharWidth(), 20 * fontMetrics().height());
 }
@@ -130,6 +177,102 @@ void DvbRecordingDialog::removeRecording()
 	}
 }
 
+void DvbRecordingDialog::playRecording()
+{
+	QModelIndex index = treeView->currentIndex();
+
+	if (!index.isValid()) {
+		return;
+	}
+
+	DvbSharedRecording recording = model->value(index);
+
+	if (recording->status != DvbRecording::Recording) {
+		return;
+	}
+
+	// the recording is played from the beginning while it continues
+	if (manager->getRecordingModel()->playRecording(recording)) {
+		accept();
+	}
+}
+
+void DvbRecordingDialog::updatePlayAction()
+{
+	DvbSharedRecording recording = model->value(treeView->currentIndex());
+	bool enabled = (recording.isValid() && (recording->status == DvbRecording::Recording));
+
+	playAction->setEnabled(enabled);
+	playButton->setEnabled(enabled);
+}
+
+void DvbRecordingDialog::updateStatistics()
+{
+	statisticsView->clear();
+
+	foreach (const DvbRecordingStatistics &statistics,
+		 manager->getRecordingScanner()->getStatistics()) {
+		QString bitRate;
+
+		if (statistics.duration > 0) {
+			// average (minimum - maximum of the minutes)
+			bitRate = QString::number((statistics.size * 8) / statistics.duration);
+
+			if (!statistics.bitRates.isEmpty()) {
+				QList<int> bitRates = statistics.bitRates;
+				qSort(bitRates);
+				bitRate += QLatin1String(" (") + QString::number(bitRates.first()) +
+					QLatin1String(" - ") + QString::number(bitRates.last()) +
+					QLatin1Char(')');
+			}
+		}
+
+		QStringList missingPids;
+
+		foreach (int pid, statistics.missingPids) {
+			missingPids.append(QString::number(pid));
+		}
+
+		QStringList stringList;
+		stringList << statistics.fileName <<
+			QTime(0, 0).addMSecs(int(statistics.duration)).toString() << bitRate <<
+			QString::number(statistics.ccErrors) << QString::number(statistics.pcrJumps) <<
+			QString::number(statistics.scrambledPackets) <<
+			missingPids.join(QLatin1String(", "));
+		statisticsView->addTopLevelItem(new QTreeWidgetItem(stringList));
+	}
+}
+
+void DvbRecordingDialog::trimFile()
+{
+	QTreeWidgetItem *item = statisticsView->currentItem();
+
+	if (item == NULL) {
+		return;
+	}
+
+	QString fileName = item->text(0);
+	QFileInfo fileInfo(fileName);
+	QString targetFileName = fileInfo.path() + QLatin1Char('/') + fileInfo.completeBaseName() +
+		QLatin1String("-trimmed");
+
+	if (!fileInfo.suffix().isEmpty()) {
+		targetFileName += QLatin1Char('.') + fileInfo.suffix();
+	}
+
+	// the copy appears in the list once it has been written and scanned
+	manager->getRecordingScanner()->trimFile(fileName, targetFileName,
+		qint64(manager->getBeginMargin()) * 1000, qint64(manager->getEndMargin()) * 1000);
+}
+
+void DvbRecordingDialog::fileTrimmed(const QString &targetFileName, bool success)
+{
+	if (!success) {
+		KMessageBox::sorry(this, i18nc("@info", "Cannot write <filename>%1</filename>.",
+			targetFileName));
+	}
+}
+
 void DvbRecordingLessThan::setSortOrder(SortOrder sortOrder_)
 {
 	for (int index = 0; index < 4; ++index) {
@@ -260,6 +403,10 @@ QVariant DvbRecordingTableModel::data(const QModelIndex &index, int role) const
 			if (index.column() == 0) {
 				switch (recording->status) {
 				case DvbRecording::Inactive:
+					if (recording->hasConflict) {
+						return KIcon(QLatin1String("dialog-warning"));
+					}
+
 					break;
 				case DvbRecording::Recording:
 					return KIcon(QLatin1String("media-record"));
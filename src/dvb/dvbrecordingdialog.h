@@ -23,7 +23,10 @@
 
 #include <KDialog>
 
+class QPushButton;
 class QTreeView;
+class QTreeWidget;
+class KAction;
 class DvbManager;
 class DvbRecordingTableModel;
 
@@ -40,11 +43,19 @@ private slots:
 	void newRecording();
 	void editRecording();
 	void removeRecording();
+	void playRecording(); // only running recordings
+	void updatePlayAction();
+	void updateStatistics();
+	void trimFile();
+	void fileTrimmed(const QString &targetFileName, bool success);
 
 private:
 	DvbManager *manager;
 	DvbRecordingTableModel *model;
 	QTreeView *treeView;
+	QTreeWidget *statisticsView;
+	KAction *playAction;
+	QPushButton *playButton;
 };
 
 #endif /* DVBRECORDINGDIALOG_H */
@@ -0,0 +1,649 @@
+/*
+ * dvbrecordingscanner.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbrecordingscanner.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QFile>
+#include <QMutex>
+#include <QRunnable>
+#include <QSqlQuery>
+#include <QThread>
+#include <QVariant>
+#include <QVector>
+#include <fcntl.h>
+#include <sys/stat.h> // bsd compatibility
+#include <sys/types.h> // bsd compatibility
+#include <unistd.h>
+#include "../log.h"
+#include "dvbsi.h"
+#include "dvbtscutter.h"
+#include "dvbtsindex.h"
+
+class DvbRecordingScanPid
+{
+public:
+	DvbRecordingScanPid() : packets(0), firstCc(-1), lastCc(-1), firstCcDiscontinuity(false),
+		firstPcr(-1), lastPcr(-1), firstPcrDiscontinuity(false), lastSamplePcr(-1) { }
+	~DvbRecordingScanPid() { }
+
+	qint64 packets;
+	int firstCc; // only packets with payload
+	int lastCc;
+	bool firstCcDiscontinuity;
+	qint64 firstPcr;
+	qint64 lastPcr;
+	bool firstPcrDiscontinuity;
+	qint64 lastSamplePcr;
+};
+
+class DvbRecordingScanSample
+{
+public:
+	qint64 offset;
+	qint64 pcr;
+	int pid;
+};
+
+Q_DECLARE_TYPEINFO(DvbRecordingScanSample, Q_PRIMITIVE_TYPE);
+
+// statistics of a chunk; the transitions between the chunks are checked when merging
+
+class DvbRecordingScanResult
+{
+public:
+	DvbRecordingScanResult() : ccErrors(0), pcrJumps(0), scrambledPackets(0) { }
+	~DvbRecordingScanResult() { }
+
+	QMap<int, DvbRecordingScanPid> pids;
+	QVector<DvbRecordingScanSample> samples; // about one pcr per second
+	QByteArray pmtPacket; // only the first chunk
+	qint64 ccErrors;
+	qint64 pcrJumps;
+	qint64 scrambledPackets;
+};
+
+class DvbRecordingScanJob
+{
+public:
+	DvbRecordingScanJob() : size(0), remainingChunks(0) { }
+	~DvbRecordingScanJob() { }
+
+	QString fileName;
+	qint64 size;
+	QVector<DvbRecordingScanResult> results; // one for every chunk
+	QMutex mutex;
+	int remainingChunks;
+};
+
+class DvbRecordingTrimJob : public QRunnable
+{
+public:
+	DvbRecordingTrimJob(DvbRecordingScanner *scanner_, const QAtomicInt *aborted_) :
+		scanner(scanner_), aborted(aborted_), begin(0), end(0), finished(false),
+		success(false)
+	{
+		setAutoDelete(false); // deleted by the scanner
+	}
+
+	~DvbRecordingTrimJob() { }
+
+	void run();
+
+	DvbRecordingScanner *scanner;
+	const QAtomicInt *aborted;
+	QString fileName;
+	QString targetFileName;
+	qint64 begin; // milliseconds
+	qint64 end; // milliseconds
+	QMutex mutex;
+	bool finished;
+	bool success;
+};
+
+void DvbRecordingTrimJob::run()
+{
+	QThread::currentThread()->setPriority(QThread::IdlePriority);
+	DvbTsCutter cutter;
+	cutter.setAbortFlag(aborted);
+	bool result = cutter.trim(fileName, targetFileName, begin, end);
+
+	QMutexLocker locker(&mutex);
+	finished = true;
+	success = result;
+	QCoreApplication::postEvent(scanner, new QEvent(QEvent::User));
+}
+
+static bool isPcrJump(qint64 lastPcr, qint64 pcr)
+{
+	// the pcr has to be transmitted at least every 100 ms
+	return (((pcr - lastPcr) & (DvbTsPacket::TimestampWrap - 1)) > 90000);
+}
+
+class DvbRecordingScanChunk : public QRunnable
+{
+public:
+	DvbRecordingScanChunk(DvbRecordingScanner *scanner_, const QAtomicInt *aborted_,
+		DvbRecordingScanJob *job_, int index_, qint64 offset_, qint64 size_) :
+		scanner(scanner_), aborted(aborted_), job(job_), index(index_), offset(offset_),
+		size(size_), pmtPid(-1) { }
+	~DvbRecordingScanChunk() { }
+
+	void run();
+
+private:
+	void processPacket(const char *packet, qint64 packetOffset, DvbRecordingScanResult &result);
+
+	DvbRecordingScanner *scanner;
+	const QAtomicInt *aborted;
+	DvbRecordingScanJob *job;
+	int index;
+	qint64 offset;
+	qint64 size;
+	int pmtPid;
+};
+
+void DvbRecordingScanChunk::run()
+{
+	// SCHED_IDLE on linux; the live recordings come first
+	QThread::currentThread()->setPriority(QThread::IdlePriority);
+	DvbRecordingScanResult result;
+	int fd = open(QFile::encodeName(job->fileName).constData(), O_RDONLY);
+
+	if (fd >= 0) {
+		QByteArray buffer(1024 * 188, Qt::Uninitialized);
+		qint64 position = offset;
+
+		while (position < (offset + size)) {
+			if (aborted->load() != 0) {
+				close(fd);
+				return;
+			}
+
+			int bytes = int(qMin(qint64(buffer.size()), offset + size - position));
+			ssize_t bytesRead = pread(fd, buffer.data(), bytes, position);
+
+			if (bytesRead < 188) {
+				break;
+			}
+
+			for (int i = 0; (i + 188) <= bytesRead; i += 188) {
+				processPacket(buffer.constData() + i, position + i, result);
+			}
+
+			position += ((bytesRead / 188) * 188);
+		}
+
+		close(fd);
+	}
+
+	QMutexLocker locker(&job->mutex);
+	job->results[index] = result;
+
+	if (--job->remainingChunks == 0) {
+		QCoreApplication::postEvent(scanner, new QEvent(QEvent::User));
+	}
+}
+
+void DvbRecordingScanChunk::processPacket(const char *packet, qint64 packetOffset,
+	DvbRecordingScanResult &result)
+{
+	DvbTsPacket tsPacket(packet);
+	int pid = tsPacket.pid();
+
+	if ((packet[0] != 0x47) || (pid == 0x1fff)) {
+		return;
+	}
+
+	DvbRecordingScanPid &state = result.pids[pid];
+	++state.packets;
+
+	if (tsPacket.isScrambled()) {
+		++result.scrambledPackets;
+	}
+
+	bool discontinuity = tsPacket.isDiscontinuous();
+
+	if (tsPacket.hasPayload()) {
+		int continuityCounter = tsPacket.continuityCounter();
+
+		if (state.firstCc < 0) {
+			state.firstCc = continuityCounter;
+			state.firstCcDiscontinuity = discontinuity;
+		} else if (!discontinuity && (continuityCounter != ((state.lastCc + 1) & 0x0f)) &&
+			   (continuityCounter != state.lastCc)) {
+			// a packet may be sent twice (same counter)
+			++result.ccErrors;
+		}
+
+		state.lastCc = continuityCounter;
+	}
+
+	qint64 pcr;
+
+	if (tsPacket.getPcr(pcr)) {
+		bool jump = false;
+
+		if (state.firstPcr < 0) {
+			state.firstPcr = pcr;
+			state.firstPcrDiscontinuity = discontinuity;
+		} else if (!discontinuity && isPcrJump(state.lastPcr, pcr)) {
+			++result.pcrJumps;
+			jump = true;
+		}
+
+		state.lastPcr = pcr;
+
+		if ((state.lastSamplePcr < 0) || jump ||
+		    (((pcr - state.lastSamplePcr) & (DvbTsPacket::TimestampWrap - 1)) >= 90000)) {
+			DvbRecordingScanSample sample;
+			sample.offset = packetOffset;
+			sample.pcr = pcr;
+			sample.pid = pid;
+			result.samples.append(sample);
+			state.lastSamplePcr = pcr;
+		}
+	}
+
+	if ((index != 0) || !tsPacket.payloadUnitStart() || !result.pmtPacket.isEmpty()) {
+		return;
+	}
+
+	// the recordings start with the (regenerated) pat / pmt
+
+	if ((pid == 0) && (pmtPid < 0)) {
+		const unsigned char *data = reinterpret_cast<const unsigned char *>(packet);
+		int sectionOffset = tsPacket.payloadOffset();
+
+		if (sectionOffset < 188) {
+			sectionOffset += (1 + data[sectionOffset]);
+		}
+
+		if ((sectionOffset + 12) <= 188) {
+			int programNumber = ((data[sectionOffset + 8] << 8) | data[sectionOffset + 9]);
+
+			if (programNumber != 0) {
+				pmtPid = (((data[sectionOffset + 10] & 0x1f) << 8) | data[sectionOffset + 11]);
+			}
+		}
+	} else if (pid == pmtPid) {
+		result.pmtPacket = QByteArray(packet, 188);
+	}
+}
+
+DvbRecordingScanner::DvbRecordingScanner(QObject *parent) : QObject(parent), aborted(0)
+{
+	threadPool.setMaxThreadCount(MaxThreads);
+	pendingTimer.setSingleShot(true);
+	connect(&pendingTimer, SIGNAL(timeout()), this, SLOT(startScans()));
+	sqlInit(QLatin1String("RecordingStatistics"),
+		QStringList() << QLatin1String("FileName") << QLatin1String("Duration") <<
+		QLatin1String("Size") << QLatin1String("BitRates") << QLatin1String("CcErrors") <<
+		QLatin1String("PcrJumps") << QLatin1String("ScrambledPackets") <<
+		QLatin1String("MissingPids"));
+}
+
+DvbRecordingScanner::~DvbRecordingScanner()
+{
+	// the statistics of the unfinished files are lost (the files aren't scanned again)
+	aborted.store(1);
+	threadPool.clear();
+	threadPool.waitForDone();
+	qDeleteAll(jobs);
+	qDeleteAll(trimJobs);
+	sqlFlush();
+}
+
+void DvbRecordingScanner::scanFile(const QString &fileName)
+{
+	if (!pendingFiles.contains(fileName)) {
+		pendingFiles.append(fileName);
+	}
+
+	// the writer thread needs some time to write the remaining blocks
+	pendingTimer.start(10000);
+}
+
+QList<DvbRecordingStatistics> DvbRecordingScanner::getStatistics() const
+{
+	return statistics.values();
+}
+
+void DvbRecordingScanner::startScans()
+{
+	foreach (const QString &fileName, pendingFiles) {
+		struct stat buf;
+
+		if (stat(QFile::encodeName(fileName).constData(), &buf) != 0) {
+			Log("DvbRecordingScanner::startScans: cannot find file") << fileName;
+			continue;
+		}
+
+		DvbRecordingScanJob *job = new DvbRecordingScanJob();
+		job->fileName = fileName;
+		job->size = ((qint64(buf.st_size) / 188) * 188);
+		int chunkCount = int(qMax((job->size + ChunkSize - 1) / ChunkSize, Q_INT64_C(1)));
+		job->results.resize(chunkCount);
+		job->remainingChunks = chunkCount;
+		jobs.append(job);
+
+		for (int i = 0; i < chunkCount; ++i) {
+			qint64 offset = (qint64(i) * ChunkSize);
+			threadPool.start(new DvbRecordingScanChunk(this, &aborted, job, i, offset,
+				qMin(qint64(ChunkSize), job->size - offset)));
+		}
+	}
+
+	pendingFiles.clear();
+}
+
+void DvbRecordingScanner::trimFile(const QString &fileName, const QString &targetFileName,
+	qint64 begin, qint64 end)
+{
+	DvbRecordingTrimJob *trimJob = new DvbRecordingTrimJob(this, &aborted);
+	trimJob->fileName = fileName;
+	trimJob->targetFileName = targetFileName;
+	trimJob->begin = begin;
+	trimJob->end = end;
+	trimJobs.append(trimJob);
+	threadPool.start(trimJob);
+}
+
+void DvbRecordingScanner::customEvent(QEvent *event)
+{
+	Q_UNUSED(event)
+
+	for (int i = 0; i < trimJobs.size(); ++i) {
+		DvbRecordingTrimJob *trimJob = trimJobs.at(i);
+		trimJob->mutex.lock();
+		bool finished = trimJob->finished;
+		bool success = trimJob->success;
+		trimJob->mutex.unlock();
+
+		if (!finished) {
+			continue;
+		}
+
+		trimJobs.removeAt(i);
+		--i;
+
+		if (success) {
+			Log("DvbRecordingScanner::customEvent: trimmed file") << trimJob->targetFileName;
+			scanFile(trimJob->targetFileName);
+		} else {
+			Log("DvbRecordingScanner::customEvent: cannot trim file") << trimJob->fileName;
+		}
+
+		emit fileTrimmed(trimJob->targetFileName, success);
+		delete trimJob;
+	}
+
+	for (int i = 0; i < jobs.size(); ++i) {
+		DvbRecordingScanJob *job = jobs.at(i);
+		job->mutex.lock();
+		bool finished = (job->remainingChunks == 0);
+		job->mutex.unlock();
+
+		if (!finished) {
+			continue;
+		}
+
+		jobs.removeAt(i);
+		--i;
+
+		DvbRecordingStatistics newStatistics;
+		newStatistics.fileName = job->fileName;
+		newStatistics.size = job->size;
+		QMap<int, DvbRecordingScanPid> pids;
+		QMap<int, int> sampleCounts;
+
+		foreach (const DvbRecordingScanResult &result, job->results) {
+			newStatistics.ccErrors += result.ccErrors;
+			newStatistics.pcrJumps += result.pcrJumps;
+			newStatistics.scrambledPackets += result.scrambledPackets;
+
+			for (QMap<int, DvbRecordingScanPid>::const_iterator it = result.pids.constBegin();
+			     it != result.pids.constEnd(); ++it) {
+				const DvbRecordingScanPid &state = *it;
+
+				if (!pids.contains(it.key())) {
+					pids.insert(it.key(), state);
+					continue;
+				}
+
+				// check the transition from the previous chunk
+				DvbRecordingScanPid &mergedState = pids[it.key()];
+				mergedState.packets += state.packets;
+
+				if (state.firstCc >= 0) {
+					if ((mergedState.lastCc >= 0) && !state.firstCcDiscontinuity &&
+					    (state.firstCc != ((mergedState.lastCc + 1) & 0x0f)) &&
+					    (state.firstCc != mergedState.lastCc)) {
+						++newStatistics.ccErrors;
+					}
+
+					mergedState.lastCc = state.lastCc;
+				}
+
+				if (state.firstPcr >= 0) {
+					if ((mergedState.lastPcr >= 0) && !state.firstPcrDiscontinuity &&
+					    isPcrJump(mergedState.lastPcr, state.firstPcr)) {
+						++newStatistics.pcrJumps;
+					}
+
+					mergedState.lastPcr = state.lastPcr;
+				}
+			}
+
+			foreach (const DvbRecordingScanSample &sample, result.samples) {
+				++sampleCounts[sample.pid];
+			}
+		}
+
+		// duration and bit rate profile (per minute) based on the main pcr pid
+		int pcrPid = -1;
+
+		for (QMap<int, int>::const_iterator it = sampleCounts.constBegin();
+		     it != sampleCounts.constEnd(); ++it) {
+			if ((pcrPid < 0) || (*it > sampleCounts.value(pcrPid))) {
+				pcrPid = it.key();
+			}
+		}
+
+		QVector<qint64> minuteBytes;
+		QVector<qint64> minuteTicks;
+		qint64 ticks = 0;
+		bool hasPreviousSample = false;
+		DvbRecordingScanSample previousSample;
+
+		foreach (const DvbRecordingScanResult &result, job->results) {
+			foreach (const DvbRecordingScanSample &sample, result.samples) {
+				if (sample.pid != pcrPid) {
+					continue;
+				}
+
+				if (hasPreviousSample && !isPcrJump(previousSample.pcr, sample.pcr) &&
+				    (sample.pcr != previousSample.pcr)) {
+					int minute = int(ticks / (60 * 90000));
+
+					if (minute >= minuteBytes.size()) {
+						minuteBytes.resize(minute + 1);
+						minuteTicks.resize(minute + 1);
+					}
+
+					qint64 deltaTicks =
+						((sample.pcr - previousSample.pcr) & (DvbTsPacket::TimestampWrap - 1));
+					minuteBytes[minute] += (sample.offset - previousSample.offset);
+					minuteTicks[minute] += deltaTicks;
+					ticks += deltaTicks;
+				}
+
+				previousSample = sample;
+				hasPreviousSample = true;
+			}
+		}
+
+		newStatistics.duration = (ticks / 90);
+
+		for (int j = 0; j < minuteBytes.size(); ++j) {
+			// bytes * 8 / (ticks / 90) = kbit/s
+			newStatistics.bitRates.append((minuteTicks.at(j) > 0) ?
+				int((minuteBytes.at(j) * 8 * 90) / minuteTicks.at(j)) : 0);
+		}
+
+		// the pids of the pmt which never appeared
+		const QByteArray &pmtPacket = job->results.at(0).pmtPacket;
+
+		if (pmtPacket.size() == 188) {
+			const unsigned char *data =
+				reinterpret_cast<const unsigned char *>(pmtPacket.constData());
+			int sectionOffset = DvbTsPacket(pmtPacket.constData()).payloadOffset();
+
+			if (sectionOffset < 188) {
+				sectionOffset += (1 + data[sectionOffset]);
+			}
+
+			if ((sectionOffset + 3) <= 188) {
+				int sectionSize =
+					(3 + (((data[sectionOffset + 1] & 0x0f) << 8) | data[sectionOffset + 2]));
+
+				if ((sectionOffset + sectionSize) <= 188) {
+					DvbPmtSection pmtSection(pmtPacket.constData() + sectionOffset,
+						sectionSize);
+
+					if (pmtSection.isValid()) {
+						DvbPmtParser pmtParser(pmtSection);
+						QList<int> expectedPids;
+
+						if (pmtParser.videoPid >= 0) {
+							expectedPids.append(pmtParser.videoPid);
+						}
+
+						for (int j = 0; j < pmtParser.audioPids.size(); ++j) {
+							expectedPids.append(pmtParser.audioPids.at(j).first);
+						}
+
+						for (int j = 0; j < pmtParser.subtitlePids.size(); ++j) {
+							expectedPids.append(pmtParser.subtitlePids.at(j).first);
+						}
+
+						if (pmtParser.teletextPid >= 0) {
+							expectedPids.append(pmtParser.teletextPid);
+						}
+
+						foreach (int pid, expectedPids) {
+							if (pids.value(pid).packets == 0) {
+								newStatistics.missingPids.append(pid);
+							}
+						}
+					}
+				}
+			}
+		}
+
+		delete job;
+
+		// a file which is scanned again replaces the old statistics
+		SqlKey sqlKey;
+
+		foreach (const DvbRecordingStatistics &oldStatistics, statistics) {
+			if (oldStatistics.fileName == newStatistics.fileName) {
+				sqlKey = oldStatistics;
+				break;
+			}
+		}
+
+		if (sqlKey.isSqlKeyValid()) {
+			newStatistics.setSqlKey(sqlKey);
+			statistics.insert(sqlKey, newStatistics);
+			sqlUpdate(sqlKey);
+		} else {
+			newStatistics.setSqlKey(sqlFindFreeKey(statistics));
+			statistics.insert(newStatistics, newStatistics);
+			sqlInsert(newStatistics);
+		}
+
+		Log("DvbRecordingScanner::customEvent: scanned file (cc errors / pcr jumps)") <<
+			newStatistics.ccErrors << newStatistics.pcrJumps << newStatistics.fileName;
+		emit statisticsUpdated();
+	}
+}
+
+void DvbRecordingScanner::bindToSqlQuery(SqlKey sqlKey, QSqlQuery &query, int index) const
+{
+	QMap<SqlKey, DvbRecordingStatistics>::const_iterator it = statistics.constFind(sqlKey);
+
+	if (it == statistics.constEnd()) {
+		Log("DvbRecordingScanner::bindToSqlQuery: invalid statistics");
+		return;
+	}
+
+	QStringList bitRates;
+
+	foreach (int bitRate, it->bitRates) {
+		bitRates.append(QString::number(bitRate));
+	}
+
+	QStringList missingPids;
+
+	foreach (int pid, it->missingPids) {
+		missingPids.append(QString::number(pid));
+	}
+
+	query.bindValue(index++, it->fileName);
+	query.bindValue(index++, it->duration);
+	query.bindValue(index++, it->size);
+	query.bindValue(index++, bitRates.join(QLatin1String(",")));
+	query.bindValue(index++, it->ccErrors);
+	query.bindValue(index++, it->pcrJumps);
+	query.bindValue(index++, it->scrambledPackets);
+	query.bindValue(index++, missingPids.join(QLatin1String(",")));
+}
+
+bool DvbRecordingScanner::insertFromSqlQuery(SqlKey sqlKey, const QSqlQuery &query, int index)
+{
+	DvbRecordingStatistics newStatistics;
+	newStatistics.fileName = query.value(index++).toString();
+	newStatistics.duration = query.value(index++).toLongLong();
+	newStatistics.size = query.value(index++).toLongLong();
+
+	foreach (const QString &bitRate,
+		 query.value(index++).toString().split(QLatin1Char(','), QString::SkipEmptyParts)) {
+		newStatistics.bitRates.append(bitRate.toInt());
+	}
+
+	newStatistics.ccErrors = query.value(index++).toLongLong();
+	newStatistics.pcrJumps = query.value(index++).toLongLong();
+	newStatistics.scrambledPackets = query.value(index++).toLongLong();
+
+	foreach (const QString &pid,
+		 query.value(index++).toString().split(QLatin1Char(','), QString::SkipEmptyParts)) {
+		newStatistics.missingPids.append(pid.toInt());
+	}
+
+	if (newStatistics.fileName.isEmpty()) {
+		return false;
+	}
+
+	newStatistics.setSqlKey(sqlKey);
+	statistics.insert(sqlKey, newStatistics);
+	return true;
+}
@@ -0,0 +1,98 @@
+/*
+ * dvbrecordingscanner.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBRECORDINGSCANNER_H
+#define DVBRECORDINGSCANNER_H
+
+#include <QAtomicInt>
+#include <QMap>
+#include <QStringList>
+#include <QThreadPool>
+#include <QTimer>
+#include "../sqlinterface.h"
+
+class DvbRecordingScanJob;
+class DvbRecordingTrimJob;
+
+class DvbRecordingStatistics : public SqlKey
+{
+public:
+	DvbRecordingStatistics() : duration(0), size(0), ccErrors(0), pcrJumps(0),
+		scrambledPackets(0) { }
+	~DvbRecordingStatistics() { }
+
+	QString fileName;
+	qint64 duration; // milliseconds (pcr based)
+	qint64 size; // bytes
+	QList<int> bitRates; // kbit/s for every minute
+	qint64 ccErrors;
+	qint64 pcrJumps;
+	qint64 scrambledPackets;
+	QList<int> missingPids; // listed in the pmt, but not present
+};
+
+/*
+ * scans finished recordings in the background (the chunks of the files are distributed
+ * over a few idle priority threads, so that the running recordings aren't slowed down)
+ * and stores the statistics in the database
+ */
+
+class DvbRecordingScanner : public QObject, private SqlInterface
+{
+	Q_OBJECT
+public:
+	explicit DvbRecordingScanner(QObject *parent);
+	~DvbRecordingScanner();
+
+	void scanFile(const QString &fileName); // a while later (the file may still be written)
+	QList<DvbRecordingStatistics> getStatistics() const;
+
+	// writes a copy without the first 'begin' and the last 'end' milliseconds (cut at
+	// key frames, see DvbTsCutter); the copy is scanned afterwards
+	void trimFile(const QString &fileName, const QString &targetFileName, qint64 begin,
+		qint64 end);
+
+signals:
+	void statisticsUpdated();
+	void fileTrimmed(const QString &targetFileName, bool success);
+
+private slots:
+	void startScans();
+
+private:
+	enum {
+		ChunkSize = (64 << 20), // multiple of 188
+		MaxThreads = 2
+	};
+
+	void customEvent(QEvent *event);
+	void bindToSqlQuery(SqlKey sqlKey, QSqlQuery &query, int index) const;
+	bool insertFromSqlQuery(SqlKey sqlKey, const QSqlQuery &query, int index);
+
+	QMap<SqlKey, DvbRecordingStatistics> statistics;
+	QStringList pendingFiles;
+	QTimer pendingTimer;
+	QThreadPool threadPool;
+	QAtomicInt aborted; // the running chunk stops at the next read
+	QList<DvbRecordingScanJob *> jobs;
+	QList<DvbRecordingTrimJob *> trimJobs;
+};
+
+#endif /* DVBRECORDINGSCANNER_H */
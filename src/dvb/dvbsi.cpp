@@ -1142,7 +1142,8 @@ void DvbSectionGenerator::endSection(int sectionLength, int pid)
 	versionNumber = (versionNumber + 1) & 0x1f;
 }
 
-DvbPmtParser::DvbPmtParser(const DvbPmtSection &section) : videoPid(-1), teletextPid(-1)
+DvbPmtParser::DvbPmtParser(const DvbPmtSection &section) : videoPid(-1), videoStreamType(-1),
+	teletextPid(-1)
 {
 	for (DvbPmtSectionEntry entry = section.entries(); entry.isValid(); entry.advance()) {
 		QString streamLanguage;
@@ -1207,6 +1208,7 @@ DvbPmtParser::DvbPmtParser(const DvbPmtSection &section) : videoPid(-1), teletex
 		case 0x1b: // H264 video
 			if (videoPid < 0) {
 				videoPid = entry.pid();
+				videoStreamType = entry.streamType();
 			} else {
 				Log("DvbPmtParser::DvbPmtParser: more than one video pid");
 			}
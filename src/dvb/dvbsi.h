@@ -313,6 +313,7 @@ public:
 	~DvbPmtParser() { }
 
 	int videoPid;
+	int videoStreamType;
 	QList<QPair<int, QString> > audioPids; // QString = language code (may be empty)
 	QList<QPair<int, QString> > subtitlePids; // QString = language code
 	int teletextPid;
@@ -732,6 +733,11 @@ public:
 		initEitSectionEntry(getData() + getLength(), getSize() - getLength());
 	}
 
+	int eventId() const
+	{
+		return (at(0) << 8) | at(1);
+	}
+
 	int startDate() const
 	{
 		return (at(2) << 8) | at(3);
@@ -948,6 +954,11 @@ public:
 		return (at(3) << 8) | at(4);
 	}
 
+	int pcrPid() const
+	{
+		return ((at(8) & 0x1f) << 8) | at(9);
+	}
+
 	DvbDescriptor descriptors() const
 	{
 		return DvbDescriptor(getData() + 12, descriptorsLength);
@@ -1025,6 +1036,16 @@ public:
 		return (at(10) << 8) | at(11);
 	}
 
+	int segmentLastSectionNumber() const
+	{
+		return at(12);
+	}
+
+	int lastTableId() const
+	{
+		return at(13);
+	}
+
 	DvbEitSectionEntry entries() const
 	{
 		return DvbEitSectionEntry(getData() + 14, getLength() - 18);
@@ -0,0 +1,393 @@
+/*
+ * dvbtscutter.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbtscutter.h"
+
+#include <QFile>
+#include <errno.h>
+#include <fcntl.h>
+#include <string.h>
+#include <sys/stat.h> // bsd compatibility
+#include <sys/syscall.h>
+#include <sys/types.h> // bsd compatibility
+#include <unistd.h>
+#include "../log.h"
+
+bool DvbTsCutter::cut(const QString &sourceFileName, const QString &targetFileName,
+	const QList<QPair<qint64, qint64> > &ranges)
+{
+	copiedBytes = 0;
+	insertedBytes = 0;
+
+	if (!index.load(DvbTsIndex::sidecarFileName(sourceFileName))) {
+		Log("DvbTsCutter::cut: cannot load index") << sourceFileName;
+		return false;
+	}
+
+	int sourceFd = ::open(QFile::encodeName(sourceFileName).constData(), O_RDONLY);
+
+	if (sourceFd < 0) {
+		Log("DvbTsCutter::cut: cannot open file") << sourceFileName;
+		return false;
+	}
+
+	struct stat sourceStat;
+
+	if ((fstat(sourceFd, &sourceStat) != 0) || !findPatPmt(sourceFd)) {
+		Log("DvbTsCutter::cut: cannot find pat / pmt") << sourceFileName;
+		::close(sourceFd);
+		return false;
+	}
+
+	int targetFd = ::open(QFile::encodeName(targetFileName).constData(),
+		O_WRONLY | O_CREAT | O_EXCL, 0666);
+
+	if (targetFd < 0) {
+		Log("DvbTsCutter::cut: cannot open file") << targetFileName;
+		::close(sourceFd);
+		return false;
+	}
+
+	const QVector<DvbTsIndexEntry> &entries = index.getEntries();
+	qint64 sourceSize = ((sourceStat.st_size / 188) * 188);
+	QVector<DvbTsIndexEntry> targetEntries;
+	qint64 targetOffset = 0;
+	qint64 targetTime = 0;
+	qint64 previousEnd = 0;
+	bool first = true;
+	bool ok = true;
+
+	for (int i = 0; (i < ranges.size()) && ok; ++i) {
+		// begin: last key frame at or before; end: first key frame after the range
+		DvbTsIndexEntry beginEntry;
+
+		if (!index.findKeyFrame(ranges.at(i).first, beginEntry)) {
+			continue;
+		}
+
+		int endIndex = 0;
+
+		while ((endIndex < entries.size()) &&
+		       (entries.at(endIndex).time <= ranges.at(i).second)) {
+			++endIndex;
+		}
+
+		qint64 begin = qMax(beginEntry.offset, previousEnd);
+		qint64 end = sourceSize;
+		qint64 endTime = entries.last().time;
+
+		if (endIndex < entries.size()) {
+			end = qMin(entries.at(endIndex).offset, sourceSize);
+			endTime = entries.at(endIndex).time;
+		}
+
+		if (begin >= end) {
+			continue;
+		}
+
+		QByteArray packets = splicePackets(sourceFd, begin, end - begin, first);
+
+		if (!writeAll(targetFd, packets.constData(), packets.size()) ||
+		    !copyRange(sourceFd, targetFd, begin, end - begin)) {
+			Log("DvbTsCutter::cut: cannot write file") << targetFileName;
+			ok = false;
+			break;
+		}
+
+		for (int j = 0; j < endIndex; ++j) {
+			const DvbTsIndexEntry &entry = entries.at(j);
+
+			if (entry.offset >= begin) {
+				DvbTsIndexEntry targetEntry;
+				targetEntry.time = (targetTime + entry.time - beginEntry.time);
+				targetEntry.offset = (targetOffset + packets.size() + entry.offset - begin);
+				targetEntries.append(targetEntry);
+			}
+		}
+
+		targetOffset += (packets.size() + end - begin);
+		targetTime += qMax(endTime - beginEntry.time, Q_INT64_C(0));
+		insertedBytes += packets.size();
+		copiedBytes += (end - begin);
+		previousEnd = end;
+		first = false;
+	}
+
+	::close(sourceFd);
+
+	if (::close(targetFd) != 0) {
+		ok = false;
+	}
+
+	if (ok && first) {
+		// e.g. the recording is shorter than the margins
+		Log("DvbTsCutter::cut: nothing to copy") << sourceFileName;
+		ok = false;
+	}
+
+	if (!ok) {
+		QFile::remove(targetFileName);
+		return false;
+	}
+
+	return DvbTsIndex::save(DvbTsIndex::sidecarFileName(targetFileName), targetEntries);
+}
+
+bool DvbTsCutter::trim(const QString &sourceFileName, const QString &targetFileName,
+	qint64 begin, qint64 end)
+{
+	DvbTsIndex sourceIndex;
+
+	if (!sourceIndex.load(DvbTsIndex::sidecarFileName(sourceFileName))) {
+		Log("DvbTsCutter::trim: cannot load index") << sourceFileName;
+		return false;
+	}
+
+	qint64 duration = sourceIndex.getEntries().last().time;
+	QList<QPair<qint64, qint64> > ranges;
+	ranges.append(qMakePair(begin, duration - end));
+	return cut(sourceFileName, targetFileName, ranges);
+}
+
+bool DvbTsCutter::findPatPmt(int fd)
+{
+	// the recordings start with a pat / pmt (and repeat them every 500 ms)
+	QByteArray head(HeadSize, Qt::Uninitialized);
+	ssize_t size = pread(fd, head.data(), head.size(), 0);
+
+	if (size < 188) {
+		return false;
+	}
+
+	patPackets.clear();
+	pmtPackets.clear();
+	pmtPid = -1;
+
+	for (int i = 0; (i + 188) <= size; i += 188) {
+		const char *packet = (head.constData() + i);
+		DvbTsPacket tsPacket(packet);
+
+		if (packet[0] != 0x47) {
+			return false;
+		}
+
+		if (pmtPid < 0) {
+			int offset = tsPacket.payloadOffset();
+
+			if ((tsPacket.pid() != 0) || !tsPacket.payloadUnitStart() || (offset >= 188)) {
+				continue;
+			}
+
+			// pointer field, then the section
+			const unsigned char *data = reinterpret_cast<const unsigned char *>(packet);
+			offset += (1 + data[offset]);
+
+			if (((offset + 8) > 188) || (data[offset] != 0x00)) {
+				continue;
+			}
+
+			int end = (offset + 3 + (((data[offset + 1] & 0x0f) << 8) | data[offset + 2]) - 4);
+
+			for (int j = (offset + 8); ((j + 4) <= end) && ((j + 4) <= 188); j += 4) {
+				if (((data[j] << 8) | data[j + 1]) != 0) {
+					pmtPid = (((data[j + 2] & 0x1f) << 8) | data[j + 3]);
+					break;
+				}
+			}
+
+			if (pmtPid >= 0) {
+				patPackets = QByteArray(packet, 188);
+			}
+
+			continue;
+		}
+
+		if (tsPacket.pid() != pmtPid) {
+			continue;
+		}
+
+		if (tsPacket.payloadUnitStart() && !pmtPackets.isEmpty()) {
+			break;
+		}
+
+		if (tsPacket.payloadUnitStart() || !pmtPackets.isEmpty()) {
+			pmtPackets.append(packet, 188);
+
+			if (pmtPackets.size() >= (16 * 188)) {
+				break;
+			}
+		}
+	}
+
+	return (!patPackets.isEmpty() && !pmtPackets.isEmpty());
+}
+
+QByteArray DvbTsCutter::splicePackets(int fd, qint64 offset, qint64 size, bool first)
+{
+	// continuity counter which has to precede the range (for every pid)
+	QByteArray head(int(qMin(size, qint64(HeadSize))), Qt::Uninitialized);
+	ssize_t headSize = pread(fd, head.data(), head.size(), offset);
+	QMap<int, int> continuityCounters;
+
+	for (int i = 0; (i + 188) <= headSize; i += 188) {
+		DvbTsPacket tsPacket(head.constData() + i);
+		int pid = tsPacket.pid();
+
+		if ((pid != 0x1fff) && !continuityCounters.contains(pid)) {
+			// the counter is only incremented by packets with a payload
+			continuityCounters.insert(pid, (tsPacket.continuityCounter() -
+				(tsPacket.hasPayload() ? 1 : 0)) & 0x0f);
+		}
+	}
+
+	QByteArray packets;
+	const QByteArray *psiPackets[2] = { &patPackets, &pmtPackets };
+	int psiPids[2] = { 0, pmtPid };
+
+	for (int i = 0; i < 2; ++i) {
+		int count = (psiPackets[i]->size() / 188);
+		int continuityCounter = continuityCounters.value(psiPids[i], (count - 1) & 0x0f);
+		continuityCounter = ((continuityCounter - count) & 0x0f);
+
+		if (!first) {
+			appendDiscontinuity(packets, psiPids[i], continuityCounter);
+		}
+
+		for (int j = 0; j < count; ++j) {
+			continuityCounter = ((continuityCounter + 1) & 0x0f);
+			QByteArray packet = psiPackets[i]->mid(j * 188, 188);
+			packet[3] = char((packet.at(3) & 0xf0) | continuityCounter);
+			packets.append(packet);
+		}
+
+		continuityCounters.remove(psiPids[i]);
+	}
+
+	if (!first) {
+		for (QMap<int, int>::const_iterator it = continuityCounters.constBegin();
+		     it != continuityCounters.constEnd(); ++it) {
+			appendDiscontinuity(packets, it.key(), it.value());
+		}
+	}
+
+	return packets;
+}
+
+void DvbTsCutter::appendDiscontinuity(QByteArray &packets, int pid,
+	int continuityCounter) const
+{
+	// adaptation field only (doesn't increment the counter) with discontinuity_indicator
+	char packet[188];
+	memset(packet, 0xff, sizeof(packet));
+	packet[0] = 0x47;
+	packet[1] = char((pid >> 8) & 0x1f);
+	packet[2] = char(pid & 0xff);
+	packet[3] = char(0x20 | continuityCounter);
+	packet[4] = char(183);
+	packet[5] = char(0x80);
+	packets.append(packet, sizeof(packet));
+}
+
+bool DvbTsCutter::copyRange(int sourceFd, int targetFd, qint64 offset, qint64 size)
+{
+#ifdef __NR_copy_file_range
+	// in-kernel copy (the data is still copied, the offsets aren't block aligned)
+	while (size > 0) {
+		if (isAborted()) {
+			return false;
+		}
+
+		qint64 sourceOffset = offset; // loff_t
+		ssize_t bytesCopied = syscall(__NR_copy_file_range, sourceFd, &sourceOffset,
+			targetFd, NULL, size_t(qMin(size, qint64(CopySize))), 0);
+
+		if (bytesCopied > 0) {
+			offset += bytesCopied;
+			size -= bytesCopied;
+			continue;
+		}
+
+		if ((bytesCopied < 0) && (errno == EINTR)) {
+			continue;
+		}
+
+		if ((bytesCopied < 0) && (errno != ENOSYS) && (errno != EXDEV) &&
+		    (errno != EINVAL) && (errno != EOPNOTSUPP)) {
+			return false;
+		}
+
+		// not supported (or unexpected end of file); fall back to read / write
+		break;
+	}
+#endif /* __NR_copy_file_range */
+
+	QByteArray buffer(int(qMin(size, qint64(BufferSize))), Qt::Uninitialized);
+
+	while (size > 0) {
+		if (isAborted()) {
+			return false;
+		}
+
+		ssize_t bytesRead = pread(sourceFd, buffer.data(), int(qMin(size,
+			qint64(buffer.size()))), offset);
+
+		if (bytesRead < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		if ((bytesRead == 0) || !writeAll(targetFd, buffer.constData(), bytesRead)) {
+			return false;
+		}
+
+		offset += bytesRead;
+		size -= bytesRead;
+	}
+
+	return true;
+}
+
+bool DvbTsCutter::writeAll(int fd, const char *data, qint64 size)
+{
+	while (size > 0) {
+		ssize_t bytesWritten = write(fd, data, size);
+
+		if (bytesWritten < 0) {
+			if (errno == EINTR) {
+				continue;
+			}
+
+			return false;
+		}
+
+		data += bytesWritten;
+		size -= bytesWritten;
+	}
+
+	return true;
+}
+
+bool DvbTsCutter::isAborted() const
+{
+	return ((abortFlag != NULL) && (abortFlag->load() != 0));
+}
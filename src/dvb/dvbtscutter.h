@@ -0,0 +1,98 @@
+/*
+ * dvbtscutter.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBTSCUTTER_H
+#define DVBTSCUTTER_H
+
+#include <QAtomicInt>
+#include <QList>
+#include <QMap>
+#include <QPair>
+#include <QString>
+#include "dvbtsindex.h"
+
+/*
+ * lossless cutter for recordings; the ranges are extended to the surrounding random
+ * access points of the index (i.e. complete gops), so nothing has to be re-encoded;
+ * the kept data is copied with copy_file_range() (in-kernel copy without a round trip
+ * through user space) and at every splice point the pat / pmt are repeated and the
+ * continuity counters are resynchronized (discontinuity_indicator); the offsets aren't
+ * block aligned (packets of 188 bytes), so the extents aren't shared (no reflinks)
+ */
+
+class DvbTsCutter
+{
+public:
+	DvbTsCutter() : abortFlag(NULL), pmtPid(-1), copiedBytes(0), insertedBytes(0) { }
+	~DvbTsCutter() { }
+
+	// the copying stops (and cut() fails) once the flag is set (may be called by any thread)
+	void setAbortFlag(const QAtomicInt *abortFlag_)
+	{
+		abortFlag = abortFlag_;
+	}
+
+	/*
+	 * the ranges (milliseconds since the start of the recording) must be ascending;
+	 * the target file must not exist yet; an index is written for the target file;
+	 * returns false (and removes the target file) if none of the ranges contains data
+	 */
+
+	bool cut(const QString &sourceFileName, const QString &targetFileName,
+		const QList<QPair<qint64, qint64> > &ranges);
+
+	// removes the first 'begin' and the last 'end' milliseconds (e.g. the margins)
+	bool trim(const QString &sourceFileName, const QString &targetFileName, qint64 begin,
+		qint64 end);
+
+	qint64 getCopiedBytes() const // without the inserted packets
+	{
+		return copiedBytes;
+	}
+
+	qint64 getInsertedBytes() const
+	{
+		return insertedBytes;
+	}
+
+private:
+	enum {
+		HeadSize = (4 << 20), // the continuity counters are taken from this area
+		BufferSize = (1 << 20),
+		CopySize = (64 << 20) // per copy_file_range() call (the abort flag is checked)
+	};
+
+	bool findPatPmt(int fd);
+	QByteArray splicePackets(int fd, qint64 offset, qint64 size, bool first);
+	void appendDiscontinuity(QByteArray &packets, int pid, int continuityCounter) const;
+	bool copyRange(int sourceFd, int targetFd, qint64 offset, qint64 size);
+	bool writeAll(int fd, const char *data, qint64 size);
+	bool isAborted() const;
+
+	DvbTsIndex index;
+	const QAtomicInt *abortFlag;
+	QByteArray patPackets;
+	QByteArray pmtPackets;
+	int pmtPid;
+	qint64 copiedBytes;
+	qint64 insertedBytes;
+};
+
+#endif /* DVBTSCUTTER_H */
@@ -0,0 +1,413 @@
+/*
+ * dvbtsindex.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbtsindex.h"
+
+#include <QDataStream>
+#include "../log.h"
+#include "dvbsi.h"
+
+bool DvbTsPacket::isDiscontinuous() const
+{
+	return (hasAdaptationField() && (packet[4] >= 1) && ((packet[5] & 0x80) != 0));
+}
+
+bool DvbTsPacket::isRandomAccess() const
+{
+	return (hasAdaptationField() && (packet[4] >= 1) && ((packet[5] & 0x40) != 0));
+}
+
+bool DvbTsPacket::getPcr(qint64 &pcr) const
+{
+	if (!hasAdaptationField() || (packet[4] < 7) || ((packet[5] & 0x10) == 0)) {
+		return false;
+	}
+
+	pcr = ((qint64(packet[6]) << 25) | (packet[7] << 17) | (packet[8] << 9) |
+		(packet[9] << 1) | (packet[10] >> 7));
+	return true;
+}
+
+int DvbTsPacket::payloadOffset() const
+{
+	if (!hasPayload()) {
+		return 188;
+	}
+
+	int offset = 4;
+
+	if (hasAdaptationField()) {
+		offset += (1 + packet[4]);
+
+		if (offset > 188) {
+			return 188;
+		}
+	}
+
+	return offset;
+}
+
+bool DvbTsPacket::getPts(qint64 &pts) const
+{
+	if (!payloadUnitStart()) {
+		return false;
+	}
+
+	int offset = payloadOffset();
+
+	if ((offset + 14) > 188) {
+		return false;
+	}
+
+	const unsigned char *pes = (packet + offset);
+
+	if ((pes[0] != 0x00) || (pes[1] != 0x00) || (pes[2] != 0x01) || ((pes[7] & 0x80) == 0)) {
+		return false;
+	}
+
+	pts = ((qint64((pes[9] >> 1) & 0x07) << 30) | (pes[10] << 22) | ((pes[11] >> 1) << 15) |
+		(pes[12] << 7) | (pes[13] >> 1));
+	return true;
+}
+
+class DvbTsIndexEntryLessThan
+{
+public:
+	bool operator()(const DvbTsIndexEntry &x, const DvbTsIndexEntry &y) const
+	{
+		return (x.time < y.time);
+	}
+};
+
+DvbTsIndex::DvbTsIndex()
+{
+	reset();
+}
+
+DvbTsIndex::~DvbTsIndex()
+{
+	closeSidecarFile();
+}
+
+void DvbTsIndex::reset()
+{
+	entries.clear();
+	gaps.clear();
+	indexPid = -1;
+	streamType = -1;
+	size = 0;
+	lastPcr = -1;
+	lastPts = -1;
+	ticks = 0;
+}
+
+void DvbTsIndex::setPids(const DvbPmtParser &pmtParser)
+{
+	if (pmtParser.videoPid >= 0) {
+		indexPid = pmtParser.videoPid;
+		streamType = pmtParser.videoStreamType;
+	} else if (!pmtParser.audioPids.isEmpty()) {
+		indexPid = pmtParser.audioPids.at(0).first;
+		streamType = -1;
+	} else {
+		indexPid = -1;
+		streamType = -1;
+	}
+}
+
+void DvbTsIndex::addPackets(const char *data, int size_)
+{
+	for (int i = 0; (i + 188) <= size_; i += 188) {
+		const char *packet = (data + i);
+		DvbTsPacket tsPacket(packet);
+		qint64 pcr;
+
+		if (tsPacket.getPcr(pcr)) {
+			lastPcr = pcr;
+		}
+
+		if ((tsPacket.pid() == indexPid) && tsPacket.payloadUnitStart() && isKeyFrame(packet)) {
+			qint64 pts;
+
+			if (!tsPacket.getPts(pts)) {
+				pts = lastPcr;
+			}
+
+			if (pts >= 0) {
+				appendEntry(pts, size);
+			}
+		}
+
+		size += 188;
+	}
+}
+
+bool DvbTsIndex::openSidecarFile(const QString &fileName)
+{
+	closeSidecarFile();
+	sidecarFile.setFileName(fileName);
+
+	if (!sidecarFile.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		Log("DvbTsIndex::openSidecarFile: cannot open file") << sidecarFile.fileName();
+		return false;
+	}
+
+	QDataStream stream(&sidecarFile);
+	stream.setVersion(QDataStream::Qt_4_4);
+	int version = 0x18a6c4f3;
+	stream << version;
+
+	foreach (const DvbTsIndexEntry &entry, entries) {
+		stream << entry.time << entry.offset;
+	}
+
+	foreach (const DvbTsIndexEntry &gap, gaps) {
+		stream << gap.time << (-1 - gap.offset);
+	}
+
+	return true;
+}
+
+void DvbTsIndex::closeSidecarFile()
+{
+	sidecarFile.close();
+}
+
+bool DvbTsIndex::load(const QString &fileName)
+{
+	reset();
+	QFile file(fileName);
+
+	if (!file.open(QIODevice::ReadOnly)) {
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_4_4);
+	int version;
+	stream >> version;
+
+	if (version != 0x18a6c4f3) {
+		Log("DvbTsIndex::load: wrong version") << file.fileName();
+		return false;
+	}
+
+	while (!stream.atEnd()) {
+		DvbTsIndexEntry entry;
+		stream >> entry.time >> entry.offset;
+
+		if (stream.status() != QDataStream::Ok) {
+			// the last entry may be incomplete if the recording was interrupted
+			break;
+		}
+
+		if (entry.offset < 0) {
+			entry.offset = (-1 - entry.offset);
+			gaps.append(entry);
+			continue;
+		}
+
+		entries.append(entry);
+	}
+
+	if (!entries.isEmpty()) {
+		size = entries.last().offset;
+	}
+
+	return !entries.isEmpty();
+}
+
+bool DvbTsIndex::save(const QString &fileName, const QVector<DvbTsIndexEntry> &entries)
+{
+	QFile file(fileName);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		Log("DvbTsIndex::save: cannot open file") << file.fileName();
+		return false;
+	}
+
+	QDataStream stream(&file);
+	stream.setVersion(QDataStream::Qt_4_4);
+	int version = 0x18a6c4f3;
+	stream << version;
+
+	foreach (const DvbTsIndexEntry &entry, entries) {
+		stream << entry.time << entry.offset;
+	}
+
+	return (stream.status() == QDataStream::Ok);
+}
+
+void DvbTsIndex::resume(qint64 offset, qint64 gapDuration)
+{
+	while (!entries.isEmpty() && (entries.last().offset >= offset)) {
+		entries.pop_back();
+	}
+
+	DvbTsIndexEntry gap;
+	gap.time = ((entries.isEmpty() ? 0 : entries.last().time) + qMax(gapDuration, Q_INT64_C(0)));
+	gap.offset = offset;
+	gaps.append(gap);
+
+	if (sidecarFile.isOpen()) {
+		QDataStream stream(&sidecarFile);
+		stream.setVersion(QDataStream::Qt_4_4);
+		stream << gap.time << (-1 - gap.offset);
+	}
+
+	// the timestamps after the gap are unrelated to the previous ones
+	size = offset;
+	lastPcr = -1;
+	lastPts = -1;
+	ticks = (90 * gap.time);
+}
+
+bool DvbTsIndex::findKeyFrame(qint64 time, DvbTsIndexEntry &entry) const
+{
+	DvbTsIndexEntry value;
+	value.time = time;
+	value.offset = 0;
+	int index = (qUpperBound(entries.constBegin(), entries.constEnd(), value,
+		DvbTsIndexEntryLessThan()) - entries.constBegin());
+
+	if (index <= 0) {
+		if (entries.isEmpty()) {
+			return false;
+		}
+
+		index = 1;
+	}
+
+	entry = entries.at(index - 1);
+	return true;
+}
+
+bool DvbTsIndex::isKeyFrame(const char *packet) const
+{
+	DvbTsPacket tsPacket(packet);
+
+	if (tsPacket.isRandomAccess()) {
+		return true;
+	}
+
+	if (streamType < 0) {
+		// audio: every pes packet can be decoded independently
+		return true;
+	}
+
+	int offset = tsPacket.payloadOffset();
+
+	if ((offset + 9) > 188) {
+		return false;
+	}
+
+	const unsigned char *data = reinterpret_cast<const unsigned char *>(packet);
+
+	if ((data[offset] != 0x00) || (data[offset + 1] != 0x00) || (data[offset + 2] != 0x01)) {
+		return false;
+	}
+
+	// skip the pes header and look for a start code indicating a key frame
+	offset += (9 + data[offset + 8]);
+
+	for (int i = offset; (i + 5) < 188; ++i) {
+		if ((data[i] != 0x00) || (data[i + 1] != 0x00) || (data[i + 2] != 0x01)) {
+			continue;
+		}
+
+		int code = data[i + 3];
+
+		switch (streamType) {
+		case 0x01: // MPEG1 video
+		case 0x02: // MPEG2 video
+			if (code == 0xb3) {
+				// sequence header
+				return true;
+			}
+
+			if (code == 0x00) {
+				// picture header; check for an I frame
+				return (((data[i + 5] >> 3) & 0x07) == 1);
+			}
+
+			break;
+		case 0x10: // MPEG4 video
+			if (code == 0xb0) {
+				// visual object sequence
+				return true;
+			}
+
+			if (code == 0xb6) {
+				// video object plane; check for an I-VOP
+				return ((data[i + 4] >> 6) == 0);
+			}
+
+			break;
+		case 0x1b: // H264 video
+			switch (code & 0x1f) {
+			case 5: // IDR slice
+			case 7: // sequence parameter set
+				return true;
+			case 1: // non-IDR slice
+				return false;
+			}
+
+			break;
+		default:
+			return false;
+		}
+	}
+
+	return false;
+}
+
+void DvbTsIndex::appendEntry(qint64 pts, qint64 offset)
+{
+	if (lastPts >= 0) {
+		qint64 delta = ((pts - lastPts) & (DvbTsPacket::TimestampWrap - 1));
+
+		if (delta > (60 * 90000)) {
+			// discontinuity; continue with the previous time
+			delta = 0;
+		}
+
+		ticks += delta;
+	}
+
+	lastPts = pts;
+	DvbTsIndexEntry entry;
+	entry.time = (ticks / 90);
+	entry.offset = offset;
+
+	if (!entries.isEmpty()) {
+		// audio frames are very short; limit the size of the index
+		if ((streamType < 0) && ((entry.time - entries.last().time) < 500)) {
+			return;
+		}
+	}
+
+	entries.append(entry);
+
+	if (sidecarFile.isOpen()) {
+		QDataStream stream(&sidecarFile);
+		stream.setVersion(QDataStream::Qt_4_4);
+		stream << entry.time << entry.offset;
+	}
+}
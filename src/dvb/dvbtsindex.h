@@ -0,0 +1,151 @@
+/*
+ * dvbtsindex.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBTSINDEX_H
+#define DVBTSINDEX_H
+
+#include <QFile>
+#include <QVector>
+
+class DvbPmtParser;
+
+// accessors for a transport stream packet (188 bytes); the sync byte isn't checked
+
+class DvbTsPacket
+{
+public:
+	explicit DvbTsPacket(const char *packet_) :
+		packet(reinterpret_cast<const unsigned char *>(packet_)) { }
+	~DvbTsPacket() { }
+
+	int pid() const
+	{
+		return (((packet[1] << 8) | packet[2]) & ((1 << 13) - 1));
+	}
+
+	bool payloadUnitStart() const
+	{
+		return ((packet[1] & 0x40) != 0);
+	}
+
+	bool hasAdaptationField() const
+	{
+		return ((packet[3] & 0x20) != 0);
+	}
+
+	bool hasPayload() const
+	{
+		return ((packet[3] & 0x10) != 0);
+	}
+
+	int continuityCounter() const
+	{
+		return (packet[3] & 0x0f);
+	}
+
+	bool isScrambled() const
+	{
+		return ((packet[3] & 0xc0) != 0); // transport_scrambling_control
+	}
+
+	bool isDiscontinuous() const; // discontinuity_indicator
+	bool isRandomAccess() const; // random_access_indicator
+	bool getPcr(qint64 &pcr) const; // 90 kHz units
+	int payloadOffset() const; // 188 if there's no payload
+	bool getPts(qint64 &pts) const; // only at the start of a pes packet
+
+	static const qint64 TimestampWrap = (Q_INT64_C(1) << 33);
+
+private:
+	const unsigned char *packet;
+};
+
+class DvbTsIndexEntry
+{
+public:
+	qint64 time; // milliseconds since the first indexed frame
+	qint64 offset; // bytes
+};
+
+Q_DECLARE_TYPEINFO(DvbTsIndexEntry, Q_PRIMITIVE_TYPE);
+
+/*
+ * maps the time of random access points (key frames) to file offsets; the index is
+ * either kept in memory (time shift) or additionally appended to a sidecar file;
+ * gaps (interrupted recordings) are stored with a negative offset in the sidecar file
+ */
+
+class DvbTsIndex
+{
+public:
+	DvbTsIndex();
+	~DvbTsIndex();
+
+	void reset();
+	void setPids(const DvbPmtParser &pmtParser); // indexes video (or audio if not present)
+	void addPackets(const char *data, int size); // every packet which is written
+
+	bool openSidecarFile(const QString &fileName);
+	void closeSidecarFile();
+	bool load(const QString &fileName); // reads a sidecar file
+	// writes a sidecar file (e.g. for a cut recording)
+	static bool save(const QString &fileName, const QVector<DvbTsIndexEntry> &entries);
+	// continues after an interruption; the data after 'offset' has been discarded
+	void resume(qint64 offset, qint64 gapDuration); // milliseconds
+
+	// finds the last random access point at or before 'time' (milliseconds)
+	bool findKeyFrame(qint64 time, DvbTsIndexEntry &entry) const;
+
+	const QVector<DvbTsIndexEntry> &getEntries() const
+	{
+		return entries;
+	}
+
+	const QVector<DvbTsIndexEntry> &getGaps() const // time and offset after the gap
+	{
+		return gaps;
+	}
+
+	qint64 getSize() const // bytes indexed so far
+	{
+		return size;
+	}
+
+	static QString sidecarFileName(const QString &fileName)
+	{
+		return (fileName + QLatin1String(".idx"));
+	}
+
+private:
+	bool isKeyFrame(const char *packet) const;
+	void appendEntry(qint64 pts, qint64 offset);
+
+	QVector<DvbTsIndexEntry> entries;
+	QVector<DvbTsIndexEntry> gaps;
+	int indexPid;
+	int streamType;
+	qint64 size;
+	qint64 lastPcr;
+	qint64 lastPts;
+	qint64 ticks; // 90 kHz units since the first indexed frame
+	QFile sidecarFile;
+};
+
+#endif /* DVBTSINDEX_H */
@@ -0,0 +1,263 @@
+/*
+ * dvbxmltv.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbxmltv.h"
+
+#include "../log.h"
+
+DvbXmltvReader::DvbXmltvReader(QIODevice *device) : reader(device)
+{
+}
+
+DvbXmltvReader::~DvbXmltvReader()
+{
+}
+
+bool DvbXmltvReader::read(QList<DvbXmltvChannel> &channels,
+	QList<DvbXmltvProgramme> &programmes, int maxCount)
+{
+	while (!reader.atEnd()) {
+		if (programmes.size() >= maxCount) {
+			return true;
+		}
+
+		if (reader.readNext() != QXmlStreamReader::StartElement) {
+			continue;
+		}
+
+		// the other elements (like <tv>) are descended into
+		if (reader.name() == QLatin1String("channel")) {
+			readChannel(channels);
+		} else if (reader.name() == QLatin1String("programme")) {
+			DvbXmltvProgramme programme;
+
+			if (readProgramme(programme)) {
+				appendProgramme(programmes, programme);
+			}
+		}
+	}
+
+	if (reader.hasError()) {
+		Log("DvbXmltvReader::read: parse error in line") << qint64(reader.lineNumber()) <<
+			reader.errorString();
+	}
+
+	// the programmes without stop time at the end are dropped
+	openProgrammes.clear();
+	return false;
+}
+
+QDateTime DvbXmltvReader::parseDateTime(const QString &string)
+{
+	QString trimmedString = string.trimmed();
+	int digitCount = 0;
+
+	while ((digitCount < trimmedString.size()) && (digitCount < 14) &&
+	       trimmedString.at(digitCount).isDigit()) {
+		++digitCount;
+	}
+
+	if ((digitCount < 8) || ((digitCount % 2) != 0)) {
+		return QDateTime();
+	}
+
+	int values[6] = { 0, 1, 1, 0, 0, 0 };
+	values[0] = trimmedString.left(4).toInt();
+
+	for (int i = 1; (4 + 2 * i) <= digitCount; ++i) {
+		values[i] = trimmedString.mid(2 + 2 * i, 2).toInt();
+	}
+
+	QDateTime dateTime(QDate(values[0], values[1], values[2]),
+		QTime(values[3], values[4], values[5]), Qt::UTC);
+	QString offset = trimmedString.mid(digitCount).trimmed();
+
+	if ((offset.size() == 5) &&
+	    ((offset.at(0) == QLatin1Char('+')) || (offset.at(0) == QLatin1Char('-')))) {
+		bool hoursOk;
+		bool minutesOk;
+		int seconds = (offset.mid(1, 2).toInt(&hoursOk) * 3600 +
+			offset.mid(3, 2).toInt(&minutesOk) * 60);
+
+		if (!hoursOk || !minutesOk) {
+			return QDateTime();
+		}
+
+		if (offset.at(0) == QLatin1Char('-')) {
+			seconds = -seconds;
+		}
+
+		dateTime = dateTime.addSecs(-seconds);
+	}
+
+	return dateTime;
+}
+
+void DvbXmltvReader::readChannel(QList<DvbXmltvChannel> &channels)
+{
+	DvbXmltvChannel channel;
+	channel.id = reader.attributes().value(QLatin1String("id")).toString();
+
+	while (reader.readNextStartElement()) {
+		if (reader.name() == QLatin1String("display-name")) {
+			channel.displayNames.append(
+				reader.readElementText(QXmlStreamReader::SkipChildElements));
+		} else {
+			reader.skipCurrentElement();
+		}
+	}
+
+	if (!channel.id.isEmpty()) {
+		channels.append(channel);
+	}
+}
+
+bool DvbXmltvReader::readProgramme(DvbXmltvProgramme &programme)
+{
+	QXmlStreamAttributes attributes = reader.attributes();
+	programme.channelId = attributes.value(QLatin1String("channel")).toString();
+	programme.begin = parseDateTime(attributes.value(QLatin1String("start")).toString());
+
+	if (attributes.hasAttribute(QLatin1String("stop"))) {
+		programme.end = parseDateTime(attributes.value(QLatin1String("stop")).toString());
+	}
+
+	while (reader.readNextStartElement()) {
+		// there may be multiple titles (different languages); the first one is used
+		if ((reader.name() == QLatin1String("title")) && programme.title.isEmpty()) {
+			programme.title = reader.readElementText(QXmlStreamReader::SkipChildElements);
+		} else if ((reader.name() == QLatin1String("sub-title")) &&
+			   programme.subheading.isEmpty()) {
+			programme.subheading =
+				reader.readElementText(QXmlStreamReader::SkipChildElements);
+		} else if ((reader.name() == QLatin1String("desc")) &&
+			   programme.details.isEmpty()) {
+			programme.details = reader.readElementText(QXmlStreamReader::SkipChildElements);
+		} else {
+			reader.skipCurrentElement();
+		}
+	}
+
+	return (!programme.channelId.isEmpty() && programme.begin.isValid());
+}
+
+void DvbXmltvReader::appendProgramme(QList<DvbXmltvProgramme> &programmes,
+	const DvbXmltvProgramme &programme)
+{
+	QHash<QString, DvbXmltvProgramme>::iterator it =
+		openProgrammes.find(programme.channelId);
+
+	if (it != openProgrammes.end()) {
+		if (it->begin < programme.begin) {
+			it->end = programme.begin;
+			programmes.append(*it);
+		}
+
+		openProgrammes.erase(it);
+	}
+
+	if (programme.end.isValid()) {
+		programmes.append(programme);
+	} else {
+		openProgrammes.insert(programme.channelId, programme);
+	}
+}
+
+DvbXmltvWriter::DvbXmltvWriter(QIODevice *device) : writer(device)
+{
+	writer.setAutoFormatting(true);
+	writer.writeStartDocument();
+	writer.writeDTD(QLatin1String("<!DOCTYPE tv SYSTEM \"xmltv.dtd\">"));
+	writer.writeStartElement(QLatin1String("tv"));
+	writer.writeAttribute(QLatin1String("generator-info-name"), QLatin1String("Kaffeine"));
+}
+
+DvbXmltvWriter::~DvbXmltvWriter()
+{
+}
+
+void DvbXmltvWriter::writeChannel(const QString &id, const QString &displayName)
+{
+	writer.writeStartElement(QLatin1String("channel"));
+	writer.writeAttribute(QLatin1String("id"), id);
+	writer.writeTextElement(QLatin1String("display-name"), displayName);
+	writer.writeEndElement();
+}
+
+void DvbXmltvWriter::writeProgramme(const QString &channelId, const DvbEpgEntry &entry)
+{
+	writer.writeStartElement(QLatin1String("programme"));
+	writer.writeAttribute(QLatin1String("start"), formatDateTime(entry.begin));
+	writer.writeAttribute(QLatin1String("stop"),
+		formatDateTime(entry.begin.addSecs(QTime().secsTo(entry.duration))));
+	writer.writeAttribute(QLatin1String("channel"), channelId);
+	writer.writeTextElement(QLatin1String("title"), entry.title);
+
+	if (!entry.subheading.isEmpty()) {
+		writer.writeTextElement(QLatin1String("sub-title"), entry.subheading);
+	}
+
+	if (!entry.details.isEmpty()) {
+		writer.writeTextElement(QLatin1String("desc"), entry.details);
+	}
+
+	writer.writeEndElement();
+}
+
+void DvbXmltvWriter::writeEntries(const QList<DvbSharedEpgEntry> &entries,
+	const QMap<QString, QString> &channelIds)
+{
+	QHash<QString, QString> ids; // channel name -> xmltv id
+
+	for (QMap<QString, QString>::const_iterator it = channelIds.constBegin();
+	     it != channelIds.constEnd(); ++it) {
+		ids.insert(it.value(), it.key());
+	}
+
+	QMap<QString, QString> channels; // xmltv id -> channel name (sorted by id)
+
+	foreach (const DvbSharedEpgEntry &entry, entries) {
+		const QString &name = entry->channel->name;
+		channels.insert(ids.value(name, name), name);
+	}
+
+	for (QMap<QString, QString>::const_iterator it = channels.constBegin();
+	     it != channels.constEnd(); ++it) {
+		writeChannel(it.key(), it.value());
+	}
+
+	foreach (const DvbSharedEpgEntry &entry, entries) {
+		const QString &name = entry->channel->name;
+		writeProgramme(ids.value(name, name), *entry);
+	}
+}
+
+bool DvbXmltvWriter::finish()
+{
+	writer.writeEndElement();
+	writer.writeEndDocument();
+	return !writer.hasError();
+}
+
+QString DvbXmltvWriter::formatDateTime(const QDateTime &dateTime)
+{
+	return (dateTime.toUTC().toString(QLatin1String("yyyyMMddhhmmss")) +
+		QLatin1String(" +0000"));
+}
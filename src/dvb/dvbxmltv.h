@@ -0,0 +1,114 @@
+/*
+ * dvbxmltv.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBXMLTV_H
+#define DVBXMLTV_H
+
+#include <QXmlStreamReader>
+#include <QXmlStreamWriter>
+#include "dvbepgstore.h"
+
+class DvbXmltvChannel
+{
+public:
+	DvbXmltvChannel() { }
+	~DvbXmltvChannel() { }
+
+	QString id;
+	QStringList displayNames;
+};
+
+class DvbXmltvProgramme
+{
+public:
+	DvbXmltvProgramme() { }
+	~DvbXmltvProgramme() { }
+
+	QString channelId;
+	QDateTime begin; // UTC
+	QDateTime end; // UTC
+	QString title;
+	QString subheading;
+	QString details;
+};
+
+/*
+ * streaming xmltv parser; only the current element is kept in memory (and one programme
+ * per channel if the stop times are missing)
+ */
+
+class DvbXmltvReader
+{
+public:
+	explicit DvbXmltvReader(QIODevice *device);
+	~DvbXmltvReader();
+
+	// appends the following channels and at most 'maxCount' programmes; returns false once
+	// the end of the file has been reached (or if an error occurred)
+	bool read(QList<DvbXmltvChannel> &channels, QList<DvbXmltvProgramme> &programmes,
+		int maxCount);
+
+	bool hasError() const
+	{
+		return reader.hasError();
+	}
+
+	QString errorString() const
+	{
+		return reader.errorString();
+	}
+
+	// "YYYYMMDDhhmmss +hhmm" (the trailing parts are optional; UTC if there's no offset)
+	static QDateTime parseDateTime(const QString &string);
+
+private:
+	void readChannel(QList<DvbXmltvChannel> &channels);
+	bool readProgramme(DvbXmltvProgramme &programme);
+	void appendProgramme(QList<DvbXmltvProgramme> &programmes,
+		const DvbXmltvProgramme &programme);
+
+	QXmlStreamReader reader;
+	QHash<QString, DvbXmltvProgramme> openProgrammes; // without stop (ended by the next one)
+};
+
+class DvbXmltvWriter
+{
+public:
+	explicit DvbXmltvWriter(QIODevice *device);
+	~DvbXmltvWriter();
+
+	// the channels have to be written before the programmes
+	void writeChannel(const QString &id, const QString &displayName);
+	void writeProgramme(const QString &channelId, const DvbEpgEntry &entry);
+
+	// 'channelIds' maps xmltv ids to channel names (the channel name is used otherwise)
+	void writeEntries(const QList<DvbSharedEpgEntry> &entries,
+		const QMap<QString, QString> &channelIds);
+
+	// closes the document; returns false if an error occurred
+	bool finish();
+
+	static QString formatDateTime(const QDateTime &dateTime);
+
+private:
+	QXmlStreamWriter writer;
+};
+
+#endif /* DVBXMLTV_H */
@@ -0,0 +1,274 @@
+/*
+ * dvbxmltvimporter.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include "dvbxmltvimporter.h"
+
+#include <QCoreApplication>
+#include <QEvent>
+#include <QFile>
+#include <QMutex>
+#include <QSemaphore>
+#include <QThread>
+#include "../log.h"
+#include "dvbchannel.h"
+#include "dvbepg.h"
+#include "dvbmanager.h"
+#include "dvbxmltv.h"
+
+class DvbXmltvBatch
+{
+public:
+	DvbXmltvBatch() { }
+	~DvbXmltvBatch() { }
+
+	QList<DvbXmltvChannel> channels;
+	QList<DvbXmltvProgramme> programmes;
+};
+
+class DvbXmltvImportThread : public QThread
+{
+public:
+	DvbXmltvImportThread(QObject *receiver_, const QString &fileName_) : receiver(receiver_),
+		fileName(fileName_), freeBatches(MaxPendingBatches), aborted(false), done(false) { }
+	~DvbXmltvImportThread() { }
+
+	enum {
+		BatchSize = 1000, // programmes
+		MaxPendingBatches = 4
+	};
+
+	// returns true once the file has been parsed completely (no further batches follow)
+	bool takeBatches(QList<DvbXmltvBatch> &newBatches)
+	{
+		QMutexLocker locker(&mutex);
+		newBatches = batches;
+		batches.clear();
+		return done;
+	}
+
+	// has to be called for every processed batch
+	void releaseBatch()
+	{
+		freeBatches.release();
+	}
+
+	void abort()
+	{
+		mutex.lock();
+		aborted = true;
+		mutex.unlock();
+		freeBatches.release();
+	}
+
+private:
+	void run();
+
+	QObject *receiver;
+	QString fileName;
+	QSemaphore freeBatches;
+	QMutex mutex;
+	QList<DvbXmltvBatch> batches;
+	bool aborted;
+	bool done;
+};
+
+void DvbXmltvImportThread::run()
+{
+	QFile file(fileName);
+
+	if (file.open(QIODevice::ReadOnly)) {
+		DvbXmltvReader reader(&file);
+		bool atEnd = false;
+
+		while (!atEnd) {
+			freeBatches.acquire();
+
+			mutex.lock();
+			bool stop = aborted;
+			mutex.unlock();
+
+			if (stop) {
+				break;
+			}
+
+			DvbXmltvBatch batch;
+			atEnd = !reader.read(batch.channels, batch.programmes, BatchSize);
+
+			mutex.lock();
+			batches.append(batch);
+			mutex.unlock();
+
+			if (!atEnd) {
+				QCoreApplication::postEvent(receiver, new QEvent(QEvent::User));
+			}
+		}
+	} else {
+		Log("DvbXmltvImportThread::run: cannot open file") << fileName;
+	}
+
+	mutex.lock();
+	done = true;
+	mutex.unlock();
+	QCoreApplication::postEvent(receiver, new QEvent(QEvent::User));
+}
+
+DvbXmltvImporter::DvbXmltvImporter(DvbManager *manager_, QObject *parent) : QObject(parent),
+	manager(manager_), thread(NULL), importedCount(0), skippedCount(0)
+{
+}
+
+DvbXmltvImporter::~DvbXmltvImporter()
+{
+	if (thread != NULL) {
+		thread->abort();
+		thread->wait();
+		delete thread;
+	}
+}
+
+bool DvbXmltvImporter::importFile(const QString &fileName)
+{
+	if (thread != NULL) {
+		return false;
+	}
+
+	channelIds = manager->getXmltvChannelIds();
+	channelNames.clear();
+	channels.clear();
+	importedCount = 0;
+	skippedCount = 0;
+
+	foreach (const DvbSharedChannel &channel, manager->getChannelModel()->getChannels()) {
+		channelNames.insert(channel->name.toLower(), channel);
+	}
+
+	thread = new DvbXmltvImportThread(this, fileName);
+	thread->start();
+	return true;
+}
+
+bool DvbXmltvImporter::exportFile(const QString &fileName)
+{
+	QFile file(fileName);
+
+	if (!file.open(QIODevice::WriteOnly | QIODevice::Truncate)) {
+		Log("DvbXmltvImporter::exportFile: cannot open file") << fileName;
+		return false;
+	}
+
+	DvbXmltvWriter writer(&file);
+	writer.writeEntries(manager->getEpgModel()->getEntries(), manager->getXmltvChannelIds());
+
+	if (!writer.finish()) {
+		Log("DvbXmltvImporter::exportFile: cannot write file") << fileName;
+		return false;
+	}
+
+	return true;
+}
+
+void DvbXmltvImporter::customEvent(QEvent *event)
+{
+	Q_UNUSED(event)
+
+	if (thread == NULL) {
+		return;
+	}
+
+	QList<DvbXmltvBatch> batches;
+	bool done = thread->takeBatches(batches);
+
+	foreach (const DvbXmltvBatch &batch, batches) {
+		processBatch(batch);
+		thread->releaseBatch();
+	}
+
+	if (done) {
+		thread->wait();
+		delete thread;
+		thread = NULL;
+		channelNames.clear();
+		channels.clear();
+		Log("DvbXmltvImporter::customEvent: imported programmes (new or existing / skipped)")
+			<< importedCount << skippedCount;
+		emit importFinished(importedCount, skippedCount);
+	}
+}
+
+void DvbXmltvImporter::processBatch(const DvbXmltvBatch &batch)
+{
+	foreach (const DvbXmltvChannel &channel, batch.channels) {
+		channels.insert(channel.id, findChannel(channel.id, channel.displayNames));
+	}
+
+	QList<DvbEpgEntry> entries;
+
+	foreach (const DvbXmltvProgramme &programme, batch.programmes) {
+		QHash<QString, DvbSharedChannel>::const_iterator it =
+			channels.constFind(programme.channelId);
+
+		if (it == channels.constEnd()) {
+			// the <channel> element is optional
+			it = channels.insert(programme.channelId,
+				findChannel(programme.channelId, QStringList()));
+		}
+
+		int duration = programme.begin.secsTo(programme.end);
+
+		if (!it->isValid() || (duration <= 0) || (duration >= 86400)) {
+			++skippedCount;
+			continue;
+		}
+
+		DvbEpgEntry entry(*it);
+		entry.begin = programme.begin;
+		entry.duration = QTime(0, 0, 0).addSecs(duration);
+		entry.title = programme.title;
+		entry.subheading = programme.subheading;
+		entry.details = programme.details;
+		entries.append(entry);
+	}
+
+	// inserted in one go; the model batches the notifications
+	int count = manager->getEpgModel()->addEntries(entries);
+	importedCount += count;
+	skippedCount += (entries.size() - count);
+}
+
+DvbSharedChannel DvbXmltvImporter::findChannel(const QString &id,
+	const QStringList &displayNames) const
+{
+	DvbChannelModel *channelModel = manager->getChannelModel();
+	QString channelName = channelIds.value(id);
+
+	if (!channelName.isEmpty()) {
+		return channelModel->findChannelByName(channelName);
+	}
+
+	foreach (const QString &displayName, displayNames) {
+		DvbSharedChannel channel = channelNames.value(displayName.toLower());
+
+		if (channel.isValid()) {
+			return channel;
+		}
+	}
+
+	return channelModel->findChannelByName(id);
+}
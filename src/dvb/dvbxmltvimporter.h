@@ -0,0 +1,71 @@
+/*
+ * dvbxmltvimporter.h
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#ifndef DVBXMLTVIMPORTER_H
+#define DVBXMLTVIMPORTER_H
+
+#include "dvbepgstore.h"
+
+class DvbManager;
+class DvbXmltvBatch;
+class DvbXmltvImportThread;
+
+/*
+ * the file is parsed by a worker thread; the programmes are handed over in batches (only
+ * a few batches are queued, so that the memory usage doesn't depend on the file size)
+ */
+
+class DvbXmltvImporter : public QObject
+{
+	Q_OBJECT
+public:
+	DvbXmltvImporter(DvbManager *manager_, QObject *parent);
+	~DvbXmltvImporter();
+
+	bool isRunning() const
+	{
+		return (thread != NULL);
+	}
+
+	// returns false if there's already an import running
+	bool importFile(const QString &fileName);
+
+	// writes the whole epg (synchronously); returns false if an error occurred
+	bool exportFile(const QString &fileName);
+
+signals:
+	// 'skippedCount' includes programmes which have already ended
+	void importFinished(int importedCount, int skippedCount);
+
+private:
+	void customEvent(QEvent *event);
+	void processBatch(const DvbXmltvBatch &batch);
+	DvbSharedChannel findChannel(const QString &id, const QStringList &displayNames) const;
+
+	DvbManager *manager;
+	DvbXmltvImportThread *thread;
+	QMap<QString, QString> channelIds; // xmltv id -> channel name (configurable)
+	QHash<QString, DvbSharedChannel> channelNames; // lower case name -> channel
+	QHash<QString, DvbSharedChannel> channels; // xmltv id -> channel (may be invalid)
+	int importedCount;
+	int skippedCount;
+};
+
+#endif /* DVBXMLTVIMPORTER_H */
@@ -24,6 +24,7 @@
 #include <QBoxLayout>
 #include <QContextMenuEvent>
 #include <QDBusInterface>
+#include <QFileInfo>
 #include <QLabel>
 #include <QPushButton>
 #include <QStringListModel>
@@ -781,7 +782,7 @@ void MediaWidget::longSkipBackward()
 		currentTime = 0;
 	}
 
-	backend->seek(currentTime);
+	seekToKeyFrame(currentTime);
 }
 
 void MediaWidget::shortSkipBackward()
@@ -793,19 +794,19 @@ void MediaWidget::shortSkipBackward()
 		currentTime = 0;
 	}
 
-	backend->seek(currentTime);
+	seekToKeyFrame(currentTime);
 }
 
 void MediaWidget::shortSkipForward()
 {
 	int shortSkipDuration = Configuration::instance()->getShortSkipDuration();
-	backend->seek(backend->getCurrentTime() + 1000 * shortSkipDuration);
+	seekToKeyFrame(backend->getCurrentTime() + 1000 * shortSkipDuration);
 }
 
 void MediaWidget::longSkipForward()
 {
 	int longSkipDuration = Configuration::instance()->getLongSkipDuration();
-	backend->seek(backend->getCurrentTime() + 1000 * longSkipDuration);
+	seekToKeyFrame(backend->getCurrentTime() + 1000 * longSkipDuration);
 }
 
 void MediaWidget::jumpToPosition()
@@ -1048,7 +1049,19 @@ void MediaWidget::wheelEvent(QWheelEvent *event)
 		currentTime = 0;
 	}
 
-	backend->seek(currentTime);
+	seekToKeyFrame(currentTime);
+}
+
+void MediaWidget::seekToKeyFrame(int time)
+{
+	float position;
+
+	// the source may know the exact offset of a key frame (e.g. dvb recordings)
+	if (source->getKeyFramePosition(time, position)) {
+		backend->seekPosition(position);
+	} else {
+		backend->seek(time);
+	}
 }
 
 void MediaWidget::playbackFinished()
@@ -1273,6 +1286,40 @@ void JumpToPositionDialog::accept()
 	KDialog::accept();
 }
 
+MediaSourceUrl::MediaSourceUrl(const QUrl &url_, const QUrl &subtitleUrl_) : url(url_),
+	subtitleUrl(subtitleUrl_)
+{
+#if HAVE_DVB == 1
+	fileSize = 0;
+
+	if (url.isLocalFile()) {
+		QString fileName = url.toLocalFile();
+		QString indexFileName = DvbTsIndex::sidecarFileName(fileName);
+
+		if (QFile::exists(indexFileName) && keyFrameIndex.load(indexFileName)) {
+			fileSize = QFileInfo(fileName).size();
+		}
+	}
+#endif /* HAVE_DVB == 1 */
+}
+
+bool MediaSourceUrl::getKeyFramePosition(int time, float &position) const
+{
+#if HAVE_DVB == 1
+	DvbTsIndexEntry entry;
+
+	if ((fileSize > 0) && keyFrameIndex.findKeyFrame(time, entry)) {
+		position = (float(entry.offset) / fileSize);
+		return true;
+	}
+#else
+	Q_UNUSED(time)
+	Q_UNUSED(position)
+#endif /* HAVE_DVB == 1 */
+
+	return false;
+}
+
 void SeekSlider::mousePressEvent(QMouseEvent *event)
 {
 	int buttons = style()->styleHint(QStyle::SH_Slider_AbsoluteSetButtons);
@@ -177,6 +177,7 @@ private:
 	void keyPressEvent(QKeyEvent *event);
 	void resizeEvent(QResizeEvent *event);
 	void wheelEvent(QWheelEvent *event);
+	void seekToKeyFrame(int time); // milliseconds
 
 	KMenu *menu;
 	AbstractMediaWidget *backend;
@@ -260,6 +261,8 @@ public:
 	virtual QString getDefaultCaption() const { return QString(); }
 	virtual void setCurrentAudioStream(int ) { }
 	virtual void setCurrentSubtitle(int ) { }
+	// time in milliseconds ; position [0 - 1] relative to the file size
+	virtual bool getKeyFramePosition(int , float &) const { return false; }
 	virtual void trackLengthChanged(int ) { }
 	virtual void metadataChanged(const QMap<MediaWidget::MetadataType, QString> &) { }
 	virtual void playbackFinished() { }
@@ -23,8 +23,17 @@
 
 #include <QSlider>
 #include <KDialog>
+#include <config-kaffeine.h>
 #include "mediawidget.h"
 
+#ifndef HAVE_DVB
+#error HAVE_DVB must be defined
+#endif /* HAVE_DVB */
+
+#if HAVE_DVB == 1
+#include "dvb/dvbtsindex.h"
+#endif /* HAVE_DVB == 1 */
+
 class QTimeEdit;
 
 class JumpToPositionDialog : public KDialog
@@ -53,15 +62,21 @@ private:
 class MediaSourceUrl : public MediaSource
 {
 public:
-	MediaSourceUrl(const QUrl &url_, const QUrl &subtitleUrl_) : url(url_),
-		subtitleUrl(subtitleUrl_) { }
+	MediaSourceUrl(const QUrl &url_, const QUrl &subtitleUrl_);
 	~MediaSourceUrl() { }
 
 	Type getType() const { return Url; }
 	QUrl getUrl() const { return url; }
+	bool getKeyFramePosition(int time, float &position) const;
 
 	QUrl url;
 	QUrl subtitleUrl;
+
+#if HAVE_DVB == 1
+private:
+	DvbTsIndex keyFrameIndex; // loaded from the sidecar file of dvb recordings
+	qint64 fileSize;
+#endif /* HAVE_DVB == 1 */
 };
 
 class MediaSourceAudioCd : public MediaSource
@@ -21,7 +21,6 @@
 #include "sqlinterface.h"
 
 #include <QAbstractItemModel>
-#include <QStringList>
 #include "log.h"
 #include "sqlhelper.h"
 
@@ -50,15 +49,17 @@ void SqlInterface::sqlFlush()
 	}
 }
 
-void SqlInterface::sqlInit(const QString &tableName, const QStringList &columnNames)
+void SqlInterface::sqlInit(const QString &tableName, const QStringList &columnNames,
+	const QStringList &indexedColumnNames, const QString &loadCondition)
 {
 	QString existsStatement = QLatin1String("SELECT name FROM sqlite_master WHERE name='") + tableName +
 		QLatin1String("' AND type = 'table'");
 	createStatement = QLatin1String("CREATE TABLE ") + tableName + QLatin1String(" (Id INTEGER PRIMARY KEY, ");
-	QString selectStatement = QLatin1String("SELECT Id, ");
+	selectStatement = QLatin1String("SELECT Id, ");
 	insertStatement = QLatin1String("INSERT INTO ") + tableName + QLatin1String(" (Id, ");
 	updateStatement = QLatin1String("UPDATE ") + tableName + QLatin1String(" SET ");
 	deleteStatement = QLatin1String("DELETE FROM ") + tableName + QLatin1String(" WHERE Id = ?");
+	deleteWhereStatement = QLatin1String("DELETE FROM ") + tableName + QLatin1String(" WHERE ");
 
 	sqlColumnCount = columnNames.size();
 
@@ -89,28 +90,83 @@ void SqlInterface::sqlInit(const QString &tableName, const QStringList &columnNa
 
 	insertStatement.append(QLatin1Char(')'));
 
+	foreach (const QString &columnName, indexedColumnNames) {
+		indexStatements.append(QLatin1String("CREATE INDEX IF NOT EXISTS ") + tableName +
+			columnName + QLatin1String("Index ON ") + tableName + QLatin1String(" (") +
+			columnName + QLatin1Char(')'));
+	}
+
 	if (!sqlHelper->exec(existsStatement).next()) {
 		createTable = true;
 		requestSubmission();
 	} else {
+		// columns which have been added later
+		QStringList existingColumnNames;
+
+		for (QSqlQuery query = sqlHelper->exec(QLatin1String("PRAGMA table_info(") + tableName +
+		     QLatin1Char(')')); query.next();) {
+			existingColumnNames.append(query.value(1).toString());
+		}
+
+		foreach (const QString &columnName, columnNames) {
+			if (!existingColumnNames.contains(columnName)) {
+				sqlHelper->exec(QLatin1String("ALTER TABLE ") + tableName +
+					QLatin1String(" ADD COLUMN ") + columnName);
+			}
+		}
+
+		foreach (const QString &indexStatement, indexStatements) {
+			sqlHelper->exec(indexStatement);
+		}
+
+		QSqlQuery maxQuery =
+			sqlHelper->exec(QLatin1String("SELECT MAX(Id) FROM ") + tableName);
+
+		if (maxQuery.next()) {
+			highestKey = SqlKey(maxQuery.value(0).toUInt());
+		}
+
 		// queries can only be prepared if the table exists
 		insertQuery = sqlHelper->prepare(insertStatement);
 		updateQuery = sqlHelper->prepare(updateStatement);
 		deleteQuery = sqlHelper->prepare(deleteStatement);
 
-		for (QSqlQuery query = sqlHelper->exec(selectStatement); query.next();) {
-			qint64 fullKey = query.value(0).toLongLong();
-			SqlKey sqlKey(static_cast<int>(fullKey));
+		if (loadCondition.isEmpty()) {
+			load(selectStatement);
+		} else {
+			sqlLoad(loadCondition);
+		}
+	}
+}
+
+void SqlInterface::sqlLoad(const QString &condition)
+{
+	if (!createTable) {
+		load(selectStatement + QLatin1String(" WHERE ") + condition);
+	}
+}
 
-			if (!sqlKey.isSqlKeyValid() || (sqlKey.sqlKey != fullKey)) {
-				Log("SqlInterface::sqlInit: invalid key") << fullKey;
-				continue;
-			}
+void SqlInterface::sqlDelete(const QString &condition)
+{
+	if (!createTable) {
+		sqlHelper->exec(deleteWhereStatement + condition);
+	}
+}
 
-			if (!insertFromSqlQuery(sqlKey, query, 1)) {
-				pendingStatements.insert(sqlKey, Remove);
-				requestSubmission();
-			}
+void SqlInterface::load(const QString &statement)
+{
+	for (QSqlQuery query = sqlHelper->exec(statement); query.next();) {
+		qint64 fullKey = query.value(0).toLongLong();
+		SqlKey sqlKey(static_cast<int>(fullKey));
+
+		if (!sqlKey.isSqlKeyValid() || (sqlKey.sqlKey != fullKey)) {
+			Log("SqlInterface::load: invalid key") << fullKey;
+			continue;
+		}
+
+		if (!insertFromSqlQuery(sqlKey, query, 1)) {
+			pendingStatements.insert(sqlKey, Remove);
+			requestSubmission();
 		}
 	}
 }
@@ -192,6 +248,10 @@ void SqlInterface::sqlSubmit()
 		createTable = false;
 		sqlHelper->exec(createStatement);
 
+		foreach (const QString &indexStatement, indexStatements) {
+			sqlHelper->exec(indexStatement);
+		}
+
 		// queries can only be prepared if the table exists
 		insertQuery = sqlHelper->prepare(insertStatement);
 		updateQuery = sqlHelper->prepare(updateStatement);
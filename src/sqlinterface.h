@@ -22,8 +22,10 @@
 #define SQLINTERFACE_H
 
 #include <QExplicitlySharedDataPointer>
+#include <QHash>
 #include <QMap>
 #include <QSqlQuery>
+#include <QStringList>
 
 class SqlHelper;
 
@@ -58,6 +60,11 @@ public:
 		return (sqlKey < other.sqlKey);
 	}
 
+	friend uint qHash(const SqlKey &key)
+	{
+		return qHash(key.sqlKey);
+	}
+
 	quint32 sqlKey;
 };
 
@@ -69,7 +76,20 @@ public:
 	SqlInterface();
 	virtual ~SqlInterface();
 
-	void sqlInit(const QString &tableName, const QStringList &columnNames);
+	// if 'loadCondition' is set, only the matching rows are loaded (see sqlLoad())
+	void sqlInit(const QString &tableName, const QStringList &columnNames,
+		const QStringList &indexedColumnNames = QStringList(),
+		const QString &loadCondition = QString());
+	void sqlLoad(const QString &condition); // loads the rows matching the sql expression
+	// deletes the rows matching the sql expression at once (they must not have been loaded)
+	void sqlDelete(const QString &condition);
+	// the highest key of the table at sqlInit() (also covers the rows which haven't been
+	// loaded yet)
+	SqlKey sqlHighestKey() const
+	{
+		return highestKey;
+	}
+
 	void sqlInsert(SqlKey key);
 	void sqlUpdate(SqlKey key);
 	void sqlRemove(SqlKey key);
@@ -106,18 +126,23 @@ private:
 		Remove
 	};
 
+	void load(const QString &statement);
 	void requestSubmission();
 
 	QExplicitlySharedDataPointer<SqlHelper> sqlHelper;
 	QMap<SqlKey, PendingStatement> pendingStatements;
+	SqlKey highestKey;
 	bool createTable;
 	bool hasPendingStatements;
 
 	int sqlColumnCount;
 	QString createStatement;
+	QStringList indexStatements;
+	QString selectStatement;
 	QString insertStatement;
 	QString updateStatement;
 	QString deleteStatement;
+	QString deleteWhereStatement;
 	QSqlQuery insertQuery;
 	QSqlQuery updateQuery;
 	QSqlQuery deleteQuery;
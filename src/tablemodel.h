@@ -22,6 +22,7 @@
 #define TABLEMODEL_H
 
 #include <QAbstractTableModel>
+#include <QVector>
 
 template<class T> class TableModel : public QAbstractTableModel
 {
@@ -128,6 +129,101 @@ protected:
 		}
 	}
 
+	// one sorted merge and one layout change for the whole batch (items which are already
+	// present are skipped)
+	template<class U> void insertItems(const U &container)
+	{
+		QList<ItemType> newItems;
+
+		for (typename U::ConstIterator it = container.constBegin();
+		     it != container.constEnd(); ++it) {
+			const ItemType &item = *it;
+
+			if (item.isValid() && helper.filterAcceptsItem(item) &&
+			    (binaryFind(item) == items.size())) {
+				newItems.append(item);
+			}
+		}
+
+		if (newItems.isEmpty()) {
+			return;
+		}
+
+		if (newItems.size() == 1) {
+			insert(newItems.at(0));
+			return;
+		}
+
+		qSort(newItems.begin(), newItems.end(), lessThan);
+		beginLayoutChange();
+		QList<ItemType> mergedItems;
+		mergedItems.reserve(items.size() + newItems.size());
+		int i = 0;
+		int j = 0;
+
+		while ((i < items.size()) || (j < newItems.size())) {
+			// existing items come first (like upperBound())
+			if ((j >= newItems.size()) ||
+			    ((i < items.size()) && !lessThan(newItems.at(j), items.at(i)))) {
+				mergedItems.append(items.at(i));
+				++i;
+			} else {
+				mergedItems.append(newItems.at(j));
+				++j;
+			}
+		}
+
+		items = mergedItems;
+		endLayoutChange();
+	}
+
+	// one layout change for the whole batch (items which aren't present are skipped)
+	template<class U> void removeItems(const U &container)
+	{
+		QVector<bool> removedRows(items.size(), false);
+		int removedCount = 0;
+		int lastRow = -1;
+
+		for (typename U::ConstIterator it = container.constBegin();
+		     it != container.constEnd(); ++it) {
+			const ItemType &item = *it;
+
+			if (item.isValid()) {
+				int row = binaryFind(item);
+
+				if ((row < items.size()) && !removedRows.at(row)) {
+					removedRows[row] = true;
+					++removedCount;
+					lastRow = row;
+				}
+			}
+		}
+
+		if (removedCount == 0) {
+			return;
+		}
+
+		if (removedCount == 1) {
+			beginRemoveRows(QModelIndex(), lastRow, lastRow);
+			items.removeAt(lastRow);
+			endRemoveRows();
+			return;
+		}
+
+		beginLayoutChange();
+		QList<ItemType> remainingItems;
+		remainingItems.reserve(items.size() - removedCount);
+
+		for (int i = 0; i < items.size(); ++i) {
+			if (!removedRows.at(i)) {
+				remainingItems.append(items.at(i));
+			}
+		}
+
+		items = remainingItems;
+		endLayoutChange();
+	}
+
 	void aboutToUpdate(const ItemType &item)
 	{
 		updatingRow = -1;
@@ -0,0 +1,207 @@
+/*
+ * benchmarkepg.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QBuffer>
+#include <QCoreApplication>
+#include <QDebug>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include "../src/dvb/dvbepgstore.h"
+#include "../src/dvb/dvbxmltv.h"
+
+/*
+ * fills the epg store and the search index with synthetic events (a limited set of
+ * titles and descriptions, like the repeated shows of a real epg) and reports the memory
+ * usage and timings
+ */
+
+static qint64 residentSize()
+{
+	QFile file(QLatin1String("/proc/self/status"));
+
+	if (!file.open(QIODevice::ReadOnly)) {
+		return 0;
+	}
+
+	foreach (const QByteArray &line, file.readAll().split('\n')) {
+		if (line.startsWith("VmRSS:")) {
+			return (line.mid(6).trimmed().split(' ').first().toLongLong() * 1024);
+		}
+	}
+
+	return 0;
+}
+
+static QString syntheticText(const char *prefix, int index, int length)
+{
+	// a new string every time (like the section parser); the content repeats
+	QString text = QLatin1String(prefix) + QString::number(index);
+
+	while (text.size() < length) {
+		text += QLatin1String(" lorem ipsum ") + QString::number(index);
+	}
+
+	return text;
+}
+
+int main(int argc, char *argv[])
+{
+	QCoreApplication app(argc, argv);
+	QStringList arguments = app.arguments().mid(1);
+	bool interning = true;
+
+	if (!arguments.isEmpty() && (arguments.first() == QLatin1String("--no-interning"))) {
+		interning = false;
+		arguments.removeFirst();
+	}
+
+	if (arguments.size() > 2) {
+		qCritical() << "Syntax: benchmarkepg [--no-interning] [<events> [<channels>]]";
+		return 1;
+	}
+
+	int eventCount = 1000000;
+	int channelCount = 500;
+
+	if (arguments.size() >= 1) {
+		eventCount = qMax(arguments.at(0).toInt(), 1);
+	}
+
+	if (arguments.size() >= 2) {
+		channelCount = qMax(arguments.at(1).toInt(), 1);
+	}
+
+	QList<DvbSharedChannel> channels;
+
+	for (int i = 0; i < channelCount; ++i) {
+		DvbChannel *channel = new DvbChannel();
+		channel->name = QString(QLatin1String("Channel %1")).arg(i);
+		channels.append(DvbSharedChannel(channel));
+	}
+
+	QDateTime baseDateTime = QDateTime::currentDateTime().toUTC();
+	qint64 baseSize = residentSize();
+	DvbEpgStore store;
+	QElapsedTimer timer;
+	timer.start();
+
+	for (int i = 0; i < eventCount; ++i) {
+		// 30 minutes per event, the channels are filled in parallel
+		int channelIndex = (i % channelCount);
+		int eventIndex = (i / channelCount);
+		DvbEpgEntry *entry = new DvbEpgEntry(channels.at(channelIndex));
+		entry->begin = baseDateTime.addSecs(1800 * eventIndex);
+		entry->duration = QTime(0, 30);
+		entry->title = syntheticText("Title ", (i * 7) % 2000, 20);
+		entry->subheading = syntheticText("Subheading ", (i * 11) % 5000, 40);
+		entry->details = syntheticText("Details ", (i * 13) % 20000, 300);
+		entry->eventId = (eventIndex & 0xffff);
+
+		if (interning) {
+			store.intern(entry);
+		}
+
+		store.insert(DvbSharedEpgEntry(entry));
+	}
+
+	qint64 insertTime = timer.restart();
+	int found = 0;
+
+	for (int i = 0; i < 100000; ++i) {
+		int index = ((qint64(i) * 7919) % eventCount);
+		DvbEpgEntry entry(channels.at(index % channelCount));
+		entry.begin = baseDateTime.addSecs(1800 * (index / channelCount));
+		entry.duration = QTime(0, 30);
+		entry.eventId = ((index / channelCount) & 0xffff);
+
+		if (store.find(entry).isValid()) {
+			++found;
+		}
+	}
+
+	qint64 findTime = timer.elapsed();
+	qint64 usedSize = (residentSize() - baseSize);
+
+	qDebug() << store.size() << "events on" << channelCount << "channels," <<
+		(interning ? store.stringCount() : 0) << "interned strings";
+	qDebug() << "memory:" << (usedSize / (1024 * 1024)) << "MiB," <<
+		(usedSize / store.size()) << "bytes per event";
+	qDebug() << "insert:" << insertTime << "ms; 100000 lookups:" << findTime << "ms (" <<
+		found << "found )";
+
+	// full text search
+	DvbEpgSearchIndex searchIndex;
+	timer.restart();
+
+	foreach (const DvbSharedEpgEntry &entry, store.getEntries()) {
+		searchIndex.insert(entry);
+	}
+
+	qint64 indexTime = timer.restart();
+	QStringList queries;
+	queries << QLatin1String("title 1234") << QLatin1String("subheading 42") <<
+		QLatin1String("details 4711 lor") << QLatin1String("t");
+
+	foreach (const QString &query, queries) {
+		timer.restart();
+		int count = searchIndex.find(query).size();
+		qDebug() << "search" << query << ":" << count << "events in" << timer.elapsed() <<
+			"ms";
+	}
+
+	qDebug() << "index:" << indexTime << "ms," <<
+		((residentSize() - baseSize - usedSize) / (1024 * 1024)) << "MiB";
+
+	// xmltv export and import (in memory, so that the disk speed doesn't matter)
+	QBuffer buffer;
+	buffer.open(QIODevice::WriteOnly);
+	timer.restart();
+
+	{
+		DvbXmltvWriter writer(&buffer);
+		writer.writeEntries(store.getEntries(), QMap<QString, QString>());
+		writer.finish();
+	}
+
+	qint64 exportTime = qMax(timer.restart(), qint64(1));
+	buffer.close();
+	buffer.open(QIODevice::ReadOnly);
+	DvbXmltvReader reader(&buffer);
+	QList<DvbXmltvChannel> xmltvChannels;
+	QList<DvbXmltvProgramme> programmes;
+	int programmeCount = 0;
+	bool atEnd = false;
+
+	while (!atEnd) {
+		// the same batch size as the importer
+		atEnd = !reader.read(xmltvChannels, programmes, 1000);
+		programmeCount += programmes.size();
+		programmes.clear();
+	}
+
+	qint64 importTime = qMax(timer.elapsed(), qint64(1));
+	qDebug() << "xmltv export:" << (buffer.size() / (1024 * 1024)) << "MiB in" << exportTime <<
+		"ms," << (qint64(store.size()) * 1000 / exportTime) << "events/s";
+	qDebug() << "xmltv parse:" << programmeCount << "programmes," << xmltvChannels.size() <<
+		"channels in" << importTime << "ms," << (qint64(programmeCount) * 1000 / importTime) <<
+		"events/s";
+	return 0;
+}
@@ -0,0 +1,217 @@
+/*
+ * benchmarkrecording.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QDir>
+#include <QElapsedTimer>
+#include <QFile>
+#include <QStringList>
+#include <unistd.h>
+#include "../src/dvb/dvbfilewriter.h"
+
+/*
+ * writes 'streams' recordings with a fixed bit rate in parallel (the data is sent in
+ * 10 ms intervals like the demux does) and reports dropped data and write latencies
+ */
+
+class Benchmark
+{
+public:
+	Benchmark() : ioUring(false), directIo(false), bitRate(16), duration(30) { }
+	~Benchmark() { }
+
+	bool run(int streams); // returns false if data has been dropped
+
+	QByteArray input; // a multiple of 188 bytes
+	QString outputPath;
+	bool ioUring;
+	bool directIo;
+	int bitRate; // Mbit/s per stream
+	int duration; // seconds
+};
+
+bool Benchmark::run(int streams)
+{
+	DvbFileWriterThread *thread = new DvbFileWriterThread(NULL);
+	thread->setIoUringEnabled(ioUring);
+	QList<DvbFileWriter *> writers;
+	QVector<int> inputOffsets;
+
+	for (int i = 0; i < streams; ++i) {
+		QString fileName = QDir(outputPath).filePath(
+			QString(QLatin1String("benchmark-%1.m2t")).arg(i));
+		QFile::remove(fileName);
+		DvbFileWriter *writer = new DvbFileWriter();
+
+		if (!writer->open(thread, fileName, directIo, 8, 10)) {
+			qCritical() << "Error: can't open file" << fileName;
+			delete writer;
+			break;
+		}
+
+		writers.append(writer);
+		// every stream starts at a different position
+		inputOffsets.append(((input.size() / 188) * i / streams) * 188);
+	}
+
+	// 10 ms worth of data, rounded to whole packets
+	int chunkSize = qMax(((bitRate * 1000000 / 8 / 100) / 188) * 188, 188);
+	QElapsedTimer timer;
+	timer.start();
+	qint64 ticks = 0;
+
+	while (timer.elapsed() < (1000 * qint64(duration))) {
+		for (int i = 0; i < writers.size(); ++i) {
+			int size = chunkSize;
+
+			while (size > 0) {
+				int offset = inputOffsets.at(i);
+				int bytes = qMin(size, input.size() - offset);
+				writers.at(i)->write(input.constData() + offset, bytes);
+				size -= bytes;
+				inputOffsets[i] = ((offset + bytes) % input.size());
+			}
+		}
+
+		QCoreApplication::processEvents();
+		++ticks;
+		qint64 wait = ((10 * ticks) - timer.elapsed());
+
+		if (wait > 0) {
+			usleep(1000 * wait);
+		}
+	}
+
+	qint64 elapsed = timer.elapsed();
+	qint64 overflowBytes = 0;
+
+	foreach (DvbFileWriter *writer, writers) {
+		overflowBytes += writer->getOverflowBytes();
+		writer->close();
+	}
+
+	bool ioUringActive = thread->isIoUringActive();
+	// waits until everything has been written; the latency histograms of the files
+	// are logged when they are closed
+	delete thread;
+
+	qint64 totalBytes = (qint64(writers.size()) * chunkSize * ticks);
+	qDebug() << streams << "streams:" << (ioUringActive ? "io_uring" : "write()") <<
+		"written" << (totalBytes - overflowBytes) / (1024 * 1024) << "MiB in" << elapsed <<
+		"ms, dropped" << overflowBytes << "bytes";
+
+	foreach (DvbFileWriter *writer, writers) {
+		QFile::remove(writer->fileName());
+		delete writer;
+	}
+
+	return ((overflowBytes == 0) && (writers.size() == streams));
+}
+
+int main(int argc, char *argv[])
+{
+	// QCoreApplication is needed for proper file name handling
+	QCoreApplication app(argc, argv);
+	Benchmark benchmark;
+	QString inputFile;
+	bool findMax = false;
+	QStringList arguments = app.arguments().mid(1);
+
+	while (!arguments.isEmpty() && arguments.first().startsWith(QLatin1String("--"))) {
+		QString argument = arguments.takeFirst();
+
+		if (argument == QLatin1String("--io-uring")) {
+			benchmark.ioUring = true;
+		} else if (argument == QLatin1String("--direct-io")) {
+			benchmark.directIo = true;
+		} else if (argument == QLatin1String("--find-max")) {
+			findMax = true;
+		} else if ((argument == QLatin1String("--input")) && !arguments.isEmpty()) {
+			inputFile = arguments.takeFirst();
+		} else {
+			arguments.clear();
+			break;
+		}
+	}
+
+	if ((arguments.size() < 2) || (arguments.size() > 4)) {
+		qCritical() << "Syntax: benchmarkrecording [--io-uring] [--direct-io] [--find-max] "
+			"[--input <ts file>] <output dir> <streams> [<Mbit/s per stream> "
+			"[<seconds>]]";
+		return 1;
+	}
+
+	benchmark.outputPath = arguments.at(0);
+	int streams = qMax(arguments.at(1).toInt(), 1);
+
+	if (arguments.size() >= 3) {
+		benchmark.bitRate = qMax(arguments.at(2).toInt(), 1);
+	}
+
+	if (arguments.size() >= 4) {
+		benchmark.duration = qMax(arguments.at(3).toInt(), 1);
+	}
+
+	if (!inputFile.isEmpty()) {
+		QFile file(inputFile);
+
+		if (!file.open(QIODevice::ReadOnly)) {
+			qCritical() << "Error: can't open file" << file.fileName();
+			return 1;
+		}
+
+		// replaying 64 MiB is enough to defeat any compression or deduplication
+		benchmark.input = file.read(((64 * 1024 * 1024) / 188) * 188);
+		benchmark.input.truncate((benchmark.input.size() / 188) * 188);
+	}
+
+	if (benchmark.input.isEmpty()) {
+		// synthetic stream: null packets with a varying payload
+		benchmark.input.resize(16 * 1024 * 188);
+
+		for (int i = 0; i < benchmark.input.size(); i += 188) {
+			char *packet = (benchmark.input.data() + i);
+			packet[0] = 0x47;
+			packet[1] = 0x1f;
+			packet[2] = char(0xff);
+			packet[3] = char(0x10 | ((i / 188) & 0x0f));
+
+			for (int j = 4; j < 188; ++j) {
+				packet[j] = char(i + j);
+			}
+		}
+	}
+
+	if (!findMax) {
+		return benchmark.run(streams) ? 0 : 2;
+	}
+
+	// increase the number of streams until data is dropped
+	int maxStreams = 0;
+
+	while (benchmark.run(streams)) {
+		maxStreams = streams;
+		streams *= 2;
+	}
+
+	qDebug() << "maximum number of streams without drops:" << maxStreams;
+	return 0;
+}
@@ -0,0 +1,99 @@
+/*
+ * checkrepetitions.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <time.h>
+#include "../src/dvb/dvbrecording.h"
+
+/*
+ * checks the computation of the next repetition of a recording (DvbRecording::
+ * nextRepetition()) across the DST switches of Europe/Berlin in 2011 (spring: 27 March,
+ * 02:00 CET --> 03:00 CEST; autumn: 30 October, 03:00 CEST --> 02:00 CET); the local
+ * start time has to be kept; returns a non-zero exit code if a check fails
+ */
+
+static QDateTime utc(int year, int month, int day, int hour, int minute)
+{
+	return QDateTime(QDate(year, month, day), QTime(hour, minute), Qt::UTC);
+}
+
+static int failedChecks = 0;
+
+static void check(const char *name, const QDateTime &begin, int duration, int repeat,
+	const QDateTime &currentDateTime, const QDateTime &expectedBegin)
+{
+	QDateTime nextBegin =
+		DvbRecording::nextRepetition(begin, duration, repeat, currentDateTime);
+
+	if (nextBegin == expectedBegin) {
+		qDebug() << "ok:" << name << nextBegin.toLocalTime().toString(Qt::ISODate);
+	} else {
+		qDebug() << "FAILED:" << name << "expected" << expectedBegin.toString(Qt::ISODate) <<
+			"got" << nextBegin.toString(Qt::ISODate);
+		++failedChecks;
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	// the time zone has to be set before the first conversion
+	qputenv("TZ", "Europe/Berlin");
+	tzset();
+	QCoreApplication application(argc, argv);
+
+	int daily = ((1 << 7) - 1);
+	int weekdays = ((1 << 5) - 1);
+	int saturday = (1 << 5);
+
+	// 20:00 CET (19:00 UTC) --> 20:00 CEST (18:00 UTC)
+	check("daily, spring", utc(2011, 3, 26, 19, 0), 3600, daily, utc(2011, 3, 26, 20, 30),
+		utc(2011, 3, 27, 18, 0));
+	// 20:00 CEST (18:00 UTC) --> 20:00 CET (19:00 UTC)
+	check("daily, autumn", utc(2011, 10, 29, 18, 0), 3600, daily, utc(2011, 10, 29, 19, 30),
+		utc(2011, 10, 30, 19, 0));
+	// 01:30 CET --> 01:30 CET (the switch happens half an hour after the next begin)
+	check("daily at night, spring", utc(2011, 3, 26, 0, 30), 7200, daily,
+		utc(2011, 3, 26, 3, 0), utc(2011, 3, 27, 0, 30));
+	// friday 20:00 CEST --> monday 20:00 CET
+	check("weekdays, autumn", utc(2011, 10, 28, 18, 0), 3600, weekdays,
+		utc(2011, 10, 28, 19, 30), utc(2011, 10, 31, 19, 0));
+	// the previous saturday has been missed (the computer was switched off)
+	check("weekly, missed, spring", utc(2011, 3, 19, 19, 0), 3600, saturday,
+		utc(2011, 3, 27, 10, 0), utc(2011, 4, 2, 18, 0));
+
+	// three weekly repetitions across the autumn switch keep 20:00 local time
+	QDateTime begin = utc(2011, 10, 15, 18, 0);
+	QList<QDateTime> expectedBegins;
+	expectedBegins << utc(2011, 10, 22, 18, 0) << utc(2011, 10, 29, 18, 0) <<
+		utc(2011, 11, 5, 19, 0);
+
+	foreach (const QDateTime &expectedBegin, expectedBegins) {
+		check("weekly, autumn", begin, 3600, saturday, begin.addSecs(5400), expectedBegin);
+		begin = expectedBegin;
+	}
+
+	if (failedChecks != 0) {
+		qDebug() << failedChecks << "checks failed";
+		return 1;
+	}
+
+	return 0;
+}
@@ -0,0 +1,80 @@
+/*
+ * cutrecording.cpp
+ *
+ * Copyright (C) 2011 Christoph Pfister <christophpfister@gmail.com>
+ *
+ * This program is free software; you can redistribute it and/or modify
+ * it under the terms of the GNU General Public License as published by
+ * the Free Software Foundation; either version 2 of the License, or
+ * (at your option) any later version.
+ *
+ * This program is distributed in the hope that it will be useful,
+ * but WITHOUT ANY WARRANTY; without even the implied warranty of
+ * MERCHANTABILITY or FITNESS FOR A PARTICULAR PURPOSE.  See the
+ * GNU General Public License for more details.
+ *
+ * You should have received a copy of the GNU General Public License along
+ * with this program; if not, write to the Free Software Foundation, Inc.,
+ * 51 Franklin Street, Fifth Floor, Boston, MA 02110-1301 USA.
+ */
+
+#include <QCoreApplication>
+#include <QDebug>
+#include <QStringList>
+#include "../src/dvb/dvbtscutter.h"
+
+// cuts a recording (with index sidecar file) without re-encoding
+
+int main(int argc, char *argv[])
+{
+	// QCoreApplication is needed for proper file name handling
+	QCoreApplication app(argc, argv);
+	QStringList arguments = app.arguments().mid(1);
+	DvbTsCutter cutter;
+	bool ok = true;
+
+	if ((arguments.size() == 5) && (arguments.at(0) == QLatin1String("--trim"))) {
+		// margins in seconds
+		ok = cutter.trim(arguments.at(1), arguments.at(2),
+			1000 * qint64(arguments.at(3).toInt()), 1000 * qint64(arguments.at(4).toInt()));
+	} else if ((arguments.size() >= 3) && !arguments.at(0).startsWith(QLatin1String("--"))) {
+		// ranges in seconds: <begin>-<end>
+		QList<QPair<qint64, qint64> > ranges;
+
+		foreach (const QString &argument, arguments.mid(2)) {
+			QStringList range = argument.split(QLatin1Char('-'));
+
+			if (range.size() != 2) {
+				ranges.clear();
+				break;
+			}
+
+			ranges.append(qMakePair(1000 * qint64(range.at(0).toInt()),
+				1000 * qint64(range.at(1).toInt())));
+		}
+
+		if (ranges.isEmpty()) {
+			arguments.clear();
+		} else {
+			ok = cutter.cut(arguments.at(0), arguments.at(1), ranges);
+		}
+	} else {
+		arguments.clear();
+	}
+
+	if (arguments.isEmpty()) {
+		qCritical() << "Syntax: cutrecording <source> <target> <begin>-<end> [...]";
+		qCritical() << "        cutrecording --trim <source> <target> <begin> <end>";
+		qCritical() << "(times in seconds)";
+		return 1;
+	}
+
+	if (!ok) {
+		qCritical() << "Error: cutting failed";
+		return 2;
+	}
+
+	qDebug() << "copied" << cutter.getCopiedBytes() << "bytes, inserted" <<
+		cutter.getInsertedBytes() << "bytes at the splice points";
+	return 0;
+}